@@ -2,6 +2,9 @@
 #define _CONVNET_CNN_ACTIVFUNC_H_
 #pragma once
 
+#include "../Utility/vecmath.h"
+#include <intrin.h>
+#include <string.h>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -19,6 +22,26 @@ namespace convnet
 
 		virtual void bpropOne(Mat &prevLayerDelta, const Mat &acFeatMaps,
 							  const Mat &currLayerDelta) = 0;
+
+		// bpropOne() gets the inputs instead of the activations
+		virtual bool isInputKept() { return false; }
+
+		// functions whose derivative follows from one bit per element 
+		// keep that bit in mask instead of the activations; maps are 
+		// continuous, mask has (total + 7) / 8 bytes, bit k % 8 of 
+		// byte k / 8 goes with element k. Outputs may alias inputs, 
+		// which is how activations run in place
+		virtual bool isMaskSupported() { return false; }
+
+		virtual void fpropMasked(Mat &acFeatMaps, const Mat &inFeatMaps, Mat &mask) {}
+
+		virtual void bpropMasked(Mat &prevLayerDelta, const Mat &currLayerDelta, 
+								 const Mat &mask) {}
+
+		static inline int getMaskBytes(const int total)
+		{
+			return (total + 7) / 8;
+		}
 	};
 }
 
@@ -53,6 +76,22 @@ namespace convnet
 			int cols = currLayerDelta.cols;
 			memcpy(prevLayerDelta.data, currLayerDelta.data, rows * cols * sizeof(float));
 		}
+
+		// identity both ways, nothing to keep
+		virtual bool isMaskSupported() { return true; }
+
+		virtual void fpropMasked(Mat &acFeatMaps, const Mat &inFeatMaps, Mat &mask)
+		{
+			if (acFeatMaps.data != inFeatMaps.data)
+				memcpy(acFeatMaps.data, inFeatMaps.data, inFeatMaps.total() * sizeof(float));
+		}
+
+		virtual void bpropMasked(Mat &prevLayerDelta, const Mat &currLayerDelta, 
+								 const Mat &mask)
+		{
+			if (prevLayerDelta.data != currLayerDelta.data)
+				memcpy(prevLayerDelta.data, currLayerDelta.data, currLayerDelta.total() * sizeof(float));
+		}
 	};
 
 
@@ -64,20 +103,128 @@ namespace convnet
 	class SigmoidFunction : public ActivFunction
 	{
 	public:
-		SigmoidFunction() {}
+		SigmoidFunction(const MathAccuracy accuracy = MATH_ACCURATE)
+		{
+			this->accuracy = accuracy;
+		}
+
 		virtual ~SigmoidFunction() {}
 
 		virtual void fpropOne(Mat &acFeatMaps, const Mat &inFeatMaps)
 		{
-			cv::exp(-inFeatMaps, acFeatMaps);
-			acFeatMaps = 1 / (acFeatMaps + 1);
+			vecSigmoid((float *)acFeatMaps.data, (const float *)inFeatMaps.data,
+					   (int)inFeatMaps.total(), accuracy);
+		}
+
+		virtual void bpropOne(Mat &prevLayerDelta, const Mat &acFeatMaps,
+							  const Mat &currLayerDelta)
+		{
+			vecSigmoidGrad((float *)prevLayerDelta.data, (const float *)acFeatMaps.data,
+						   (const float *)currLayerDelta.data, (int)currLayerDelta.total());
+		}
+	private:
+		MathAccuracy accuracy;
+	};
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//							 tanh activation function
+	//
+	// ----------------------------------------------------------------------------
+	class TanhFunction : public ActivFunction
+	{
+	public:
+		TanhFunction(const MathAccuracy accuracy = MATH_ACCURATE)
+		{
+			this->accuracy = accuracy;
+		}
+
+		virtual ~TanhFunction() {}
+
+		virtual void fpropOne(Mat &acFeatMaps, const Mat &inFeatMaps)
+		{
+			vecTanh((float *)acFeatMaps.data, (const float *)inFeatMaps.data,
+					(int)inFeatMaps.total(), accuracy);
 		}
 
 		virtual void bpropOne(Mat &prevLayerDelta, const Mat &acFeatMaps,
 							  const Mat &currLayerDelta)
 		{
-			prevLayerDelta = acFeatMaps.mul(1 - acFeatMaps).mul(currLayerDelta);
+			vecTanhGrad((float *)prevLayerDelta.data, (const float *)acFeatMaps.data,
+						(const float *)currLayerDelta.data, (int)currLayerDelta.total());
+		}
+	private:
+		MathAccuracy accuracy;
+	};
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//							  elu activation function
+	//
+	// ----------------------------------------------------------------------------
+	class ELUFunction : public ActivFunction
+	{
+	public:
+		ELUFunction(const float alpha, const MathAccuracy accuracy = MATH_ACCURATE)
+		{
+			this->alpha = alpha;
+			this->accuracy = accuracy;
+		}
+
+		virtual ~ELUFunction() {}
+
+		virtual void fpropOne(Mat &acFeatMaps, const Mat &inFeatMaps)
+		{
+			vecELU((float *)acFeatMaps.data, (const float *)inFeatMaps.data,
+				   (int)inFeatMaps.total(), alpha, accuracy);
+		}
+
+		virtual void bpropOne(Mat &prevLayerDelta, const Mat &acFeatMaps,
+							  const Mat &currLayerDelta)
+		{
+			vecELUGrad((float *)prevLayerDelta.data, (const float *)acFeatMaps.data,
+					   (const float *)currLayerDelta.data, (int)currLayerDelta.total(), alpha);
+		}
+	private:
+		float alpha;
+		MathAccuracy accuracy;
+	};
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//							  gelu activation function
+	//
+	// ----------------------------------------------------------------------------
+	class GELUFunction : public ActivFunction
+	{
+	public:
+		GELUFunction(const MathAccuracy accuracy = MATH_ACCURATE)
+		{
+			this->accuracy = accuracy;
+		}
+
+		virtual ~GELUFunction() {}
+
+		virtual void fpropOne(Mat &acFeatMaps, const Mat &inFeatMaps)
+		{
+			vecGELU((float *)acFeatMaps.data, (const float *)inFeatMaps.data,
+					(int)inFeatMaps.total(), accuracy);
+		}
+
+		// the derivative is not a function of the output
+		virtual bool isInputKept() { return true; }
+
+		virtual void bpropOne(Mat &prevLayerDelta, const Mat &inFeatMaps,
+							  const Mat &currLayerDelta)
+		{
+			vecGELUGrad((float *)prevLayerDelta.data, (const float *)inFeatMaps.data,
+						(const float *)currLayerDelta.data, (int)currLayerDelta.total(), accuracy);
 		}
+	private:
+		MathAccuracy accuracy;
 	};
 
 
@@ -103,6 +250,157 @@ namespace convnet
 			cv::threshold(acFeatMaps, prevLayerDelta, 0, 1, CV_THRESH_BINARY);
 			prevLayerDelta = prevLayerDelta.mul(currLayerDelta);
 		}
+
+		// bit set where the input is positive, 8 elements per byte: two
+		// compares give two 4-bit movemasks, the bits select in bprop
+		virtual bool isMaskSupported() { return true; }
+
+		virtual void fpropMasked(Mat &acFeatMaps, const Mat &inFeatMaps, Mat &mask)
+		{
+			const float *inPtr = (const float *)inFeatMaps.data;
+			float *acPtr = (float *)acFeatMaps.data;
+			uchar *maskPtr = mask.data;
+			int total = (int)inFeatMaps.total();
+			__m128 zero = _mm_setzero_ps();
+
+			int k = 0;
+			for (; k + 8 <= total; k += 8) {
+				__m128 v0 = _mm_loadu_ps(inPtr + k);
+				__m128 v1 = _mm_loadu_ps(inPtr + k + 4);
+				__m128 m0 = _mm_cmpgt_ps(v0, zero);
+				__m128 m1 = _mm_cmpgt_ps(v1, zero);
+				_mm_storeu_ps(acPtr + k, _mm_and_ps(v0, m0));
+				_mm_storeu_ps(acPtr + k + 4, _mm_and_ps(v1, m1));
+				maskPtr[k >> 3] = (uchar)(_mm_movemask_ps(m0) | (_mm_movemask_ps(m1) << 4));
+			}
+			if (k < total) {
+				uchar bits = 0;
+				for (int j = 0; k + j < total; ++j) {
+					bool isPositive = inPtr[k + j] > 0;
+					bits |= (uchar)(isPositive << j);
+					acPtr[k + j] = isPositive ? inPtr[k + j] : 0;
+				}
+				maskPtr[k >> 3] = bits;
+			}
+		}
+
+		virtual void bpropMasked(Mat &prevLayerDelta, const Mat &currLayerDelta, 
+								 const Mat &mask)
+		{
+			const float *currPtr = (const float *)currLayerDelta.data;
+			float *prevPtr = (float *)prevLayerDelta.data;
+			const uchar *maskPtr = mask.data;
+			int total = (int)currLayerDelta.total();
+			__m128i lowBits = _mm_setr_epi32(1, 2, 4, 8);
+			__m128i highBits = _mm_setr_epi32(16, 32, 64, 128);
+
+			int k = 0;
+			for (; k + 8 <= total; k += 8) {
+				__m128i bits = _mm_set1_epi32(maskPtr[k >> 3]);
+				__m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(bits, lowBits), lowBits);
+				__m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(bits, highBits), highBits);
+				_mm_storeu_ps(prevPtr + k, _mm_and_ps(_mm_loadu_ps(currPtr + k), _mm_castsi128_ps(m0)));
+				_mm_storeu_ps(prevPtr + k + 4, _mm_and_ps(_mm_loadu_ps(currPtr + k + 4), _mm_castsi128_ps(m1)));
+			}
+			for (; k < total; ++k)
+				prevPtr[k] = (maskPtr[k >> 3] >> (k & 7)) & 1 ? currPtr[k] : 0;
+		}
+	};
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//						   leaky relu activation function
+	//
+	// ----------------------------------------------------------------------------
+	class LeakyReLUFunction : public ActivFunction
+	{
+	public:
+		LeakyReLUFunction(const float slope)
+		{
+			this->slope = slope;
+		}
+
+		virtual ~LeakyReLUFunction() {}
+
+		virtual void fpropOne(Mat &acFeatMaps, const Mat &inFeatMaps)
+		{
+			const float *inPtr = (const float *)inFeatMaps.data;
+			float *acPtr = (float *)acFeatMaps.data;
+			for (int k = 0; k < (int)inFeatMaps.total(); ++k)
+				acPtr[k] = inPtr[k] > 0 ? inPtr[k] : inPtr[k] * slope;
+		}
+
+		// activations are positive where the inputs are
+		virtual void bpropOne(Mat &prevLayerDelta, const Mat &acFeatMaps,
+							  const Mat &currLayerDelta)
+		{
+			const float *acPtr = (const float *)acFeatMaps.data;
+			const float *currPtr = (const float *)currLayerDelta.data;
+			float *prevPtr = (float *)prevLayerDelta.data;
+			for (int k = 0; k < (int)currLayerDelta.total(); ++k)
+				prevPtr[k] = acPtr[k] > 0 ? currPtr[k] : currPtr[k] * slope;
+		}
+
+		// the same bits as ReLU, the negative side is scaled instead of zeroed
+		virtual bool isMaskSupported() { return true; }
+
+		virtual void fpropMasked(Mat &acFeatMaps, const Mat &inFeatMaps, Mat &mask)
+		{
+			const float *inPtr = (const float *)inFeatMaps.data;
+			float *acPtr = (float *)acFeatMaps.data;
+			uchar *maskPtr = mask.data;
+			int total = (int)inFeatMaps.total();
+			__m128 zero = _mm_setzero_ps();
+			__m128 s = _mm_set1_ps(slope);
+
+			int k = 0;
+			for (; k + 8 <= total; k += 8) {
+				__m128 v0 = _mm_loadu_ps(inPtr + k);
+				__m128 v1 = _mm_loadu_ps(inPtr + k + 4);
+				__m128 m0 = _mm_cmpgt_ps(v0, zero);
+				__m128 m1 = _mm_cmpgt_ps(v1, zero);
+				_mm_storeu_ps(acPtr + k, _mm_or_ps(_mm_and_ps(m0, v0), _mm_andnot_ps(m0, _mm_mul_ps(v0, s))));
+				_mm_storeu_ps(acPtr + k + 4, _mm_or_ps(_mm_and_ps(m1, v1), _mm_andnot_ps(m1, _mm_mul_ps(v1, s))));
+				maskPtr[k >> 3] = (uchar)(_mm_movemask_ps(m0) | (_mm_movemask_ps(m1) << 4));
+			}
+			if (k < total) {
+				uchar bits = 0;
+				for (int j = 0; k + j < total; ++j) {
+					bool isPositive = inPtr[k + j] > 0;
+					bits |= (uchar)(isPositive << j);
+					acPtr[k + j] = isPositive ? inPtr[k + j] : inPtr[k + j] * slope;
+				}
+				maskPtr[k >> 3] = bits;
+			}
+		}
+
+		virtual void bpropMasked(Mat &prevLayerDelta, const Mat &currLayerDelta, 
+								 const Mat &mask)
+		{
+			const float *currPtr = (const float *)currLayerDelta.data;
+			float *prevPtr = (float *)prevLayerDelta.data;
+			const uchar *maskPtr = mask.data;
+			int total = (int)currLayerDelta.total();
+			__m128i lowBits = _mm_setr_epi32(1, 2, 4, 8);
+			__m128i highBits = _mm_setr_epi32(16, 32, 64, 128);
+			__m128 s = _mm_set1_ps(slope);
+
+			int k = 0;
+			for (; k + 8 <= total; k += 8) {
+				__m128i bits = _mm_set1_epi32(maskPtr[k >> 3]);
+				__m128 m0 = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, lowBits), lowBits));
+				__m128 m1 = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(bits, highBits), highBits));
+				__m128 d0 = _mm_loadu_ps(currPtr + k);
+				__m128 d1 = _mm_loadu_ps(currPtr + k + 4);
+				_mm_storeu_ps(prevPtr + k, _mm_or_ps(_mm_and_ps(m0, d0), _mm_andnot_ps(m0, _mm_mul_ps(d0, s))));
+				_mm_storeu_ps(prevPtr + k + 4, _mm_or_ps(_mm_and_ps(m1, d1), _mm_andnot_ps(m1, _mm_mul_ps(d1, s))));
+			}
+			for (; k < total; ++k)
+				prevPtr[k] = (maskPtr[k >> 3] >> (k & 7)) & 1 ? currPtr[k] : currPtr[k] * slope;
+		}
+	private:
+		float slope;
 	};
 
 
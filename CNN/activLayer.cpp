@@ -16,17 +16,29 @@
 
 namespace convnet
 {
-	ActivLayer::ActivLayer(Mat4D &inFeatMaps, const int numThreads)
+	// the slab goes through the activation in chunks of this many 
+	// floats, whatever its layout; a multiple of 8 so that every chunk
+	// starts on a byte of the mask
+	enum { ACTIV_CHUNK_DIMS = 16384 };
+
+
+	ActivLayer::ActivLayer(Tensor &inFeatMaps, const int numThreads)
 	{
 		this->inFeatMaps = inFeatMaps;
 		this->numThreads = numThreads;
+		this->activFunc = NULL;
+		this->mathAccuracy = MATH_ACCURATE;
+		this->slope = 0.01f;
+		this->alpha = 1.0f;
+		this->isInPlace = false;
 	}
 
 	ActivLayer::~ActivLayer()
 	{
-		inFeatMaps.clear();
-		tmFeatMaps.clear();
-		ouFeatMaps.clear();
+		inFeatMaps.release();
+		tmFeatMaps.release();
+		ouFeatMaps.release();
+		maskMaps.release();
 		if (activFunc != NULL) {
 			delete activFunc;
 			activFunc = NULL;
@@ -37,24 +49,30 @@ namespace convnet
 	{
 		NONFC_INPUT_INIT(inFeatMaps);
 
+		// get activation function
+		if (activFunc != NULL)
+			delete activFunc;
+		activFunc = getActivFunction(activFuncName, mathAccuracy);
+
 		// allocate space for output feature maps
 		int numImages = inFeatMaps.size();
-		int chns = inFeatMaps[0].size();
-		int rows = inFeatMaps[0][0].rows;
-		int cols = inFeatMaps[0][0].cols;
-		ouFeatMaps.resize(numImages);
-		tmFeatMaps.resize(numImages);
-		for (int i = 0; i < numImages; ++i) {
-			ouFeatMaps[i].resize(chns);
-			tmFeatMaps[i].resize(chns);
-			for (int ch = 0; ch < chns; ++ch) {
-				ouFeatMaps[i][ch] = Mat::zeros(rows, cols, CV_32FC1);
-				tmFeatMaps[i][ch] = Mat::zeros(rows, cols, CV_32FC1);
-			}
+		int chns = inFeatMaps.getChns();
+		int rows = inFeatMaps.getRows();
+		int cols = inFeatMaps.getCols();
+		if (isInPlaceMaps())
+			ouFeatMaps = inFeatMaps;
+		else
+			ouFeatMaps.create(numImages, chns, rows, cols, inFeatMaps.getLayout());
+
+		// tmFeatMaps keeps what bpropOne() needs, masked maps keep bits
+		if (isMaskedMaps()) {
+			tmFeatMaps.release();
+			maskMaps = Mat::zeros(1, ActivFunction::getMaskBytes(inFeatMaps.getTotal()), CV_8UC1);
+		}
+		else {
+			tmFeatMaps.create(numImages, chns, rows, cols, inFeatMaps.getLayout());
+			maskMaps.release();
 		}
-
-		// get activation function
-		activFunc = getActivFunction(activFuncName);
 	}
 
 	void ActivLayer::fprop()
@@ -62,66 +80,67 @@ namespace convnet
 		NONFC_INPUT_INIT(inFeatMaps);
 		NONFC_OUTPUT_INIT(ouFeatMaps);
 
-		int numImages = inFeatMaps.size();
+		int total = inFeatMaps.getTotal();
+		int numChunks = (total + ACTIV_CHUNK_DIMS - 1) / ACTIV_CHUNK_DIMS;
+		bool isMasked = isMaskedMaps();
+		bool isInputKept = !isMasked && activFunc->isInputKept();
 
 		#ifdef _OPENMP
 		#pragma omp parallel for
 		#endif
 
-		for (int i = 0; i < numImages; ++i) {
-			fpropOne(tmFeatMaps[i], inFeatMaps[i], activFunc);
-			copyToOutputMaps(ouFeatMaps[i], tmFeatMaps[i]);
+		for (int c = 0; c < numChunks; ++c) {
+			int offset = c * ACTIV_CHUNK_DIMS;
+			int dims = min((int)ACTIV_CHUNK_DIMS, total - offset);
+			Mat inChunk(1, dims, CV_32FC1, inFeatMaps.ptr() + offset);
+			Mat ouChunk(1, dims, CV_32FC1, ouFeatMaps.ptr() + offset);
+
+			if (isMasked) {
+				Mat mask = maskMaps.colRange(offset / 8, offset / 8 + ActivFunction::getMaskBytes(dims));
+				activFunc->fpropMasked(ouChunk, inChunk, mask);
+				continue;
+			}
+
+			Mat tmChunk(1, dims, CV_32FC1, tmFeatMaps.ptr() + offset);
+			if (isInputKept)
+				memcpy(tmChunk.data, inChunk.data, dims * sizeof(float));
+			activFunc->fpropOne(ouChunk, inChunk);
+			if (!isInputKept)
+				memcpy(tmChunk.data, ouChunk.data, dims * sizeof(float));
 		}
 	}
 
+	// in place, ouFeatMaps is inFeatMaps and the next layer left its 
+	// delta there
 	void ActivLayer::bprop()
 	{
 		NONFC_INPUT_INIT(inFeatMaps);
 		NONFC_OUTPUT_INIT(ouFeatMaps);
 
-		int numImages = inFeatMaps.size();
+		int total = inFeatMaps.getTotal();
+		int numChunks = (total + ACTIV_CHUNK_DIMS - 1) / ACTIV_CHUNK_DIMS;
+		bool isMasked = isMaskedMaps();
 
 		#ifdef _OPENMP
 		#pragma omp parallel for
 		#endif
 
-		for (int i = 0; i < numImages; ++i) {
-			bpropOne(inFeatMaps[i], tmFeatMaps[i], ouFeatMaps[i],
-				     activFunc);
-		}
-	}
-
-
-
-	// ----------------------------------------------------------------------------
-	//
-	//								private function impl
-	//
-	// ----------------------------------------------------------------------------
-	void ActivLayer::fpropOne(Mat3D &tmFeatMaps, const Mat3D &inFeatMaps,
-							  ActivFunction *func)
-	{
-		for (int ch = 0; ch < inFeatMaps.size(); ++ch) {
-			func->fpropOne(tmFeatMaps[ch], inFeatMaps[ch]);
-		}
-	}
+		for (int c = 0; c < numChunks; ++c) {
+			int offset = c * ACTIV_CHUNK_DIMS;
+			int dims = min((int)ACTIV_CHUNK_DIMS, total - offset);
+			Mat inChunk(1, dims, CV_32FC1, inFeatMaps.ptr() + offset);
+			Mat ouChunk(1, dims, CV_32FC1, ouFeatMaps.ptr() + offset);
 
-	void ActivLayer::bpropOne(Mat3D &inFeatMaps, const Mat3D &tmFeatMaps,
-							  const Mat3D &ouFeatMaps, ActivFunction *func)
-	{
-		for (int ch = 0; ch < inFeatMaps.size(); ++ch) {
-			func->bpropOne(inFeatMaps[ch], tmFeatMaps[ch], ouFeatMaps[ch]);
+			if (isMasked) {
+				Mat mask = maskMaps.colRange(offset / 8, offset / 8 + ActivFunction::getMaskBytes(dims));
+				activFunc->bpropMasked(inChunk, ouChunk, mask);
+			}
+			else {
+				Mat tmChunk(1, dims, CV_32FC1, tmFeatMaps.ptr() + offset);
+				activFunc->bpropOne(inChunk, tmChunk, ouChunk);
+			}
 		}
 	}
-
-
-	void ActivLayer::copyToOutputMaps(Mat3D &ouFeatMaps, const Mat3D &tmFeatMaps)
-	{
-		int rows = ouFeatMaps[0].rows;
-		int cols = ouFeatMaps[0].cols;
-		for (int ch = 0; ch < ouFeatMaps.size(); ++ch)
-			memcpy(ouFeatMaps[ch].data, tmFeatMaps[ch].data, rows * cols * sizeof(float));
-	}
 }
 
 
@@ -139,6 +158,7 @@ namespace convnet
 		inFeatMaps.release();
 		tmFeatMaps.release();
 		ouFeatMaps.release();
+		maskMaps.release();
 		if (activFunc != NULL) {
 			delete activFunc;
 			activFunc = NULL;
@@ -150,30 +170,61 @@ namespace convnet
 	{
 		FC_INPUT_INIT(inFeatMaps);
 
-		// allocate space for output feature maps
-		tmFeatMaps = Mat::zeros(inFeatMaps.size(), CV_32FC1);
-		ouFeatMaps = Mat::zeros(inFeatMaps.size(), CV_32FC1);
-
 		// get activation function
-		activFunc = getActivFunction(activFuncName);
+		if (activFunc != NULL)
+			delete activFunc;
+		activFunc = getActivFunction(activFuncName, mathAccuracy);
+
+		// allocate space for output feature maps
+		if (isInPlaceMaps())
+			ouFeatMaps = inFeatMaps;
+		else
+			ouFeatMaps = Mat::zeros(inFeatMaps.size(), CV_32FC1);
+
+		if (isMaskedMaps()) {
+			tmFeatMaps.release();
+			maskMaps = Mat::zeros(1, ActivFunction::getMaskBytes((int)inFeatMaps.total()), CV_8UC1);
+		}
+		else {
+			tmFeatMaps = Mat::zeros(inFeatMaps.size(), CV_32FC1);
+			maskMaps.release();
+		}
 	}
 
 	void FCActivLayer::fprop()
 	{
 		FC_INPUT_INIT(inFeatMaps);
-		FC_OUTPUT_INIT(tmFeatMaps);
 		FC_OUTPUT_INIT(ouFeatMaps);
 
-		fpropOne(tmFeatMaps, inFeatMaps, activFunc);
-		copyToOutputMaps(ouFeatMaps, tmFeatMaps);
+		if (isMaskedMaps()) {
+			activFunc->fpropMasked(ouFeatMaps, inFeatMaps, maskMaps);
+			return;
+		}
+
+		FC_OUTPUT_INIT(tmFeatMaps);
+
+		if (activFunc->isInputKept()) {
+			copyToOutputMaps(tmFeatMaps, inFeatMaps);
+			fpropOne(ouFeatMaps, inFeatMaps, activFunc);
+		}
+		else {
+			fpropOne(tmFeatMaps, inFeatMaps, activFunc);
+			copyToOutputMaps(ouFeatMaps, tmFeatMaps);
+		}
 	}
 
 	void FCActivLayer::bprop()
 	{
 		FC_INPUT_INIT(inFeatMaps);
-		FC_OUTPUT_INIT(tmFeatMaps);
 		FC_OUTPUT_INIT(ouFeatMaps);
 
+		if (isMaskedMaps()) {
+			activFunc->bpropMasked(inFeatMaps, ouFeatMaps, maskMaps);
+			return;
+		}
+
+		FC_OUTPUT_INIT(tmFeatMaps);
+
 		bpropOne(inFeatMaps, tmFeatMaps, ouFeatMaps, activFunc);
 	}
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "activFunc.h"
 #include "layer.h"
 #include <string>
@@ -14,21 +15,38 @@ namespace convnet
 	class ActivLayer : public Layer
 	{
 	public:
-		ActivLayer() {}
+		ActivLayer() : activFunc(NULL), mathAccuracy(MATH_ACCURATE), slope(0.01f), alpha(1.0f), 
+					   isInPlace(false) {}
 
-		ActivLayer(Mat4D &inFeatMaps, const int numThreads = 1);
+		ActivLayer(Tensor &inFeatMaps, const int numThreads = 1);
 		
 		virtual ~ActivLayer();
 
-		inline void setNFCInFeatMaps(Mat4D &inFeatMaps);
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
 
 		inline void setActivFuncName(const string &activFuncName);
 
+		// overwrite the input maps instead of writing new ones, the next 
+		// layer then shares them and bprop works on them too; used when
+		// the function keeps a mask (ReLU, Linear) and the layer before
+		// does not need its outputs in bprop
+		inline void setInPlace(const bool isInPlace);
+
 		inline void setNumThreads(const int numThreads = 1);
 
-		inline ActivFunction *getActivFunction(const string &activFuncName);
+		// "Sigmoid", "Tanh", "ELU" and "GELU" use their exp polynomials 
+		// at the given accuracy
+		inline void setMathAccuracy(const MathAccuracy accuracy);
+
+		// slope of "LeakyReLU" for x < 0, alpha of "ELU"
+		inline void setActivParams(const float slope, const float alpha);
+
+		inline ActivFunction *getActivFunction(const string &activFuncName,
+											   const MathAccuracy accuracy = MATH_ACCURATE);
 
-		inline Mat4D &getNFCOuFeatMaps();
+		inline Tensor &getNFCOuFeatMaps();
+
+		inline void getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps);
 
 		void init();
 
@@ -36,29 +54,36 @@ namespace convnet
 		
 		void bprop();
 		
+	protected:
+		// ReLU / LeakyReLU / Linear keep a bit mask instead of their activations
+		inline bool isMaskedMaps();
+
+		inline bool isInPlaceMaps();
+
 	protected:
 		int numThreads;
 		string activFuncName;
 		ActivFunction *activFunc;
+		MathAccuracy mathAccuracy;
+		float slope;
+		float alpha;
+		bool isInPlace;
+		Mat maskMaps;		// bits of masked maps that bprop needs, see ActivFunction
 
 	private:
-		void fpropOne(Mat3D &tmFeatMaps, const Mat3D &inFeatMaps, ActivFunction *func);
-
-		void bpropOne(Mat3D &inFeatMaps, const Mat3D &tmFeatMaps, const Mat3D &ouFeatMaps,
-			          ActivFunction *func);
-
-		void copyToOutputMaps(Mat3D &ouFeatMaps, const Mat3D &tmFeatMaps);
-
-	private:
-		Mat4D inFeatMaps;
-		Mat4D tmFeatMaps;
-		Mat4D ouFeatMaps;
+		Tensor inFeatMaps;
+		Tensor tmFeatMaps;
+		Tensor ouFeatMaps;
 	};
 
 
-	inline void ActivLayer::setNFCInFeatMaps(Mat4D &inFeatMaps)
+	inline void ActivLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
+
+		// re-linked after init(), e.g. a dropout layer was removed
+		if (isInPlaceMaps())
+			this->ouFeatMaps = inFeatMaps;
 	}
 
 	inline void ActivLayer::setActivFuncName(const string &activFuncName)
@@ -66,28 +91,65 @@ namespace convnet
 		this->activFuncName = activFuncName;
 	}
 
+	inline void ActivLayer::setInPlace(const bool isInPlace)
+	{
+		this->isInPlace = isInPlace;
+	}
+
 	inline void ActivLayer::setNumThreads(const int numThreads)
 	{
 		this->numThreads;
 	}
 
-	inline Mat4D &ActivLayer::getNFCOuFeatMaps()
+	inline Tensor &ActivLayer::getNFCOuFeatMaps()
 	{
 		return this->ouFeatMaps;
 	}
 
+	inline void ActivLayer::getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps)
+	{
+		if (!ouFeatMaps.empty() && !isInPlaceMaps())
+			outputs.push_back(&ouFeatMaps);
+		if (!tmFeatMaps.empty())
+			temps.push_back(&tmFeatMaps);
+	}
+
+
+	inline void ActivLayer::setMathAccuracy(const MathAccuracy accuracy)
+	{
+		this->mathAccuracy = accuracy;
+	}
+
+	inline void ActivLayer::setActivParams(const float slope, const float alpha)
+	{
+		this->slope = slope;
+		this->alpha = alpha;
+	}
 
-	inline ActivFunction *ActivLayer::getActivFunction(const string &activFuncName)
+	inline ActivFunction *ActivLayer::getActivFunction(const string &activFuncName,
+													   const MathAccuracy accuracy)
 	{
 		if (!_strcmpi("Linear", activFuncName.c_str()))
 			return new LinearFunction;
 
 		else if (!_strcmpi("Sigmoid", activFuncName.c_str()))
-			return new SigmoidFunction;
+			return new SigmoidFunction(accuracy);
+
+		else if (!_strcmpi("Tanh", activFuncName.c_str()))
+			return new TanhFunction(accuracy);
 
 		else if (!_strcmpi("ReLU", activFuncName.c_str()))
 			return new ReLUFunction;
 
+		else if (!_strcmpi("LeakyReLU", activFuncName.c_str()))
+			return new LeakyReLUFunction(slope);
+
+		else if (!_strcmpi("ELU", activFuncName.c_str()))
+			return new ELUFunction(alpha, accuracy);
+
+		else if (!_strcmpi("GELU", activFuncName.c_str()))
+			return new GELUFunction(accuracy);
+
 		//[TODO params.bound in BoundReLU]
 		else if (!_strcmpi("BReLU", activFuncName.c_str()))
 			return new BoundReLUFunction(1);
@@ -95,6 +157,16 @@ namespace convnet
 		else return NULL;
 	}
 
+	inline bool ActivLayer::isMaskedMaps()
+	{
+		return activFunc != NULL && activFunc->isMaskSupported();
+	}
+
+	inline bool ActivLayer::isInPlaceMaps()
+	{
+		return isInPlace && isMaskedMaps();
+	}
+
 }
 
 
@@ -116,6 +188,8 @@ namespace convnet
 
 		inline Mat &getFCOuFeatMaps();
 
+		inline void getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps);
+
 		void init();
 
 		void fprop();
@@ -140,6 +214,9 @@ namespace convnet
 	inline void FCActivLayer::setFCInFeatMaps(Mat &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
+
+		if (isInPlaceMaps())
+			this->ouFeatMaps = inFeatMaps;
 	}
 
 	inline void FCActivLayer::setNumThreads(const int numThreads)
@@ -151,6 +228,14 @@ namespace convnet
 	{
 		return this->ouFeatMaps;
 	}
+
+	inline void FCActivLayer::getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps)
+	{
+		if (!ouFeatMaps.empty() && !isInPlaceMaps())
+			outputs.push_back(&ouFeatMaps);
+		if (!tmFeatMaps.empty())
+			temps.push_back(&tmFeatMaps);
+	}
 }
 
 #endif // activation layer
\ No newline at end of file
@@ -15,26 +15,25 @@
 
 namespace convnet 
 {
-	ConcatLayer::ConcatLayer(Mat4D &inFeatMaps, const int numThreads)
+	ConcatLayer::ConcatLayer(Tensor &inFeatMaps, const int numThreads)
 	{
 		this->inFeatMaps = inFeatMaps;
 		this->numThreads = numThreads;
+		this->isOutputView = false;
 	}
 
 	ConcatLayer::~ConcatLayer()
 	{
-		inFeatMaps.clear();
+		inFeatMaps.release();
+		ouFeatMaps.release();
 	}
 
 	void ConcatLayer::init()
 	{
 		NONFC_INPUT_INIT(inFeatMaps);
 
-		int numImages = inFeatMaps.size();
-		int dims = inFeatMaps[0].size() * wparams.height * wparams.width;
-		int numBlocks = (inFeatMaps[0][0].rows - wparams.height + 1) * 
-						(inFeatMaps[0][0].cols - wparams.width + 1);
-		ouFeatMaps = Mat::zeros(numBlocks * numImages, dims, CV_32FC1);
+		ouFeatMaps.release();
+		bindOutputMaps();
 	}
 
 	void ConcatLayer::fprop()
@@ -42,9 +41,13 @@ namespace convnet
 		NONFC_INPUT_INIT(inFeatMaps);
 		FC_OUTPUT_INIT(ouFeatMaps);
 
+		// outputs are the input tensor itself
+		if (isInputView())
+			return;
+
 		int numImages = inFeatMaps.size();
-		int numBlocks = (inFeatMaps[0][0].rows - wparams.height + 1) *
-						(inFeatMaps[0][0].cols - wparams.width + 1);
+		int numBlocks = (inFeatMaps.getRows() - wparams.height + 1) *
+						(inFeatMaps.getCols() - wparams.width + 1);
 
 		#ifdef _OPENMP
 		#pragma omp parallel for
@@ -61,9 +64,13 @@ namespace convnet
 		NONFC_INPUT_INIT(inFeatMaps);
 		FC_OUTPUT_INIT(ouFeatMaps);
 
+		// the fc layer wrote its dz/dx into the input tensor already
+		if (isInputView())
+			return;
+
 		int numImages = inFeatMaps.size();
-		int numBlocks = (inFeatMaps[0][0].rows - wparams.height + 1) *
-						(inFeatMaps[0][0].cols - wparams.width + 1);
+		int numBlocks = (inFeatMaps.getRows() - wparams.height + 1) *
+						(inFeatMaps.getCols() - wparams.width + 1);
 		#ifdef _OPENMP
 		#pragma omp parallel for
 		#endif
@@ -74,6 +81,28 @@ namespace convnet
 		}
 	}
 
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+	void ConcatLayer::bindOutputMaps()
+	{
+		int numImages = inFeatMaps.size();
+		int dims = inFeatMaps.getChns() * wparams.height * wparams.width;
+		int numBlocks = (inFeatMaps.getRows() - wparams.height + 1) * 
+						(inFeatMaps.getCols() - wparams.width + 1);
+
+		// a window covering whole NCHW maps makes row i image i as it is
+		// laid out in the tensor, so no copy is needed either way
+		if (numBlocks == 1 && inFeatMaps.isPacked())
+			ouFeatMaps = Mat(numImages, dims, CV_32FC1, inFeatMaps.ptr());
+		else if (ouFeatMaps.empty() || isOutputView)
+			ouFeatMaps = Mat::zeros(numBlocks * numImages, dims, CV_32FC1);
+		isOutputView = numBlocks == 1 && inFeatMaps.isPacked();
+	}
+
 	void ConcatLayer::fpropOne(Mat &ouFeatMaps, const Mat3D &inFeatMaps, 
 						       const WeightGeometry &wparams)
 	{
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "../utility/param.h"
 #include "layer.h"
 #include <string>				  // string
@@ -17,13 +18,13 @@ namespace convnet
 	class ConcatLayer : public Layer
 	{
 	public:
-		ConcatLayer() {}
+		ConcatLayer() : isOutputView(false) {}
 		
-		ConcatLayer(Mat4D &inFeatMaps, const int numThreads = 1);
+		ConcatLayer(Tensor &inFeatMaps, const int numThreads = 1);
 
 		~ConcatLayer();
 		
-		inline void setNFCInFeatMaps(Mat4D &inFeatMaps);
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
 
 		inline void setWeightGeometry(const int width, const int height);
 
@@ -31,6 +32,8 @@ namespace convnet
 
 		inline Mat &getFCOuFeatMaps();
 
+		inline void getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps);
+
 		void init();
 
 		void fprop();
@@ -38,22 +41,33 @@ namespace convnet
 		void bprop();
 
 	private:
+		// ouFeatMaps is a [numImages x dims] header over the input tensor
+		// when possible, allocated otherwise
+		void bindOutputMaps();
+
+		inline bool isInputView();
+
 		void fpropOne(Mat &ouFeatMaps, const Mat3D &inFeatMaps, const WeightGeometry &wparams);
 
 		void bpropOne(Mat3D &inFeatMaps, const Mat &ouFeatMaps, const WeightGeometry &wparams);
 
 
 	private:
-		Mat4D inFeatMaps;
+		Tensor inFeatMaps;
 		Mat ouFeatMaps;
 		WeightGeometry wparams;
 		int numThreads;
+		bool isOutputView;
 	};
 
 
-	inline void ConcatLayer::setNFCInFeatMaps(Mat4D &inFeatMaps)
+	inline void ConcatLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
+
+		// re-linked after init(), e.g. a dropout layer was removed
+		if (!this->ouFeatMaps.empty())
+			bindOutputMaps();
 	}
 
 	inline void ConcatLayer::setWeightGeometry(const int width, const int height)
@@ -70,6 +84,17 @@ namespace convnet
 	{
 		return this->ouFeatMaps;
 	}
+
+	inline void ConcatLayer::getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps)
+	{
+		if (!ouFeatMaps.empty() && !isOutputView)
+			outputs.push_back(&ouFeatMaps);
+	}
+
+	inline bool ConcatLayer::isInputView()
+	{
+		return this->isOutputView && this->ouFeatMaps.data == (uchar *)inFeatMaps.ptr();
+	}
 }
 
 #endif // concatenation layer
\ No newline at end of file
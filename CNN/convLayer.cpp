@@ -4,10 +4,12 @@
 #include "../Utility/check.h"
 #include "../utility/mmul.h"
 #include "../utility/im2row.h"
+#include "../utility/sgemm.h"
 #include "convLayer.h"
 
 #include <ctime>
-#include <arrayfire.h> 
+#include <cfloat>
+#include <sstream>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -21,10 +23,16 @@ namespace convnet
 	using namespace std;
 	using namespace cv;
 	
-	ConvLayer::ConvLayer(Mat4D &inFeatMaps, const int numThreads)
+	ConvLayer::ConvLayer()
+	{
+		setConvAlgorithm(CONV_AUTO);
+	}
+
+	ConvLayer::ConvLayer(Tensor &inFeatMaps, const int numThreads)
 	{
 		this->inFeatMaps = inFeatMaps;
 		this->numThreads = numThreads;
+		setConvAlgorithm(CONV_AUTO);
 	}
 
 	ConvLayer::~ConvLayer()
@@ -34,9 +42,10 @@ namespace convnet
 		weightGrads.clear();
 		bias.release();
 		biasMoments.release();
-		biasGrads.clear();
-		inFeatMaps.clear();
-		ouFeatMaps.clear();
+		biasGrads.release();
+		inFeatMaps.release();
+		ouFeatMaps.release();
+		colImages.release();
 	}
 
 	void ConvLayer::init()
@@ -69,31 +78,41 @@ namespace convnet
 		biasMoments = Mat::zeros(numWeights, 1, CV_32FC1);
 		bias = Mat::zeros(numWeights, 1, CV_32FC1);
 			
+		// second moments of the adaptive update rules
+		weightVariances.clear();
+		biasVariances.release();
+		if (layerUpdater.isVarianceKept()) {
+			weightVariances.resize(numGroups);
+			for (int g = 0; g < numGroups; ++g)
+				weightVariances[g] = Mat::zeros(numWeights / numGroups, weightDims, CV_32FC1);
+			biasVariances = Mat::zeros(numWeights, 1, CV_32FC1);
+		}
+
 		// allocate space for gradients of weights and bias
-		weightGrads.resize(numThreads);
-		biasGrads.resize(numThreads);
-		for (int b = 0; b < numThreads; ++b) {
-			biasGrads[b] = Mat::zeros(numWeights, 1, CV_32FC1);
-			weightGrads[b].resize(numGroups);
-			for (int g = 0; g < numGroups; ++g) {
-				weightGrads[b][g] = Mat::zeros(numWeights / numGroups, weightDims, CV_32FC1);
-			}
+		biasGrads = Mat::zeros(numWeights, 1, CV_32FC1);
+		weightGrads.resize(numGroups);
+		for (int g = 0; g < numGroups; ++g) {
+			weightGrads[g] = Mat::zeros(numWeights / numGroups, weightDims, CV_32FC1);
 		}
 
 		// allocate space for output maps
-		int rows = inFeatMaps[0][0].rows;
-		int cols = inFeatMaps[0][0].cols;
+		int rows = inFeatMaps.getRows();
+		int cols = inFeatMaps.getCols();
 		int ouRows = (rows + padding.top + padding.bottom - wparams.height) / 
 					  strides.stepRow + 1;
 		int ouCols = (cols + padding.left + padding.right - wparams.width) / 
 					  strides.stepCol + 1;
-		ouFeatMaps.resize(numImages);
-		for (int i = 0; i < numImages; i++) {
-			ouFeatMaps[i].resize(numWeights);
-			for (int j = 0; j < numWeights; j++) {
-				ouFeatMaps[i][j] = Mat::zeros(ouRows, ouCols, CV_32FC1);
-			}
-		}
+		// channel major, the maps are one [numWeights x (numImages x ouRows x ouCols)]
+		// matrix, so gemm can write them in one go; blocked inputs give
+		// blocked outputs
+		if (inFeatMaps.getLayout() == TENSOR_NCHW8C)
+			ouFeatMaps.create(numImages, numWeights, ouRows, ouCols, TENSOR_NCHW8C);
+		else
+			ouFeatMaps.create(numImages, numWeights, ouRows, ouCols, TENSOR_CNHW);
+
+		for (int p = 0; p < CONV_NUM_PASSES; ++p)
+			convAlgos[p] = resolveAlgorithm(convAlgos[p], (ConvPass)p);
+		initAlgorithms();
 	}
 	
 	void ConvLayer::fprop()
@@ -101,18 +120,7 @@ namespace convnet
 		NONFC_INPUT_INIT(inFeatMaps);
 		NONFC_OUTPUT_INIT(ouFeatMaps);
 
-		// do fprop
-		int numImages = inFeatMaps.size();
-
-		#ifdef _OPENMP
-		#pragma omp parallel for
-		#endif
-		
-		for (int i = 0; i < numImages; ++i) {
-			fpropOne(ouFeatMaps[i], inFeatMaps[i], weights, bias,
-					 wparams, strides, padding);
-		}
-		
+		fpropWith(convAlgos[CONV_FPROP]);
 	}
 
 	void ConvLayer::bprop()
@@ -121,59 +129,154 @@ namespace convnet
 		NONFC_INPUT_INIT(inFeatMaps);
 		NONFC_OUTPUT_INIT(ouFeatMaps);
 
-		int numImages = ouFeatMaps.size();
-		int tsize = numImages < numThreads ? numImages : (int)ceil(numImages / numThreads);
-		int t = 0;
+		// bias gradients are the sums of the delta maps
+		if (ouFeatMaps.getLayout() == TENSOR_NCHW8C)
+			blockedConv.bpropBias(biasGrads, ouFeatMaps);
+		else {
+			float *biasGradPtr = CV_MAT_PRF(biasGrads);
+			for (int k = 0; k < wparams.numWeights; ++k) {
+				biasGradPtr[k] = 0;
+				for (int i = 0; i < ouFeatMaps.size(); ++i)
+					biasGradPtr[k] += (float)sum(ouFeatMaps[i][k])[0];
+			}
+		}
 
-		#ifdef _OPENMP
-		#pragma omp parallel for
-		#endif
+		// weight gradients first, inFeatMaps still holds the inputs
+		bpropWeightsWith(convAlgos[CONV_WGRAD], convAlgos[CONV_WGRAD] == convAlgos[CONV_FPROP]);
+		if (isDzDx)
+			bpropDataWith(convAlgos[CONV_DGRAD], convAlgos[CONV_DGRAD] == convAlgos[CONV_WGRAD]);
+	}
 
-		// divide data into number threads (map)
-		for (t = 0; t < numThreads; ++t) {
-			Mat threadBiasGrads = Mat::zeros(bias.size(), CV_32FC1);
-			Mat3D threadWeightGrads(weights.size());
-			for (int g = 0; g < wparams.numGroups; ++g) {
-				threadWeightGrads[g] = Mat::zeros(weights[0].size(), CV_32FC1);
-			}
+	void ConvLayer::update()
+	{
+		vector<ParamBlock> blocks;
+		beginUpdate();
+		getParamBlocks(blocks);
+		updateParamBlocks(blocks);
+	}
 
-			int tstart = max(0, t * tsize);
-			int tend = min(numImages, (t + 1) * tsize);
-			for (int i = tstart; i < tend; ++i) {
-				bpropOne(inFeatMaps[i], threadWeightGrads, threadBiasGrads, inFeatMaps[i], ouFeatMaps[i], 
-						 weights, wparams, strides, padding, isDzDx);
-			}
+	void ConvLayer::beginUpdate()
+	{
+		layerUpdater.nextStep();
+		winograd.setFilterStale();
+		fftconv.setFilterStale();
+	}
 
-			for (int g = 0; g < wparams.numGroups; ++g) {
-				memcpy(weightGrads[t][g].data, threadWeightGrads[g].data,
-					   threadWeightGrads[g].rows * threadWeightGrads[g].cols * sizeof(float));
+	bool ConvLayer::getParamBlocks(vector<ParamBlock> &blocks)
+	{
+		layerUpdater.getParamBlocks(blocks, weights, weightMoments, weightVariances,
+									bias, biasMoments, biasVariances, 
+									weightGrads, biasGrads);
+		return true;
+	}
 
-				memcpy(biasGrads[t].data, threadBiasGrads.data,
-					   threadBiasGrads.cols * sizeof(float));
-			}
+	void ConvLayer::getParamTensors(vector<Mat *> &params, vector<Mat *> &grads,
+									vector<Mat *> &states)
+	{
+		for (int g = 0; g < weights.size(); ++g) {
+			params.push_back(&weights[g]);
+			grads.push_back(&weightGrads[g]);
+			states.push_back(&weightMoments[g]);
 		}
+		params.push_back(&bias);
+		grads.push_back(&biasGrads);
+		states.push_back(&biasMoments);
+
+		for (int g = 0; g < weightVariances.size(); ++g)
+			states.push_back(&weightVariances[g]);
+		if (!biasVariances.empty())
+			states.push_back(&biasVariances);
+	}
 
-		// accumulate gradients into *[0] across different threads (reduce)
-		for (int g = 0; g < wparams.numGroups; ++g) {
-			for (int t = 1; t < numThreads; ++t) {
-				weightGrads[0][g] += weightGrads[t][g];
-			}
-		}
+	void ConvLayer::scaleLearningRate()
+	{
+		layerUpdater.scaleLearningRate();
+	}
 
-		for (int t = 1; t < numThreads; ++t) {
-			biasGrads[0] += biasGrads[t];
-		}
+
+	void ConvLayer::getWorkspaces(vector<Mat *> &workspaces)
+	{
+		bool isInputCached = convAlgos[CONV_WGRAD] == convAlgos[CONV_FPROP];
+		if (!colImages.empty() && !(isInputCached && convAlgos[CONV_FPROP] == CONV_IM2COL))
+			workspaces.push_back(&colImages);
+		winograd.getWorkspaces(workspaces, isInputCached);
+		fftconv.getWorkspaces(workspaces, isInputCached);
+		blockedConv.getWorkspaces(workspaces);
 	}
 
-	void ConvLayer::update()
+	string ConvLayer::getTuneKey()
 	{
-		layerUpdater.SGDUpdate(weights, weightMoments, bias,
-							   biasMoments, weightGrads[0], biasGrads[0]);
+		NONFC_INPUT_INIT(inFeatMaps);
+
+	#ifdef _OPENMP
+		int maxThreads = omp_get_max_threads();
+	#else
+		int maxThreads = 1;
+	#endif
+		ostringstream key;
+		key << "n" << inFeatMaps.size() << "_c" << inFeatMaps.getChns() << "x" 
+			<< inFeatMaps.getRows() << "x" << inFeatMaps.getCols() 
+			<< "_l" << inFeatMaps.getLayout()
+			<< "_w" << wparams.numWeights << "x" << wparams.weightChns << "x" 
+			<< wparams.height << "x" << wparams.width << "_g" << wparams.numGroups
+			<< "_s" << strides.stepRow << "x" << strides.stepCol 
+			<< "_p" << padding.top << "x" << padding.left << "x" 
+			<< padding.bottom << "x" << padding.right 
+			<< "_d" << (isDzDx ? 1 : 0) << "_t" << maxThreads;
+		return key.str();
 	}
 
-	void ConvLayer::scaleLearningRate()
+	void ConvLayer::autotune(const int numRepeats)
 	{
-		layerUpdater.scaleLearningRate();
+		NONFC_INPUT_INIT(inFeatMaps);
+		NONFC_OUTPUT_INIT(ouFeatMaps);
+
+		// dgrad writes over the inputs, e.g. the images of the first layer
+		Tensor savedMaps = inFeatMaps.clone();
+
+		// passes are timed on their own, i.e. wgrad and dgrad never
+		// count on transforms cached by the pass before them
+		const ConvAlgorithm candidates[] = { CONV_IM2COL, CONV_WINOGRAD, CONV_FFT,
+											 CONV_IMPLICIT_GEMM, CONV_DIRECT, CONV_BLOCKED };
+		int numCandidates = sizeof(candidates) / sizeof(ConvAlgorithm);
+		ConvAlgorithm chosen[CONV_NUM_PASSES];
+		for (int p = 0; p < CONV_NUM_PASSES; ++p) {
+			chosen[p] = convAlgos[p];
+			if (p == CONV_DGRAD && !isDzDx)
+				continue;
+
+			double bestTime = DBL_MAX;
+			for (int a = 0; a < numCandidates; ++a) {
+				if (!isAlgorithmSupported(candidates[a], (ConvPass)p))
+					continue;
+
+				convAlgos[p] = candidates[a];
+				initAlgorithms();
+
+				double algoTime = DBL_MAX;
+				for (int t = 0; t <= numRepeats; ++t) {
+					int64 start = getTickCount();
+					if (p == CONV_FPROP)
+						fpropWith(candidates[a]);
+					else if (p == CONV_WGRAD)
+						bpropWeightsWith(candidates[a], false);
+					else
+						bpropDataWith(candidates[a], false);
+
+					// the first run warms up caches and builds filter transforms
+					if (t > 0)
+						algoTime = min(algoTime, (double)(getTickCount() - start));
+				}
+
+				if (algoTime < bestTime) {
+					bestTime = algoTime;
+					chosen[p] = candidates[a];
+				}
+			}
+			convAlgos[p] = chosen[p];
+		}
+		initAlgorithms();
+		savedMaps.copyTo(inFeatMaps);
 	}
 
 
@@ -182,114 +285,279 @@ namespace convnet
 	//								private function impl
 	//
 	// ----------------------------------------------------------------------------	
-	void ConvLayer::fpropOne(Mat3D &ouFeatMaps, 
-							 const Mat3D &inFeatMaps, 
-							 const Mat3D &weights, 
-							 const Mat &bias, 
-							 const WeightGeometry &wparams, 
-							 const StrideGeometry &strides, 
-							 const PadGeometry &padding)
+	bool ConvLayer::isAlgorithmSupported(const ConvAlgorithm convAlgo, const ConvPass pass)
+	{
+		// the other engines read rows x cols planes
+		bool isBlocked = inFeatMaps.getLayout() == TENSOR_NCHW8C;
+		if (convAlgo == CONV_BLOCKED)
+			return isBlocked && BlockedConv::isSupported(wparams);
+		else if (isBlocked)
+			return false;
+		else if (convAlgo == CONV_WINOGRAD)
+			return WinogradConv::isSupported(wparams, strides);
+		else if (convAlgo == CONV_FFT)
+			return FFTConv::isSupported(wparams, strides);
+		else if (convAlgo == CONV_DIRECT)
+			return pass == CONV_FPROP && DirectConv::isSupported(wparams, strides);
+		return convAlgo == CONV_IM2COL || convAlgo == CONV_IMPLICIT_GEMM;
+	}
+
+	ConvAlgorithm ConvLayer::resolveAlgorithm(const ConvAlgorithm convAlgo, const ConvPass pass)
+	{
+		if (convAlgo != CONV_AUTO && isAlgorithmSupported(convAlgo, pass))
+			return convAlgo;
+
+		// 1 x 1 weights are a plain gemm, few input channels go direct, 
+		// stride-1 3 x 3 weights through winograd
+		if (inFeatMaps.getLayout() == TENSOR_NCHW8C) {
+			argu::ASSERT(!BlockedConv::isSupported(wparams), 
+						 " groups of blocked maps must have multiples of 8 channels !\n");
+			return CONV_BLOCKED;
+		}
+		else if (ImplicitGemmConv::isPointwiseConv(wparams, strides, padding))
+			return CONV_IMPLICIT_GEMM;
+		else if (DirectConv::isSupported(wparams, strides))
+			return pass == CONV_FPROP ? CONV_DIRECT : CONV_IMPLICIT_GEMM;
+		else if (WinogradConv::isSupported(wparams, strides))
+			return CONV_WINOGRAD;
+		return CONV_IMPLICIT_GEMM;
+	}
+
+	bool ConvLayer::usesAlgorithm(const ConvAlgorithm convAlgo)
 	{
-		int ouDims = ouFeatMaps[0].rows * ouFeatMaps[0].cols;
-		int inDims = inFeatMaps.size() * wparams.height * wparams.width * wparams.numGroups;
-		Mat colImage(inDims, ouDims, CV_32FC1);
- 		im2col(colImage, inFeatMaps, wparams.height, wparams.width,
-     		   strides.stepRow, strides.stepCol, padding.top,
- 			   padding.left, padding.bottom, padding.right);
-
- 		int colImageGroupOffset = inDims / wparams.numGroups;
+		for (int p = 0; p < CONV_NUM_PASSES; ++p) {
+			if (convAlgos[p] == convAlgo)
+				return true;
+		}
+		return false;
+	}
+
+	void ConvLayer::initAlgorithms()
+	{
+		int numImages = inFeatMaps.size();
+		int inChns = inFeatMaps.getChns();
+		int rows = inFeatMaps.getRows();
+		int cols = inFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+
+		// F(4x4, 3x3) saves more multiplications but needs maps large
+		// enough to fill its tiles
+		if (usesAlgorithm(CONV_WINOGRAD)) {
+			int tileSize = (ouRows >= 8 && ouCols >= 8) ? 4 : 2;
+			winograd.init(tileSize, wparams, padding, numImages, inChns, ouRows, ouCols);
+		}
+		else 
+			winograd = WinogradConv();
+
+		if (usesAlgorithm(CONV_FFT))
+			fftconv.init(wparams, padding, numImages, inChns, rows, cols, ouRows, ouCols);
+		else
+			fftconv = FFTConv();
+
+		if (usesAlgorithm(CONV_IMPLICIT_GEMM)) {
+			implicitGemm.init(wparams, strides, padding, numImages, inChns,
+							  rows, cols, ouRows, ouCols);
+		}
+		else
+			implicitGemm = ImplicitGemmConv();
+
+		if (usesAlgorithm(CONV_DIRECT))
+			directConv.init(wparams, strides, padding, inChns, rows, cols, ouRows, ouCols);
+		else
+			directConv = DirectConv();
+
+		if (usesAlgorithm(CONV_BLOCKED)) {
+			blockedConv.init(wparams, strides, padding, numImages, inChns,
+							 rows, cols, ouRows, ouCols);
+		}
+		else
+			blockedConv = BlockedConv();
+
+		// workspace for the batched matrix multiplications, the columns
+		// of all images are laid side by side
+		if (usesAlgorithm(CONV_IM2COL)) {
+			int inDims = inChns * wparams.height * wparams.width;
+			colImages = Mat::zeros(inDims, numImages * ouRows * ouCols, CV_32FC1);
+		}
+		else
+			colImages.release();
+	}
+
+	void ConvLayer::fpropWith(const ConvAlgorithm convAlgo)
+	{
+		if (convAlgo == CONV_WINOGRAD)
+			winograd.fprop(ouFeatMaps, inFeatMaps, weights, bias);
+		else if (convAlgo == CONV_FFT)
+			fftconv.fprop(ouFeatMaps, inFeatMaps, weights, bias);
+		else if (convAlgo == CONV_IMPLICIT_GEMM)
+			implicitGemm.fprop(ouFeatMaps, inFeatMaps, weights, bias);
+		else if (convAlgo == CONV_DIRECT)
+			directConv.fprop(ouFeatMaps, inFeatMaps, weights, bias);
+		else if (convAlgo == CONV_BLOCKED)
+			blockedConv.fprop(ouFeatMaps, inFeatMaps, weights, bias);
+		else
+			fpropIm2col(ouFeatMaps, inFeatMaps, weights, bias);
+	}
+
+	void ConvLayer::bpropWeightsWith(const ConvAlgorithm convAlgo, const bool isInputCached)
+	{
+		if (convAlgo == CONV_WINOGRAD)
+			winograd.bpropWeights(weightGrads, ouFeatMaps, inFeatMaps, isInputCached);
+		else if (convAlgo == CONV_FFT)
+			fftconv.bpropWeights(weightGrads, ouFeatMaps, inFeatMaps, isInputCached);
+		else if (convAlgo == CONV_IMPLICIT_GEMM)
+			implicitGemm.bpropWeights(weightGrads, ouFeatMaps, inFeatMaps);
+		else if (convAlgo == CONV_BLOCKED)
+			blockedConv.bpropWeights(weightGrads, ouFeatMaps, inFeatMaps, isInputCached);
+		else
+			bpropWeightsIm2col(weightGrads, ouFeatMaps, inFeatMaps, isInputCached);
+	}
+
+	void ConvLayer::bpropDataWith(const ConvAlgorithm convAlgo, const bool isDeltaCached)
+	{
+		if (convAlgo == CONV_WINOGRAD)
+			winograd.bpropData(inFeatMaps, ouFeatMaps, weights, isDeltaCached);
+		else if (convAlgo == CONV_FFT)
+			fftconv.bpropData(inFeatMaps, ouFeatMaps, weights, isDeltaCached);
+		else if (convAlgo == CONV_IMPLICIT_GEMM)
+			implicitGemm.bpropData(inFeatMaps, ouFeatMaps, weights);
+		else if (convAlgo == CONV_BLOCKED)
+			blockedConv.bpropData(inFeatMaps, ouFeatMaps, weights);
+		else
+			bpropDataIm2col(inFeatMaps, ouFeatMaps, weights);
+	}
+
+	void ConvLayer::fpropIm2col(Tensor &ouFeatMaps, 
+								const Tensor &inFeatMaps, 
+								const Mat3D &weights, 
+								const Mat &bias)
+	{
+		int numImages = inFeatMaps.size();
+		int ouDims = ouFeatMaps[0][0].rows * ouFeatMaps[0][0].cols;
+		int ldcol = colImages.cols;
+		float *colImPtr = CV_MAT_PRF(colImages);
+
+		// the channel-major output is the [N x (numImages x ouDims)]
+		// result of the multiplications, they write it directly
+		float *ouMapPtr = ouFeatMaps.ptr();
+
+		// columns of image i go to [i * ouDims, (i + 1) * ouDims)
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			im2col(colImPtr + i * ouDims, ldcol, inFeatMaps[i], wparams.height, wparams.width,
+				   strides.stepRow, strides.stepCol, padding.top, padding.left,
+				   padding.bottom, padding.right);
+		}
+
+		// one matrix multiplication per group for the whole batch
+ 		int colImageGroupOffset = colImages.rows / wparams.numGroups;
  		int weightGroupOffset = weights[0].rows;
- 		Mat ouMap(weightGroupOffset * wparams.numGroups, ouDims, CV_32FC1);
-		Mat groupColImage(colImageGroupOffset, colImage.cols, CV_32FC1);
- 		Mat groupOuMap(ouDims, weightGroupOffset, CV_32FC1);
-		
  		for (int g = 0; g < wparams.numGroups; ++g) {
- 			groupColImage = colImage.rowRange(g*colImageGroupOffset, (g + 1)*colImageGroupOffset);
- 			groupOuMap = ouMap.rowRange(g*weightGroupOffset, (g + 1)*weightGroupOffset);
-    		fastMatMul(CV_MAT_PRF(groupOuMap), CV_MAT_PRF(weights[g]), CV_MAT_PRF(groupColImage),
- 				       weights[g].rows, weights[g].cols, groupColImage.rows, groupColImage.cols,
+    		fastMatMul(ouMapPtr + g * weightGroupOffset * ldcol, CV_MAT_PRF(weights[g]),
+					   colImPtr + g * colImageGroupOffset * ldcol,
+ 				       weights[g].rows, weights[g].cols, colImageGroupOffset, ldcol,
  					   false, false);
  		}
- 		
-		if (!bias.empty())
-			ouMap += repeat(bias, 1, ouMap.cols);
 
-   		// copy to output map, point operation of cv::Mat is faster
-		for (int ch = 0; ch < ouMap.rows; ++ch) {
-			memcpy(CV_MAT_PRF(ouFeatMaps[ch]), CV_MAT_PRF(ouMap.row(ch)), ouMap.cols * sizeof(float));
+		// add bias in place, one row per channel
+		if (bias.empty())
+			return;
+
+		const float *biasPtr = CV_MAT_PRF(bias);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int ch = 0; ch < wparams.numWeights; ++ch) {
+			float *dst = ouMapPtr + ch * ldcol;
+			float b = biasPtr[ch];
+			for (int k = 0; k < ldcol; ++k)
+				dst[k] += b;
 		}
 	}
 
-	void ConvLayer::bpropOne(Mat3D &prevLayerDelta,
-							 Mat3D &weightGrads, 
-							 Mat &biasGrads,
-							 const Mat3D &inFeatMaps,
-							 const Mat3D &currLayerDelta, 
-							 const Mat3D &weights, 
-							 const WeightGeometry &wparams, 
-							 const StrideGeometry &strides,
-							 const PadGeometry &padding,
-							 const bool isDzDx)
+	void ConvLayer::bpropWeightsIm2col(Mat3D &weightGrads,
+									   const Tensor &currLayerDelta,
+									   const Tensor &inFeatMaps,
+									   const bool isColCached)
 	{
+		int numImages = currLayerDelta.size();
 		int numWeights = wparams.numWeights;
-		int currDeltaDims = currLayerDelta[0].rows * currLayerDelta[0].cols;
-		int inDims = inFeatMaps.size() * wparams.height * wparams.width * wparams.numGroups;
+		int numGroups = wparams.numGroups;
+		int ouDims = currLayerDelta[0][0].rows * currLayerDelta[0][0].cols;
+		int ldcol = colImages.cols;
+		float *colImPtr = CV_MAT_PRF(colImages);
+
+		// channel-major deltas are already the 2D matrix 
+		// [N x [numImages x Rows x Cols]]
+		const float *deltaPtr = currLayerDelta.ptr();
 		
-		// convert [N x Rows x Cols] delta maps into 2D matrix [N x [Rows x Cols]]
-		Mat delta(numWeights, currDeltaDims, CV_32FC1);
-		for (int k = 0; k < numWeights; ++k) 
-			memcpy(delta.row(k).data, currLayerDelta[k].data, currDeltaDims * sizeof(float));
-
-		// compute bias gradients based on current delta
-		// bias [1 x N], delta maps [N x rows x cols] 
-		if (!biasGrads.empty()) {
-			Mat reduceSum;
-			reduce(delta, reduceSum, 1, CV_REDUCE_SUM);
-			biasGrads += reduceSum;
+		// rebuild the columns unless fprop() left them
+		if (!isColCached) {
+			#ifdef _OPENMP
+			#pragma omp parallel for
+			#endif
+
+			for (int i = 0; i < numImages; ++i) {
+				im2col(colImPtr + i * ouDims, ldcol, inFeatMaps[i], wparams.height, wparams.width,
+					   strides.stepRow, strides.stepCol, padding.top, padding.left,
+					   padding.bottom, padding.right);
+			}
 		}
 
 		// compute weights gradients based on current delta
-		Mat colImage(inDims, currDeltaDims, CV_32FC1);
-		im2col(colImage, inFeatMaps, wparams.height, wparams.width, strides.stepRow,
- 			   strides.stepCol, padding.top, padding.left, padding.bottom, padding.right);
- 		
-		int numGroups = weights.size();
-		int colImageGroupOffset = inDims / numGroups;
+		int colImageGroupOffset = colImages.rows / numGroups;
 		int weightGroupOffset = numWeights / numGroups;
-		Mat groupColImage(colImage.rows, colImageGroupOffset, CV_32FC1);
-		Mat groupDeltaMap;
- 
  		for (int g = 0; g < numGroups; ++g) {
-			groupColImage = colImage.rowRange(g*colImageGroupOffset, (g + 1)*colImageGroupOffset);
- 			groupDeltaMap = delta.rowRange(g*weightGroupOffset, (g + 1)*weightGroupOffset);
-			fastMatMulAdd(CV_MAT_PRF(weightGrads[g]), CV_MAT_PRF(groupDeltaMap), CV_MAT_PRF(groupColImage),
-					      groupDeltaMap.rows, groupDeltaMap.cols, groupColImage.rows, groupColImage.cols, 
-						  false, true);
+			fastMatMul(CV_MAT_PRF(weightGrads[g]), deltaPtr + g * weightGroupOffset * ldcol,
+					   colImPtr + g * colImageGroupOffset * ldcol,
+					   weightGroupOffset, ldcol, colImageGroupOffset, ldcol,
+					   false, true);
  		}
+	}
+
+	void ConvLayer::bpropDataIm2col(Tensor &prevLayerDelta,
+									const Tensor &currLayerDelta,
+									const Mat3D &weights)
+	{
+		int numImages = currLayerDelta.size();
+		int numWeights = wparams.numWeights;
+		int numGroups = wparams.numGroups;
+		int ouDims = currLayerDelta[0][0].rows * currLayerDelta[0][0].cols;
+		int ldcol = colImages.cols;
+		float *colImPtr = CV_MAT_PRF(colImages);
+		const float *deltaPtr = currLayerDelta.ptr();
 
+		int colImageGroupOffset = colImages.rows / numGroups;
+		int weightGroupOffset = numWeights / numGroups;
+		int prevDeltaDims = prevLayerDelta[0][0].rows * prevLayerDelta[0][0].cols;
 
  		// compute delta(l-1) = dz/dx = kernel * delta(l) 
- 		// weights [[chns x wrows x wcols] * N], delta [N x rows x cols]
- 		if (isDzDx) {
-			int prevDeltaDims = prevLayerDelta[0].rows * prevLayerDelta[0].cols;
-			for (int ch = 0; ch < prevLayerDelta.size(); ++ch)
-				memset(prevLayerDelta[ch].data, 0, prevDeltaDims * sizeof(float));
-
- 			// should be process to avoid transpose
- 			int dzdxGroupOffset = inDims / numGroups;
- 			Mat dzdx(inDims, delta.cols, CV_32FC1);
- 			Mat groupDzdx, groupWeights;
- 
- 			for (int g = 0; g < numGroups; ++g) {
- 				groupWeights = weights[g];
- 				groupDzdx = dzdx.rowRange(g*dzdxGroupOffset, (g + 1)*dzdxGroupOffset);
- 				groupDeltaMap = delta.rowRange(g*weightGroupOffset, (g + 1)*weightGroupOffset);
- 				fastMatMul(CV_MAT_PRF(groupDzdx), CV_MAT_PRF(groupWeights), CV_MAT_PRF(groupDeltaMap),
- 						   groupWeights.rows, groupWeights.cols, groupDeltaMap.rows, groupDeltaMap.cols,
- 						   true, false);
- 			}
-			col2im(prevLayerDelta, dzdx, wparams.height, wparams.width, strides.stepRow,
- 				   strides.stepCol, padding.top, padding.left, padding.bottom, padding.right);
+ 		// weights [[chns x wrows x wcols] * N], delta [N x rows x cols],
+		// the columns are no longer needed, reuse them for dz/dx
+ 		for (int g = 0; g < numGroups; ++g) {
+ 			fastMatMul(colImPtr + g * colImageGroupOffset * ldcol, CV_MAT_PRF(weights[g]),
+					   deltaPtr + g * weightGroupOffset * ldcol,
+ 					   weights[g].rows, weights[g].cols, weightGroupOffset, ldcol,
+ 					   true, false);
  		}
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			for (int ch = 0; ch < prevLayerDelta[i].size(); ++ch)
+				memset(prevLayerDelta[i][ch].data, 0, prevDeltaDims * sizeof(float));
+
+			col2im(prevLayerDelta[i], colImPtr + i * ouDims, ldcol, wparams.height, 
+				   wparams.width, strides.stepRow, strides.stepCol, padding.top, 
+				   padding.left, padding.bottom, padding.right);
+		}
 	}
 }
\ No newline at end of file
@@ -3,7 +3,13 @@
 #pragma once
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "../utility/param.h"
+#include "../utility/winograd.h"
+#include "../utility/fftconv.h"
+#include "../utility/implicitgemm.h"
+#include "../utility/directconv.h"
+#include "../utility/blockedconv.h"
 #include "layer.h"
 #include "updater.h"
 #include <string>				  // string
@@ -15,16 +21,53 @@ namespace convnet
 	using namespace std;
 	using namespace cv;
 
+	// --------------------------------------------------------------
+	//
+	// @brief convolution algorithm used by ConvLayer
+	//
+	//	CONV_AUTO picks implicit gemm for 1 x 1 weights (a plain
+	//	gemm there), the direct kernel for weights with at most
+	//	DIRECT_CONV_MAX_CHNS channels, winograd for stride-1 3 x 3
+	//	weights and implicit gemm otherwise. CONV_FFT (stride-1,
+	//	5 x 5 and up) has to be asked for, see Test/benchConv.cpp
+	//	for where it beats the gemm paths. The direct kernel is
+	//	forward only, its layers run bprop through implicit gemm.
+	//
+	//	Each pass (ConvPass) may use its own algorithm, either set
+	//	by hand or measured by autotune(). CONV_BLOCKED is the only
+	//	algorithm for TENSOR_NCHW8C inputs and is not used for any
+	//	other layout.
+	//
+	// --------------------------------------------------------------
+	enum ConvAlgorithm
+	{
+		CONV_AUTO = 0,
+		CONV_IM2COL = 1,
+		CONV_WINOGRAD = 2,
+		CONV_FFT = 3,
+		CONV_IMPLICIT_GEMM = 4,
+		CONV_DIRECT = 5,
+		CONV_BLOCKED = 6
+	};
+
+	enum ConvPass
+	{
+		CONV_FPROP = 0, // outputs
+		CONV_WGRAD = 1, // weight gradients
+		CONV_DGRAD = 2, // dz/dx
+		CONV_NUM_PASSES = 3
+	};
+
 	class ConvLayer : public Layer
 	{
 	public:
-		ConvLayer() {}
+		ConvLayer();
 
-		ConvLayer(Mat4D &inFeatMaps, const int numThreads = 1);
+		ConvLayer(Tensor &inFeatMaps, const int numThreads = 1);
 		
 		~ConvLayer();
 
-		inline void setNFCInFeatMaps(Mat4D &inFeatMaps);
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
 
 		inline void setWeightGeometry(const int numGroups,
 									  const int numWeights,
@@ -45,12 +88,39 @@ namespace convnet
 									 const float weightMomentRate,
 									 const float weightLearningRateScale,
 								     const float weightDecay);
+
+		inline void setOptimizer(const OptimMethod optimMethod,
+								 const float varianceRate,
+								 const float epsilon);
 				
 		inline void setDzDxFlag(const bool flag);
 
 		inline void setNumThreads(const int numThreads = 1);
 
-		inline Mat4D &getNFCOuFeatMaps();
+		// same algorithm for all passes
+		inline void setConvAlgorithm(const ConvAlgorithm convAlgo = CONV_AUTO);
+
+		inline void setConvAlgorithm(const ConvPass pass, const ConvAlgorithm convAlgo);
+
+		inline ConvAlgorithm getConvAlgorithm(const ConvPass pass = CONV_FPROP);
+
+		// whether inputs of this layout can be convolved, valid once the
+		// weight geometry is set
+		inline bool isLayoutSupported(const TensorLayout layout);
+
+		// identifies the shapes, geometry and thread count the choice of
+		// autotune() depends on, valid once the input maps are set
+		string getTuneKey();
+
+		inline Tensor &getNFCOuFeatMaps();
+
+		inline void getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps);
+
+		// the im2col columns unless wgrad reuses those of fprop, the
+		// transform buffers of winograd / fft and the padded deltas of
+		// the blocked kernel; the padded images of the direct kernel
+		// keep their zero borders and are left out
+		void getWorkspaces(vector<Mat *> &workspaces);
 		
 		inline float getCurrObjCost();
 
@@ -66,38 +136,77 @@ namespace convnet
 
 		void update();
 
+		// marks the transformed filters stale, the weights change in 
+		// the sweep
+		void beginUpdate();
+
+		bool getParamBlocks(vector<ParamBlock> &blocks);
+
+		void getParamTensors(vector<Mat *> &params, vector<Mat *> &grads, 
+							 vector<Mat *> &states);
+
 		void scaleLearningRate();
+
+		// after init(), times every supported algorithm of each pass on
+		// the shapes of this layer and keeps the fastest one; the input
+		// maps are restored, weights are left untouched
+		void autotune(const int numRepeats = 3);
 		
 	private:
-		void fpropOne(Mat3D &ouFeatMaps, 
-			          const Mat3D &inFeatMaps, 
-					  const Mat3D &weights, 
-					  const Mat &bias, 
-					  const WeightGeometry &wparams,
-					  const StrideGeometry &strides,
-					  const PadGeometry &padding);
-
-		void bpropOne(Mat3D &prevLayerDelta, 
-			          Mat3D &weightGrads, 
-					  Mat &biasGrads,
-					  const Mat3D &inFeatMaps,
-					  const Mat3D &currLayerDelta,
-					  const Mat3D &weights, 
-					  const WeightGeometry &wparams,
-					  const StrideGeometry &strides,
-					  const PadGeometry &padding,
-					  const bool isDzDx);
+		bool isAlgorithmSupported(const ConvAlgorithm convAlgo, const ConvPass pass);
+
+		// CONV_AUTO and unsupported choices fall back to the default
+		ConvAlgorithm resolveAlgorithm(const ConvAlgorithm convAlgo, const ConvPass pass);
+
+		bool usesAlgorithm(const ConvAlgorithm convAlgo);
+
+		// workspaces of the algorithms in use, the others are released
+		void initAlgorithms();
+
+		void fpropWith(const ConvAlgorithm convAlgo);
+
+		// isInputCached: fprop ran on the same algorithm
+		void bpropWeightsWith(const ConvAlgorithm convAlgo, const bool isInputCached);
+
+		// isDeltaCached: wgrad ran on the same algorithm
+		void bpropDataWith(const ConvAlgorithm convAlgo, const bool isDeltaCached);
+
+		// whole-minibatch convolution: im2col columns of all images are
+		// laid side by side and each group needs a single matrix 
+		// multiplication into the channel-major output maps; wgrad 
+		// reuses the columns built by fprop
+		void fpropIm2col(Tensor &ouFeatMaps, 
+						 const Tensor &inFeatMaps, 
+						 const Mat3D &weights, 
+						 const Mat &bias);
+
+		void bpropWeightsIm2col(Mat3D &weightGrads,
+								const Tensor &currLayerDelta,
+								const Tensor &inFeatMaps,
+								const bool isColCached);
+
+		void bpropDataIm2col(Tensor &prevLayerDelta,
+							 const Tensor &currLayerDelta,
+							 const Mat3D &weights);
 
 
 	private:
 		Mat3D weights;
 		Mat3D weightMoments;
+		Mat3D weightVariances;
 		Mat bias;
 		Mat biasMoments;
-		Mat4D weightGrads;
-		Mat3D biasGrads;
-		Mat4D inFeatMaps;
-		Mat4D ouFeatMaps;
+		Mat biasVariances;
+		Mat3D weightGrads;
+		Mat biasGrads;
+		Tensor inFeatMaps;
+		Tensor ouFeatMaps;
+		Mat colImages;
+		WinogradConv winograd;
+		FFTConv fftconv;
+		ImplicitGemmConv implicitGemm;
+		DirectConv directConv;
+		BlockedConv blockedConv;
 		WeightGeometry wparams;
 		StrideGeometry strides;
 		PadGeometry padding;
@@ -105,10 +214,11 @@ namespace convnet
 
 		int numThreads;
 		bool isDzDx;
+		ConvAlgorithm convAlgos[CONV_NUM_PASSES];
 	};
 
 
-	inline void ConvLayer::setNFCInFeatMaps(Mat4D &inFeatMaps)
+	inline void ConvLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
 	}
@@ -149,6 +259,13 @@ namespace convnet
 									  weightMomentRate, weightLearningRateScale, 
 									  weightDecay);
 	}
+
+	inline void ConvLayer::setOptimizer(const OptimMethod optimMethod,
+											const float varianceRate,
+											const float epsilon)
+	{
+		layerUpdater.setOptimizer(optimMethod, varianceRate, epsilon);
+	}
 	
 	inline void ConvLayer::setDzDxFlag(const bool flag)
 	{
@@ -160,11 +277,38 @@ namespace convnet
 		this->numThreads = numThreads;
 	}
 
-	inline Mat4D &ConvLayer::getNFCOuFeatMaps()
+	inline void ConvLayer::setConvAlgorithm(const ConvAlgorithm convAlgo)
+	{
+		for (int p = 0; p < CONV_NUM_PASSES; ++p)
+			this->convAlgos[p] = convAlgo;
+	}
+
+	inline void ConvLayer::setConvAlgorithm(const ConvPass pass, const ConvAlgorithm convAlgo)
+	{
+		this->convAlgos[pass] = convAlgo;
+	}
+
+	inline ConvAlgorithm ConvLayer::getConvAlgorithm(const ConvPass pass)
+	{
+		return this->convAlgos[pass];
+	}
+
+	inline bool ConvLayer::isLayoutSupported(const TensorLayout layout)
+	{
+		return layout != TENSOR_NCHW8C || BlockedConv::isSupported(wparams);
+	}
+
+	inline Tensor &ConvLayer::getNFCOuFeatMaps()
 	{
 		return this->ouFeatMaps;
 	}
 
+	inline void ConvLayer::getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
+
 	inline float ConvLayer::getCurrObjCost()
 	{
 		Mat wwsqsum = Mat::zeros(weights[0].size(), CV_32FC1);
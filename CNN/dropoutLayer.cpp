@@ -8,7 +8,7 @@
 
 namespace convnet
 {
-	DropoutLayer::DropoutLayer(Mat4D &inFeatMaps, const int numThreads)
+	DropoutLayer::DropoutLayer(Tensor &inFeatMaps, const int numThreads)
 	{
 		this->inFeatMaps = inFeatMaps;
 		this->numThreads = numThreads;
@@ -16,9 +16,9 @@ namespace convnet
 
 	DropoutLayer::~DropoutLayer()
 	{
-		inFeatMaps.clear();
-		ouFeatMaps.clear();
-		mask.clear();
+		inFeatMaps.release();
+		ouFeatMaps.release();
+		mask.release();
 	}
 
 	void DropoutLayer::init()
@@ -27,26 +27,13 @@ namespace convnet
 
 		// allocate space for output maps
 		int numImages = inFeatMaps.size();	
-		int ouChns = inFeatMaps[0].size();
-		int ouRows = inFeatMaps[0][0].rows;
-		int ouCols = inFeatMaps[0][0].cols;
-		ouFeatMaps.resize(numImages);
-		for (int i = 0; i < numImages; i++) {
-			ouFeatMaps[i].resize(ouChns);
-			for (int j = 0; j < ouChns; j++) {
-				ouFeatMaps[i][j] = Mat::zeros(ouRows, ouCols, CV_32FC1);
-			}
-		}
+		int ouChns = inFeatMaps.getChns();
+		int ouRows = inFeatMaps.getRows();
+		int ouCols = inFeatMaps.getCols();
+		ouFeatMaps.create(numImages, ouChns, ouRows, ouCols, inFeatMaps.getLayout());
 
-		if (!isStaticMask) {
-			mask.resize(numImages);
-			for (int i = 0; i < numImages; i++) {
-				mask[i].resize(ouChns);
-				for (int j = 0; j < ouChns; j++) {
-					mask[i][j] = Mat::zeros(ouRows, ouCols, CV_32FC1);
-				}
-			}
-		}
+		if (!isStaticMask)
+			mask.create(numImages, ouChns, ouRows, ouCols, inFeatMaps.getLayout());
 	}
 
 	void DropoutLayer::fprop()
@@ -63,7 +50,14 @@ namespace convnet
 		#endif
 
 		for (int i = 0; i < numImages; ++i) {
-			for (int ch = 0; ch < inFeatMaps[0].size(); ++ch) {
+			// blocked maps are not planes, image i goes through as one row
+			if (inFeatMaps.getLayout() == TENSOR_NCHW8C) {
+				Mat maskView = mask.imageView(i);
+				cv::randu(maskView, 0, 1);
+				cv::threshold(maskView, maskView, dropoutRate, scale, CV_THRESH_BINARY);
+				continue;
+			}
+			for (int ch = 0; ch < inFeatMaps.getChns(); ++ch) {
 				cv::randu(mask[i][ch], 0, 1);
 				cv::threshold(mask[i][ch], mask[i][ch], dropoutRate, scale, CV_THRESH_BINARY);
 			}
@@ -74,7 +68,12 @@ namespace convnet
 		#endif
 
 		for (int i = 0; i < numImages; i++) {
-			fpropOne(ouFeatMaps[i], mask[i], inFeatMaps[i], isStaticMask);
+			if (inFeatMaps.getLayout() == TENSOR_NCHW8C) {
+				Mat ouView = ouFeatMaps.imageView(i);
+				cv::multiply(inFeatMaps.imageView(i), mask.imageView(i), ouView);
+			}
+			else
+				fpropOne(ouFeatMaps[i], mask[i], inFeatMaps[i], isStaticMask);
 		}
 	}
 
@@ -90,7 +89,12 @@ namespace convnet
 		#endif
 
 		for (int i = 0; i < numImages; i++) {
-			bpropOne(inFeatMaps[i], ouFeatMaps[i], mask[i]);
+			if (inFeatMaps.getLayout() == TENSOR_NCHW8C) {
+				Mat inView = inFeatMaps.imageView(i);
+				cv::multiply(ouFeatMaps.imageView(i), mask.imageView(i), inView);
+			}
+			else
+				bpropOne(inFeatMaps[i], ouFeatMaps[i], mask[i]);
 		}
 	}
 
@@ -105,22 +109,16 @@ namespace convnet
 						        const Mat3D &inFeatMaps,
 							    const bool isStaticMask)
 	{
-		if (!isStaticMask) {
-			for (int ch = 0; ch < inFeatMaps.size(); ++ch) {
-				ouFeatMaps[ch] = inFeatMaps[ch].mul(mask[ch]);
-			}
-		}
-		else
-			for (int ch = 0; ch < inFeatMaps.size(); ++ch)
-				ouFeatMaps[ch] = inFeatMaps[ch].mul(mask[ch]);
+		// multiply() writes into the tensor views instead of rebinding them
+		for (int ch = 0; ch < inFeatMaps.size(); ++ch)
+			cv::multiply(inFeatMaps[ch], mask[ch], ouFeatMaps[ch]);
 	}
 
 	void DropoutLayer::bpropOne(Mat3D &inFeatMaps, const Mat3D &ouFeatMaps, 
 							    const Mat3D &mask)
 	{
-		for (int ch = 0; ch < ouFeatMaps.size(); ++ch) {
-			inFeatMaps[ch] = ouFeatMaps[ch].mul(mask[ch]);
-		}
+		for (int ch = 0; ch < ouFeatMaps.size(); ++ch)
+			cv::multiply(ouFeatMaps[ch], mask[ch], inFeatMaps[ch]);
 	}
 }
 
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "layer.h"
 #include <opencv2/core/core.hpp>
 
@@ -13,19 +14,21 @@ namespace convnet
 	public:
 		DropoutLayer() {}
 
-		DropoutLayer(Mat4D &inFeatMaps, const int numThreads = 1);
+		DropoutLayer(Tensor &inFeatMaps, const int numThreads = 1);
 
 		virtual ~DropoutLayer();
 
-		inline void setNFCInFeatMaps(Mat4D &inFeatMaps);
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
 
 		inline void setDropoutRate(const float dropoutRate);
 
-		inline void setMask(const Mat4D &mask, const bool isStaticMask = true);
+		inline void setMask(const Tensor &mask, const bool isStaticMask = true);
 		
 		inline void setNumThreads(const int numThreads = 1);
 
-		inline Mat4D &getNFCOuFeatMaps();
+		inline Tensor &getNFCOuFeatMaps();
+
+		inline void getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps);
 
 		void init();
 
@@ -45,12 +48,12 @@ namespace convnet
 		void bpropOne(Mat3D &inFeatMaps, const Mat3D &ouFeatMaps, const Mat3D &mask);
 
 
-		Mat4D inFeatMaps;
-		Mat4D ouFeatMaps;
-		Mat4D mask;
+		Tensor inFeatMaps;
+		Tensor ouFeatMaps;
+		Tensor mask;
 	};
 
-	inline void DropoutLayer::setNFCInFeatMaps(Mat4D &inFeatMaps)
+	inline void DropoutLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
 	}
@@ -60,7 +63,7 @@ namespace convnet
 		this->dropoutRate = dropoutRate;
 	}
 
-	inline void DropoutLayer::setMask(const Mat4D &mask, const bool isStaticMask)
+	inline void DropoutLayer::setMask(const Tensor &mask, const bool isStaticMask)
 	{
 		this->mask = mask;
 		this->isStaticMask = isStaticMask;
@@ -71,10 +74,16 @@ namespace convnet
 		this->numThreads = numThreads;
 	}
 
-	inline Mat4D &DropoutLayer::getNFCOuFeatMaps()
+	inline Tensor &DropoutLayer::getNFCOuFeatMaps()
 	{
 		return this->ouFeatMaps;
 	}
+
+	inline void DropoutLayer::getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
 }
 
 
@@ -45,6 +45,14 @@ namespace convnet
 		biasMoments = Mat::zeros(1, numWeights, CV_32FC1);
 		bias = Mat::zeros(1, numWeights, CV_32FC1);
 
+		// second moments of the adaptive update rules
+		weightVariances.release();
+		biasVariances.release();
+		if (layerUpdater.isVarianceKept()) {
+			weightVariances = Mat::zeros(weightDims, numWeights, CV_32FC1);
+			biasVariances = Mat::zeros(1, numWeights, CV_32FC1);
+		}
+
 		// allocate space for gradients of weights and bias
 		biasGrads = Mat::zeros(1, numWeights, CV_32FC1);
 		weightGrads = Mat::zeros(weightDims, numWeights, CV_32FC1);
@@ -73,8 +81,38 @@ namespace convnet
 
 	void FCLayer::update()
 	{
-		layerUpdater.SGDUpdate(weights, weightMoments, bias, 
-							   biasMoments, weightGrads, biasGrads);
+		vector<ParamBlock> blocks;
+		beginUpdate();
+		getParamBlocks(blocks);
+		updateParamBlocks(blocks);
+	}
+
+	void FCLayer::beginUpdate()
+	{
+		layerUpdater.nextStep();
+	}
+
+	bool FCLayer::getParamBlocks(vector<ParamBlock> &blocks)
+	{
+		layerUpdater.getParamBlocks(blocks, weights, weightMoments, weightVariances,
+									bias, biasMoments, biasVariances,
+									weightGrads, biasGrads);
+		return true;
+	}
+
+	void FCLayer::getParamTensors(vector<Mat *> &params, vector<Mat *> &grads,
+								  vector<Mat *> &states)
+	{
+		params.push_back(&weights);
+		params.push_back(&bias);
+		grads.push_back(&weightGrads);
+		grads.push_back(&biasGrads);
+		states.push_back(&weightMoments);
+		states.push_back(&biasMoments);
+		if (!weightVariances.empty()) {
+			states.push_back(&weightVariances);
+			states.push_back(&biasVariances);
+		}
 	}
 
 	void FCLayer::scaleLearningRate()
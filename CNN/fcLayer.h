@@ -38,12 +38,18 @@ namespace convnet
 									 const float weightLearningRateScale,
 									 const float weightDecay);
 
+		inline void setOptimizer(const OptimMethod optimMethod,
+								 const float varianceRate,
+								 const float epsilon);
+
 		inline void setDzDxFlag(const bool flag);
 
 		inline void setNumThreads(const int numThreads = 1);
 
 		inline Mat &getFCOuFeatMaps();
 
+		inline void getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps);
+
 		inline float getCurrObjCost();
 
 		inline Mat &getFCWeights();
@@ -58,6 +64,13 @@ namespace convnet
 
 		void update();
 
+		void beginUpdate();
+
+		bool getParamBlocks(vector<ParamBlock> &blocks);
+
+		void getParamTensors(vector<Mat *> &params, vector<Mat *> &grads, 
+							 vector<Mat *> &states);
+
 		void scaleLearningRate();
 
 
@@ -77,8 +90,10 @@ namespace convnet
 	private:
 		Mat weights;
 		Mat weightMoments;
+		Mat weightVariances;
 		Mat bias;
 		Mat biasMoments;
+		Mat biasVariances;
 		Mat weightGrads;
 		Mat biasGrads;
 		Mat inFeatMaps;
@@ -118,6 +133,13 @@ namespace convnet
 									  weightDecay);
 	}
 
+	inline void FCLayer::setOptimizer(const OptimMethod optimMethod,
+										   const float varianceRate,
+										   const float epsilon)
+	{
+		layerUpdater.setOptimizer(optimMethod, varianceRate, epsilon);
+	}
+
 	inline void FCLayer::setDzDxFlag(const bool flag)
 	{
 		this->isDzDx = flag;
@@ -133,6 +155,12 @@ namespace convnet
 		return this->ouFeatMaps;
 	}
 
+	inline void FCLayer::getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
+
 	inline float FCLayer::getCurrObjCost()
 	{
 		Mat ww;
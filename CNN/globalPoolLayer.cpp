@@ -0,0 +1,107 @@
+/*
+*/
+
+#include "../Utility/check.h"
+#include "globalPoolLayer.h"
+
+#include <intrin.h>
+#include <opencv2/core/core.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// sum of n continuous floats, 8 lanes at a time
+	static float sumMap(const float *src, const int n)
+	{
+		__m128 acc0 = _mm_setzero_ps(), acc1 = acc0;
+		int k = 0;
+		for (; k + 8 <= n; k += 8) {
+			acc0 = _mm_add_ps(acc0, _mm_loadu_ps(src + k));
+			acc1 = _mm_add_ps(acc1, _mm_loadu_ps(src + k + 4));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+
+		float sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+		for (; k < n; ++k)
+			sum += src[k];
+		return sum;
+	}
+
+	static void fillMap(float *dst, const float value, const int n)
+	{
+		__m128 v = _mm_set1_ps(value);
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(dst + k, v);
+		for (; k < n; ++k)
+			dst[k] = value;
+	}
+
+
+	GlobalAvgPoolLayer::GlobalAvgPoolLayer(Tensor &inFeatMaps, const int numThreads)
+	{
+		this->inFeatMaps = inFeatMaps;
+		this->numThreads = numThreads;
+	}
+
+	GlobalAvgPoolLayer::~GlobalAvgPoolLayer()
+	{
+		inFeatMaps.release();
+		ouFeatMaps.release();
+	}
+
+	void GlobalAvgPoolLayer::init()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+		argu::ASSERT(inFeatMaps.getLayout() == TENSOR_NCHW8C,
+					 " global pooling needs planar maps !\n");
+
+		ouFeatMaps = Mat::zeros(inFeatMaps.size(), inFeatMaps.getChns(), CV_32FC1);
+	}
+
+	void GlobalAvgPoolLayer::fprop()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+		FC_OUTPUT_INIT(ouFeatMaps);
+
+		int numImages = inFeatMaps.size();
+		int chns = inFeatMaps.getChns();
+		int mapDims = inFeatMaps.getMapDims();
+		float scale = 1.0f / mapDims;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float *ouPtr = ouFeatMaps.ptr<float>(i);
+			for (int ch = 0; ch < chns; ++ch)
+				ouPtr[ch] = sumMap(inFeatMaps.ptr(i, ch), mapDims) * scale;
+		}
+	}
+
+	void GlobalAvgPoolLayer::bprop()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+		FC_OUTPUT_INIT(ouFeatMaps);
+
+		int numImages = inFeatMaps.size();
+		int chns = inFeatMaps.getChns();
+		int mapDims = inFeatMaps.getMapDims();
+		float scale = 1.0f / mapDims;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			const float *ouPtr = ouFeatMaps.ptr<float>(i);
+			for (int ch = 0; ch < chns; ++ch)
+				fillMap(inFeatMaps.ptr(i, ch), ouPtr[ch] * scale, mapDims);
+		}
+	}
+}
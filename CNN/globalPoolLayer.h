@@ -0,0 +1,79 @@
+#ifndef _CONVNET_CNN_GLOBALPOOLLAYER_H_
+#define _CONVNET_CNN_GLOBALPOOLLAYER_H_
+#pragma once
+
+#include "../Utility/types.h"
+#include "../Utility/tensor.h"
+#include "layer.h"
+#include <opencv2/core/core.hpp>  // cv::Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief averages every map into one value, the outputs are the
+	//		  [numImages x chns] fc inputs
+	//
+	//	Takes the place of a concat layer in front of the first fc
+	//	layer: the fc weights no longer grow with the map size and
+	//	the model does not depend on the input resolution. bprop
+	//	spreads each delta evenly over its map.
+	//
+	// --------------------------------------------------------------
+	class GlobalAvgPoolLayer : public Layer
+	{
+	public:
+		GlobalAvgPoolLayer() {}
+
+		GlobalAvgPoolLayer(Tensor &inFeatMaps, const int numThreads = 1);
+
+		virtual ~GlobalAvgPoolLayer();
+
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
+
+		inline void setNumThreads(const int numThreads = 1);
+
+		inline Mat &getFCOuFeatMaps();
+
+		inline void getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps);
+
+		void init();
+
+		void fprop();
+
+		void bprop();
+
+	private:
+		Tensor inFeatMaps;
+		Mat ouFeatMaps;
+
+		int numThreads;
+	};
+
+
+	inline void GlobalAvgPoolLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
+	{
+		this->inFeatMaps = inFeatMaps;
+	}
+
+	inline void GlobalAvgPoolLayer::setNumThreads(const int numThreads)
+	{
+		this->numThreads = numThreads;
+	}
+
+	inline Mat &GlobalAvgPoolLayer::getFCOuFeatMaps()
+	{
+		return this->ouFeatMaps;
+	}
+
+	inline void GlobalAvgPoolLayer::getFCActivMaps(vector<Mat *> &outputs, vector<Mat *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
+}
+
+#endif // global pooling layer
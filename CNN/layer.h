@@ -2,6 +2,9 @@
 #define _CVCONVNETS_CNN_LAYER_H_
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
+#include "../Utility/optim.h"
+#include <vector>
 #include <opencv2/core/core.hpp>
 
 namespace convnet 
@@ -13,13 +16,13 @@ namespace convnet
 
 		virtual ~Layer() {}
 
-		virtual void setNFCInFeatMaps(Mat4D &inFeatMaps) {}
+		virtual void setNFCInFeatMaps(Tensor &inFeatMaps) {}
 		
 		virtual void setFCInFeatMaps(cv::Mat &inFeatMaps) {}
 
 		virtual void setLabels(cv::Mat &labels) {}
 
-		virtual Mat4D &getNFCOuFeatMaps() { return Mat4D(); }
+		virtual Tensor &getNFCOuFeatMaps() { return Tensor(); }
 
 		virtual cv::Mat &getFCOuFeatMaps() { return cv::Mat(); }
 
@@ -39,6 +42,36 @@ namespace convnet
 
 		virtual void update() {}
 
+		// start one update step before getParamBlocks, called by 
+		// NNets::update for every layer and by update() of the layers
+		// with blocks, getParamBlocks itself has no side effects
+		virtual void beginUpdate() {}
+
+		// add the parameters for one NNets::update sweep instead of 
+		// update(), false if the layer updates itself
+		virtual bool getParamBlocks(std::vector<ParamBlock> &blocks) { return false; }
+
+		// weights, their grads and update state for the arenas of 
+		// NNets::builChains, which points the Mats at views
+		virtual void getParamTensors(std::vector<cv::Mat *> &params, 
+									 std::vector<cv::Mat *> &grads,
+									 std::vector<cv::Mat *> &states) {}
+
+		// maps the layer allocates in init() for the memory plan of 
+		// NNets::builChains: outputs the next layer reads, temps only
+		// read by the layer itself; maps shared with the input are left out
+		virtual void getNFCActivMaps(std::vector<Tensor *> &outputs,
+									 std::vector<Tensor *> &temps) {}
+
+		virtual void getFCActivMaps(std::vector<cv::Mat *> &outputs,
+									std::vector<cv::Mat *> &temps) {}
+
+		// float buffers of init() the layer fully writes before reading
+		// them within its fprop and within its bprop, so nothing is kept
+		// from one step to the next and the workspaces of all layers can
+		// share memory
+		virtual void getWorkspaces(std::vector<cv::Mat *> &workspaces) {}
+
 		virtual void scaleLearningRate() {}
 	};
 }
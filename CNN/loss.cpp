@@ -3,14 +3,19 @@
  */
 
 #include "../Utility/check.h"
-#include "../Utility/mmul.h"
+#include "../Utility/vecmath.h"
 #include "loss.h"
 
 #include <ctime>
 #include <cassert>
+#include <cmath>
 #include <iostream>
 #include <opencv2/core/core.hpp>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 using namespace std;
 using namespace cv;
 
@@ -28,31 +33,55 @@ namespace convnet
 		this->inFeatMaps = inFeatMaps;
 		this->labels = labels;
 		this->numThreads = numThreads;
+		this->objCost = 0;
 	}
 
 	SoftmaxLoss::~SoftmaxLoss()
 	{
 		inFeatMaps.release();
 		labels.release();
-		lmat.release();
+		sampleCosts.release();
 	}
 
 	void SoftmaxLoss::init()
 	{
-		lmat = Mat::zeros(inFeatMaps.size(), CV_32FC1);
+		sampleCosts = Mat::zeros(inFeatMaps.rows, 1, CV_32FC1);
+		objCost = 0;
 	}
 	
 	void SoftmaxLoss::fprop()
 	{
-		memset(lmat.data, 0, lmat.rows * lmat.cols * sizeof(float));
-		label2matrix(lmat, labels);
+		int numData = inFeatMaps.rows;
+		int numClasses = inFeatMaps.cols;
+		argu::ASSERT((int)labels.total() < numData, " fewer labels than images !\n");
+
+		float *costPtr = CV_MAT_PRF(sampleCosts);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
 
-		fpropOne(inFeatMaps);
+		for (int i = 0; i < numData; ++i)
+			costPtr[i] = fpropOne(inFeatMaps.ptr<float>(i), numClasses, getLabel(i));
+
+		double cost = 0;
+		for (int i = 0; i < numData; ++i)
+			cost += costPtr[i];
+		objCost = (float)(cost / numData);
 	}
 
 	void SoftmaxLoss::bprop()
 	{
-		bpropOne(inFeatMaps, inFeatMaps, lmat);
+		int numData = inFeatMaps.rows;
+		int numClasses = inFeatMaps.cols;
+		float scale = 1.0f / numData;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numData; ++i)
+			bpropOne(inFeatMaps.ptr<float>(i), numClasses, getLabel(i), scale);
 	}
 
 
@@ -61,32 +90,36 @@ namespace convnet
 	//								private function impl
 	//
 	// ----------------------------------------------------------------------------
-	void SoftmaxLoss::label2matrix(Mat &lmat, const Mat &label)
+	float SoftmaxLoss::fpropOne(float *scores, const int numClasses, const int label)
 	{
-		int numData = lmat.rows;
-		float *lablPtr = CV_MAT_PRF(label);
-		float *lmatPtr = CV_MAT_PRF(lmat);
-		for (int i = 0; i < numData; ++i)  {
-			int index = *lablPtr++;
-			CV_MAT_AT(lmatPtr, i, index, lmat.cols) = 1;
-		}
-		lablPtr = NULL;
-		lmatPtr = NULL;
-	}
+		argu::ASSERT(label < 0 || label >= numClasses, " label out of range !\n");
 
-	void SoftmaxLoss::fpropOne(Mat &inFeatMaps)
-	{
-		// compute softmax probability
-		Mat reduceVal;
-		reduce(inFeatMaps, reduceVal, 1, REDUCE_MAX, inFeatMaps.type());
-		inFeatMaps -= repeat(reduceVal, 1, inFeatMaps.cols);
-		exp(inFeatMaps, inFeatMaps);
-		reduce(inFeatMaps, reduceVal, 1, REDUCE_SUM, inFeatMaps.type());
-		inFeatMaps = inFeatMaps / repeat(reduceVal, 1, inFeatMaps.cols);
+		float maxScore = scores[0];
+		for (int k = 1; k < numClasses; ++k)
+			maxScore = max(maxScore, scores[k]);
+
+		// shifted scores, then their exp in place
+		float labelScore = scores[label] - maxScore;
+		for (int k = 0; k < numClasses; ++k)
+			scores[k] -= maxScore;
+		vecExp(scores, scores, numClasses, MATH_ACCURATE);
+
+		float sum = 0;
+		for (int k = 0; k < numClasses; ++k)
+			sum += scores[k];
+
+		float invSum = 1.0f / sum;
+		for (int k = 0; k < numClasses; ++k)
+			scores[k] *= invSum;
+
+		return std::log(sum) - labelScore;
 	}
 
-	void SoftmaxLoss::bpropOne(Mat &delta, const Mat &inFeatMaps, const Mat &lmat)
+	void SoftmaxLoss::bpropOne(float *probs, const int numClasses, const int label, 
+							   const float scale)
 	{
-		delta = (inFeatMaps - lmat) / inFeatMaps.rows;
+		for (int k = 0; k < numClasses; ++k)
+			probs[k] *= scale;
+		probs[label] -= scale;
 	}
-}
\ No newline at end of file
+}
@@ -13,10 +13,21 @@ namespace convnet
 	using namespace std;
 	using namespace cv;
 	
+	// --------------------------------------------------------------
+	//
+	// @brief softmax and cross-entropy fused per row
+	//
+	//	labels hold one class index per image (CV_32FC1 or 
+	//	CV_32SC1), no one-hot matrix is built. fprop turns the 
+	//	scores into probabilities in place and keeps the loss of 
+	//	every image, -log p = log sum exp(x - max) - (x_label - 
+	//	max); bprop turns the probabilities into (p - onehot) / N.
+	//
+	// --------------------------------------------------------------
 	class SoftmaxLoss : public Layer
 	{
 	public:
-		SoftmaxLoss() {}
+		SoftmaxLoss() : objCost(0) {}
 
 		SoftmaxLoss(Mat &inFeatMaps, const Mat &labels, const int numThreads = 1);
 
@@ -28,7 +39,11 @@ namespace convnet
 
 		inline void setNumThreads(int numThreads = 1);
 
+		// mean loss of the last fprop
 		inline float getCurrObjCost();
+
+		// [numImages x 1] losses of the last fprop
+		inline Mat &getSampleCosts();
 		
 		inline Mat &getFCOuFeatMaps();
 
@@ -39,16 +54,17 @@ namespace convnet
 		void bprop();
 
 	private:
-		void label2matrix(Mat &lmat, const Mat &label);
+		inline int getLabel(const int i);
 
-		void fpropOne(Mat &inFeatMaps);
+		float fpropOne(float *scores, const int numClasses, const int label);
 
-		void bpropOne(Mat &delta, const Mat &inFeatMaps, const Mat &lmat);
+		void bpropOne(float *probs, const int numClasses, const int label, const float scale);
 
 	private:
 		Mat inFeatMaps;
 		Mat labels;
-		Mat lmat;
+		Mat sampleCosts;
+		float objCost;
 		int numThreads;
 	};
 	
@@ -75,11 +91,20 @@ namespace convnet
 
 	inline float SoftmaxLoss::getCurrObjCost()
 	{
-		Mat logScores;
-		log(inFeatMaps, logScores);
-		logScores = logScores.mul(lmat);
-		return (float)(-(sum(logScores)[0]) / lmat.rows);
+		return this->objCost;
+	}
+
+	inline Mat &SoftmaxLoss::getSampleCosts()
+	{
+		return this->sampleCosts;
+	}
+
+	inline int SoftmaxLoss::getLabel(const int i)
+	{
+		if (labels.type() == CV_32SC1)
+			return ((const int *)labels.data)[i];
+		return (int)((const float *)labels.data)[i];
 	}
 }
 
-#endif // _convnet_include_classifier_h_
\ No newline at end of file
+#endif // _convnet_include_classifier_h_
@@ -5,7 +5,9 @@
 
 namespace convnet
 {
-	NNets::NNets() {}
+	NNets::NNets() : activPlan(ACTIV_PLAN_NONE), numMicroBatches(1), numAccumulated(0), 
+					 isBlockedLayout(false), 
+					 isInPlaceActiv(false), isConvAutotune(false) {}
 
 	NNets::~NNets()
 	{
@@ -26,6 +28,7 @@ namespace convnet
 								   lparams.biasLearningRateScale, lparams.weightLearningRate,
 								   lparams.weightMomentRate, lparams.weightLearningRateScale,
 								   lparams.weightDecay);
+		currNode->setOptimizer(lparams.optimMethod, lparams.varianceRate, lparams.epsilon);
 		currNode->setDzDxFlag(isDzDx);
 		currNode->setNumThreads(numThreads);
 
@@ -50,20 +53,28 @@ namespace convnet
 		addLayer(currNode, "pool");
 	}
 
-	void NNets::createActivLayer(const string activFuncName, const int numThreads)
+	void NNets::createActivLayer(const string activFuncName, const int numThreads,
+								 const MathAccuracy accuracy, const float slope, 
+								 const float alpha)
 	{
 		ActivLayer *currNode = new ActivLayer;
 		currNode->setActivFuncName(activFuncName);
+		currNode->setMathAccuracy(accuracy);
+		currNode->setActivParams(slope, alpha);
 		currNode->setNumThreads(numThreads);
 
 		// add-in nnets nodes
 		addLayer(currNode, "activ");
 	}
 
-	void NNets::createFCActivLayer(const string activFuncName, const int numThreads)
+	void NNets::createFCActivLayer(const string activFuncName, const int numThreads,
+								   const MathAccuracy accuracy, const float slope, 
+								   const float alpha)
 	{
 		FCActivLayer *currNode = new FCActivLayer;
 		currNode->setActivFuncName(activFuncName);
+		currNode->setMathAccuracy(accuracy);
+		currNode->setActivParams(slope, alpha);
 		currNode->setNumThreads(numThreads);
 
 		// add-in nnets nodes
@@ -80,6 +91,15 @@ namespace convnet
 		addLayer(currNode, "concat");
 	}
 
+	void NNets::createGlobalPoolLayer(const int numThreads)
+	{
+		GlobalAvgPoolLayer *currNode = new GlobalAvgPoolLayer;
+		currNode->setNumThreads(numThreads);
+
+		// add-in nnets nodes
+		addLayer(currNode, "globalPool");
+	}
+
 
 	void NNets::createFCNLayer(const WeightGeometry &wparams, const LearnGeometry &lparams,
 							   const bool isDzDx, const int numThreads)
@@ -90,6 +110,7 @@ namespace convnet
 								   lparams.biasLearningRateScale, lparams.weightLearningRate,
 								   lparams.weightMomentRate, lparams.weightLearningRateScale,
 								   lparams.weightDecay);
+		currNode->setOptimizer(lparams.optimMethod, lparams.varianceRate, lparams.epsilon);
 		currNode->setDzDxFlag(isDzDx);
 		currNode->setNumThreads(numThreads);
 
@@ -98,7 +119,7 @@ namespace convnet
 	}
 
 	void NNets::createDropoutLayer(const bool isStatisMask, const float dropoutRate,
-								   const int numThreads, const Mat4D &mask)
+								   const int numThreads, const Tensor &mask)
 	{
 		DropoutLayer *currNode = new DropoutLayer;
 		currNode->setMask(mask, isStatisMask);
@@ -131,30 +152,97 @@ namespace convnet
 		addLayer(currNode, "loss");
 	}
 
+	void NNets::createSampledLossLayer(const WeightGeometry &wparams, const LearnGeometry &lparams,
+									   const SoftmaxApprox approx, const int numSampled,
+									   const bool isDzDx, const int numThreads,
+									   const Mat &classCounts)
+	{
+		// the touched rows are updated with momentum SGD only
+		argu::ASSERT(lparams.optimMethod != OPTIM_SGD, 
+					 " sampled loss layers only support OPTIM_SGD !\n");
+
+		SampledSoftmaxLoss *currNode = new SampledSoftmaxLoss;
+		currNode->setWeightGeometry(wparams.numWeights, wparams.weightChns, wparams.initWeightScale);
+		currNode->setUpdaterParams(lparams.biasLearningRate, lparams.biasMomentRate,
+								   lparams.biasLearningRateScale, lparams.weightLearningRate,
+								   lparams.weightMomentRate, lparams.weightLearningRateScale,
+								   lparams.weightDecay);
+		currNode->setApproximation(approx, numSampled);
+		currNode->setClassFrequency(classCounts);
+		currNode->setDzDxFlag(isDzDx);
+		currNode->setNumThreads(numThreads);
+
+		// add-in nnets nodes
+		addLayer(currNode, "sampledLoss");
+	}
+
+	void NNets::setEvaluation(const bool isEval)
+	{
+		for (int i = 0; i < nodeName.size(); ++i) {
+			if (nodeName[i] == "sampledLoss")
+				((SampledSoftmaxLoss *)nodeFunc[i])->setEvaluation(isEval);
+		}
+	}
+
 	void NNets::builChains(const bool isRebuild)
 	{
 		NNETS_INIT(nodeFunc, nodeName);
 
-		if (isRebuild)
-			nodeFunc[0]->init();
+		if (isRebuild && isBlockedLayout && nodeName[0] != "reorder")
+			insertReorderLayers();
+
+		bool isTuning = isRebuild && isConvAutotune;
+		map<string, Vec3i> tuneCache;
+		if (isTuning)
+			loadConvTuneCache(tuneCache);
+
+		if (isRebuild) {
+			if (isTuning && nodeName[0] == "conv")
+				initConvLayer((ConvLayer *)nodeFunc[0], tuneCache);
+			else
+				nodeFunc[0]->init();
+		}
 
 		for (int i = 1; i < nodeName.size(); ++i) {
 			if (nodeName[i] == "conv" || nodeName[i] == "pool" || nodeName[i] == "activ" ||
-				nodeName[i] == "dropout" || nodeName[i] == "concat")
+				nodeName[i] == "dropout" || nodeName[i] == "concat" || nodeName[i] == "reorder" ||
+				nodeName[i] == "globalPool")
 				nodeFunc[i]->setNFCInFeatMaps(nodeFunc[i - 1]->getNFCOuFeatMaps());
 				
 			else if (nodeName[i] == "fcActiv" || nodeName[i] == "fcDropout" || 
 				     nodeName[i] == "fc")
 				nodeFunc[i]->setFCInFeatMaps(nodeFunc[i - 1]->getFCOuFeatMaps());
 	
-			else if (nodeName[i] == "loss") {
+			else if (nodeName[i] == "loss" || nodeName[i] == "sampledLoss") {
 				nodeFunc[i]->setFCInFeatMaps(nodeFunc[i - 1]->getFCOuFeatMaps());
 			}
 
+			// the images in front of node 0 are never overwritten
+			if (isRebuild && (nodeName[i] == "activ" || nodeName[i] == "fcActiv"))
+				((ActivLayer *)nodeFunc[i])->setInPlace(isInPlaceActiv);
+
 			// initialize current node
-			if (isRebuild)
+			if (isTuning && nodeName[i] == "conv")
+				initConvLayer((ConvLayer *)nodeFunc[i], tuneCache);
+			else if (isRebuild)
 				nodeFunc[i]->init();
 		}
+
+		if (isTuning)
+			saveConvTuneCache(tuneCache);
+
+		if (isRebuild) {
+			buildParamArenas();
+			checkGradAccumulation();
+		}
+
+		// the layers allocated their own maps and workspaces again
+		if (isRebuild && activPlan != ACTIV_PLAN_NONE)
+			planActivMaps();
+		else if (isRebuild) {
+			activBuffers.clear();
+			workspaceBuffers.clear();
+		}
 	}
 	
 
@@ -170,6 +258,8 @@ namespace convnet
 	void NNets::bprop()
 	{
 		NNETS_INIT(nodeFunc, nodeName);
+		argu::ASSERT(activPlan == ACTIV_PLAN_INFERENCE, 
+					 " the maps bprop needs are not kept by the inference plan !\n");
 
 		for (int i = nodeName.size() - 1; i >= 0; --i) {
 			nodeFunc[i]->bprop();
@@ -180,9 +270,40 @@ namespace convnet
 	{
 		NNETS_INIT(nodeFunc, nodeName);
 
+		// the loss layer averages over a micro batch, the mean of the
+		// sums is the gradient of the whole effective batch
+		if (numMicroBatches > 1) {
+			accumulateGrads();
+			if (numAccumulated < numMicroBatches)
+				return;
+
+			Mat grads = gradArena.getMat();
+			gradSums.convertTo(grads, CV_32FC1, 1.0 / numAccumulated);
+			gradSums.setTo(0);
+			numAccumulated = 0;
+		}
+
+		// conv and fc parameters of all layers in one sweep
+		vector<ParamBlock> blocks;
 		for (int i = 0; i < nodeName.size(); ++i) {
-			nodeFunc[i]->update();
+			nodeFunc[i]->beginUpdate();
+			if (!nodeFunc[i]->getParamBlocks(blocks))
+				nodeFunc[i]->update();
 		}
+		updateParamBlocks(blocks);
+	}
+
+	void NNets::zeroGrads()
+	{
+		if (!gradArena.empty())
+			gradArena.getMat().setTo(0);
+	}
+
+	float NNets::getGradNorm()
+	{
+		if (gradArena.empty())
+			return 0;
+		return (float)norm(gradArena.getMat());
 	}
 
 	void NNets::scaleLearningRate()
@@ -190,7 +311,7 @@ namespace convnet
 		NNETS_INIT(nodeFunc, nodeName);
 
 		for (int i = 0; i < nodeName.size(); ++i) {
-			if (nodeName[i] == "conv" || nodeName[i] == "fc")
+			if (nodeName[i] == "conv" || nodeName[i] == "fc" || nodeName[i] == "sampledLoss")
 				nodeFunc[i]->scaleLearningRate();
 		}
 	}
@@ -218,10 +339,22 @@ namespace convnet
 			// rebuild chains
 			builChains(false);
 		}
+
+		// the lifetimes changed with the chain
+		if (activPlan != ACTIV_PLAN_NONE)
+			planActivMaps();
 	}
 
 	void NNets::release()
 	{
+		paramArena.release();
+		gradArena.release();
+		stateArena.release();
+		gradSums.release();
+		numAccumulated = 0;
+		activBuffers.clear();
+		workspaceBuffers.clear();
+
 		if (!nodeFunc.empty()) {
 			for (int i = 0; i < nodeName.size(); ++i) {
 				if (nodeFunc[i] != NULL) delete nodeFunc[i];
@@ -230,4 +363,306 @@ namespace convnet
 		nodeFunc.clear();
 		nodeName.clear();
 	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------	
+	void NNets::initConvLayer(ConvLayer *layer, map<string, Vec3i> &tuneCache)
+	{
+		string key = layer->getTuneKey();
+		map<string, Vec3i>::iterator it = tuneCache.find(key);
+		if (it != tuneCache.end()) {
+			for (int p = 0; p < CONV_NUM_PASSES; ++p)
+				layer->setConvAlgorithm((ConvPass)p, (ConvAlgorithm)it->second[p]);
+			layer->init();
+			return;
+		}
+
+		layer->init();
+		layer->autotune();
+		tuneCache[key] = Vec3i(layer->getConvAlgorithm(CONV_FPROP), 
+							   layer->getConvAlgorithm(CONV_WGRAD),
+							   layer->getConvAlgorithm(CONV_DGRAD));
+	}
+
+	// one "key fprop wgrad dgrad" line per layer shape, a missing file 
+	// is an empty cache
+	void NNets::loadConvTuneCache(map<string, Vec3i> &tuneCache)
+	{
+		FILE *file = NULL;
+		errno_t err = fopen_s(&file, convTuneFile.c_str(), "r");
+		if (err != 0 || file == NULL)
+			return;
+
+		char key[256];
+		Vec3i algos;
+		while (fscanf_s(file, "%255s %d %d %d", key, (unsigned int)sizeof(key),
+						&algos[0], &algos[1], &algos[2]) == 4)
+			tuneCache[key] = algos;
+
+		fclose(file);
+	}
+
+	void NNets::saveConvTuneCache(const map<string, Vec3i> &tuneCache)
+	{
+		FILE *file = NULL;
+		errno_t err = fopen_s(&file, convTuneFile.c_str(), "w");
+		if (err != 0 || file == NULL) {
+			printf("Could not write %s\n", convTuneFile.c_str());
+			return;
+		}
+
+		map<string, Vec3i>::const_iterator it;
+		for (it = tuneCache.begin(); it != tuneCache.end(); ++it)
+			fprintf(file, "%s %d %d %d\n", it->first.c_str(), 
+					it->second[0], it->second[1], it->second[2]);
+
+		fclose(file);
+	}
+
+	void NNets::buildParamArenas()
+	{
+		vector<Mat *> params, grads, states;
+		for (int i = 0; i < nodeName.size(); ++i)
+			nodeFunc[i]->getParamTensors(params, grads, states);
+
+		bindArena(paramArena, params);
+		bindArena(gradArena, grads);
+		bindArena(stateArena, states);
+
+		// sums of the old grads no longer match the slab
+		gradSums.release();
+		numAccumulated = 0;
+	}
+
+	// the values are kept, the layers go on with views into the slab
+	void NNets::bindArena(FlatArena &arena, vector<Mat *> &tensors)
+	{
+		arena.release();
+		if (tensors.empty())
+			return;
+
+		vector<Size> shapes(tensors.size());
+		for (int t = 0; t < tensors.size(); ++t)
+			shapes[t] = tensors[t]->size();
+		arena.create(shapes);
+
+		for (int t = 0; t < tensors.size(); ++t) {
+			Mat view = arena.getView(t);
+			tensors[t]->copyTo(view);
+			*tensors[t] = view;
+		}
+	}
+
+	void NNets::checkGradAccumulation()
+	{
+		if (numMicroBatches == 1)
+			return;
+
+		// sampled loss layers keep row-sparse grads outside the arena
+		for (int i = 0; i < nodeName.size(); ++i) {
+			argu::ASSERT(nodeName[i] == "sampledLoss", 
+						 " sampled loss layers cannot accumulate grads !\n");
+		}
+	}
+
+	void NNets::accumulateGrads()
+	{
+		argu::ASSERT(gradArena.empty(), " builChains(true) before accumulating grads !\n");
+
+		Mat grads = gradArena.getMat();
+		if (gradSums.size() != grads.size())
+			gradSums = Mat::zeros(grads.size(), CV_32FC1);
+		gradSums += grads;
+		++numAccumulated;
+	}
+
+	void NNets::planActivMaps()
+	{
+		// in training every map lives from the fprop to the bprop of its
+		// layer, those lifetimes all nest and no two maps could share
+		if (activPlan == ACTIV_PLAN_INFERENCE)
+			planInferenceMaps();
+		else
+			activBuffers.clear();
+		planWorkspaces();
+	}
+
+	void NNets::planInferenceMaps()
+	{
+		int numNodes = nodeName.size();
+
+		// what each node hands on, nodes working in place or on views
+		// hand on the maps of the node before them
+		vector<const void *> ouPtrs(numNodes);
+		for (int i = 0; i < numNodes; ++i) {
+			if (nodeName[i] == "conv" || nodeName[i] == "pool" || nodeName[i] == "activ" ||
+				nodeName[i] == "dropout" || nodeName[i] == "reorder")
+				ouPtrs[i] = nodeFunc[i]->getNFCOuFeatMaps().ptr();
+			else
+				ouPtrs[i] = nodeFunc[i]->getFCOuFeatMaps().data;
+		}
+
+		// blocked maps keep their slabs, the padding lanes must stay zero
+		MemoryPlanner planner;
+		vector<Tensor *> planMaps;
+		vector<Mat *> planFCMaps;
+		vector<int> mapIds, fcMapIds;
+		size_t keptBytes = 0;
+		for (int i = 0; i < numNodes; ++i) {
+			vector<Tensor *> outputs, temps;
+			vector<Mat *> fcOutputs, fcTemps;
+			nodeFunc[i]->getNFCActivMaps(outputs, temps);
+			nodeFunc[i]->getFCActivMaps(fcOutputs, fcTemps);
+
+			for (int k = 0; k < outputs.size() + temps.size(); ++k) {
+				bool isOutput = k < outputs.size();
+				Tensor *maps = isOutput ? outputs[k] : temps[k - outputs.size()];
+				size_t bytes = maps->getTotal() * sizeof(float) + TENSOR_ALIGN_BYTES;
+				if (maps->getLayout() == TENSOR_NCHW8C) {
+					keptBytes += bytes;
+					continue;
+				}
+				int last = isOutput ? getLastStep(i, ouPtrs) : i;
+				mapIds.push_back(planner.addBuffer(bytes, i, last));
+				planMaps.push_back(maps);
+			}
+			for (int k = 0; k < fcOutputs.size() + fcTemps.size(); ++k) {
+				bool isOutput = k < fcOutputs.size();
+				Mat *maps = isOutput ? fcOutputs[k] : fcTemps[k - fcOutputs.size()];
+				size_t bytes = maps->total() * sizeof(float) + TENSOR_ALIGN_BYTES;
+				int last = isOutput ? getLastStep(i, ouPtrs) : i;
+				fcMapIds.push_back(planner.addBuffer(bytes, i, last));
+				planFCMaps.push_back(maps);
+			}
+		}
+		planner.plan();
+
+		int lineDims = TENSOR_ALIGN_BYTES / sizeof(float);
+		activBuffers.resize(planner.getNumSlots());
+		for (int s = 0; s < planner.getNumSlots(); ++s) {
+			int dims = (int)(planner.getSlotBytes(s) / sizeof(float));
+			activBuffers[s] = Mat::zeros(1, dims + lineDims, CV_32FC1);
+		}
+
+		for (int k = 0; k < planMaps.size(); ++k)
+			planMaps[k]->rebind(activBuffers[planner.getSlot(mapIds[k])]);
+
+		for (int k = 0; k < planFCMaps.size(); ++k) {
+			Mat &buffer = activBuffers[planner.getSlot(fcMapIds[k])];
+			int offset = (int)((float *)alignPtr(buffer.data, TENSOR_ALIGN_BYTES) - (float *)buffer.data);
+			Mat &maps = *planFCMaps[k];
+			maps = buffer.colRange(offset, offset + (int)maps.total()).reshape(1, maps.rows);
+		}
+
+		// the next layers read the new maps
+		builChains(false);
+
+		printf("Activation maps: %2.2f MB planned in %d buffers, %2.2f MB naive \n",
+			   (planner.getPlannedBytes() + keptBytes) / 1048576.0f, planner.getNumSlots(),
+			   (planner.getNaiveBytes() + keptBytes) / 1048576.0f);
+	}
+
+	void NNets::planWorkspaces()
+	{
+		int numNodes = nodeName.size();
+		int lineBytes = TENSOR_ALIGN_BYTES;
+
+		// a workspace holds data only during the fprop or the bprop of
+		// its own layer, so node i stands for both of its steps and the
+		// workspaces of different layers never overlap; those of one
+		// layer are laid out one after another, each on its own line
+		MemoryPlanner planner;
+		vector<vector<Mat *> > nodeWorkspaces(numNodes);
+		vector<int> nodeIds(numNodes, -1);
+		for (int i = 0; i < numNodes; ++i) {
+			vector<Mat *> workspaces;
+			nodeFunc[i]->getWorkspaces(workspaces);
+
+			size_t bytes = 0;
+			for (int k = 0; k < workspaces.size(); ++k) {
+				if (workspaces[k]->empty())
+					continue;
+				nodeWorkspaces[i].push_back(workspaces[k]);
+				bytes += alignSize(workspaces[k]->total() * sizeof(float), lineBytes);
+			}
+			if (bytes > 0)
+				nodeIds[i] = planner.addBuffer(bytes + lineBytes, i, i);
+		}
+		planner.plan();
+
+		workspaceBuffers.resize(planner.getNumSlots());
+		for (int s = 0; s < planner.getNumSlots(); ++s)
+			workspaceBuffers[s] = Mat::zeros(1, (int)(planner.getSlotBytes(s) / sizeof(float)), CV_32FC1);
+
+		for (int i = 0; i < numNodes; ++i) {
+			if (nodeIds[i] < 0)
+				continue;
+
+			// views of the buffer, which they keep alive
+			Mat &buffer = workspaceBuffers[planner.getSlot(nodeIds[i])];
+			int offset = (int)((float *)alignPtr(buffer.data, lineBytes) - (float *)buffer.data);
+			for (int k = 0; k < nodeWorkspaces[i].size(); ++k) {
+				Mat &workspace = *nodeWorkspaces[i][k];
+				int dims = (int)workspace.total();
+				workspace = buffer.colRange(offset, offset + dims).reshape(1, workspace.rows);
+				offset += (int)(alignSize(dims * sizeof(float), lineBytes) / sizeof(float));
+			}
+		}
+
+		printf("Workspaces: %2.2f MB planned in %d buffers, %2.2f MB naive \n",
+			   planner.getPlannedBytes() / 1048576.0f, planner.getNumSlots(),
+			   planner.getNaiveBytes() / 1048576.0f);
+	}
+
+	int NNets::getLastStep(const int index, const vector<const void *> &ouPtrs)
+	{
+		int numNodes = nodeName.size();
+
+		// the node after the last one handing the maps on reads them,
+		// the outputs of the last node live to the end of the pass
+		int last = index;
+		while (last + 1 < numNodes && ouPtrs[last + 1] == ouPtrs[index])
+			++last;
+		return min(last + 1, numNodes - 1);
+	}
+
+	void NNets::insertReorderLayers()
+	{
+		int numBlocked = 0;
+		bool hasConv = false;
+		for (; numBlocked < nodeName.size(); ++numBlocked) {
+			if (!isBlockedNode(numBlocked))
+				break;
+			hasConv |= nodeName[numBlocked] == "conv";
+		}
+
+		if (!hasConv) {
+			printf("No conv layer runs on blocked maps, keep the plain layout\n");
+			return;
+		}
+
+		ReorderLayer *toPlanes = new ReorderLayer;
+		toPlanes->setLayout(TENSOR_NCHW);
+		nodeFunc.insert(nodeFunc.begin() + numBlocked, toPlanes);
+		nodeName.insert(nodeName.begin() + numBlocked, "reorder");
+
+		ReorderLayer *toBlocks = new ReorderLayer;
+		toBlocks->setLayout(TENSOR_NCHW8C);
+		toBlocks->setDzDxFlag(false);
+		toBlocks->setNFCInFeatMaps(inFeatMaps);
+		nodeFunc.insert(nodeFunc.begin(), toBlocks);
+		nodeName.insert(nodeName.begin(), "reorder");
+	}
+
+	bool NNets::isBlockedNode(const int index)
+	{
+		if (nodeName[index] == "conv")
+			return ((ConvLayer *)nodeFunc[index])->isLayoutSupported(TENSOR_NCHW8C);
+		return nodeName[index] == "pool" || nodeName[index] == "activ" ||
+			   nodeName[index] == "dropout";
+	}
 }
\ No newline at end of file
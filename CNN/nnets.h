@@ -5,17 +5,24 @@
 #define _CONVNET_CNN_NNETS_H_
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "../Utility/check.h"
 #include "../Utility/param.h"
+#include "../Utility/arena.h"
+#include "../Utility/memplan.h"
 #include "layer.h"
 #include "activLayer.h"
 #include "concatLayer.h"
+#include "globalPoolLayer.h"
 #include "convLayer.h"
 #include "fcLayer.h"
 #include "poolLayer.h"
 #include "dropoutLayer.h"
+#include "reorderLayer.h"
 #include "updater.h"
 #include "loss.h"
+#include "sampledLoss.h"
+#include <map>
 #include <string>
 #include <opencv2/core/core.hpp>
 
@@ -24,6 +31,28 @@ namespace convnet
 	using namespace std;
 	using namespace cv;
 
+	// --------------------------------------------------------------
+	//
+	// @brief how builChains(true) places the maps of the layers
+	//
+	//	ACTIV_PLAN_NONE leaves every layer its own buffers. Both
+	//	plans let the workspaces of all layers (Layer::getWorkspaces)
+	//	share one buffer, as each holds data only within a step of
+	//	its own layer. ACTIV_PLAN_INFERENCE also gives the output
+	//	and temporary maps a lifetime over the steps of fprop and
+	//	lets maps with disjoint lifetimes share buffers, which keeps
+	//	about two layers of maps live and rules out bprop(). In
+	//	training every map is live from its fprop to its bprop, so
+	//	ACTIV_PLAN_TRAIN leaves the maps alone.
+	//
+	// --------------------------------------------------------------
+	enum ActivPlan
+	{
+		ACTIV_PLAN_NONE = 0,
+		ACTIV_PLAN_TRAIN = 1,
+		ACTIV_PLAN_INFERENCE = 2
+	};
+
 	class NNets
 	{
 	public:
@@ -35,7 +64,7 @@ namespace convnet
 
 		inline string getLayerName(const int index);
 
-		inline void setInputImages(Mat4D &inFeatMaps);
+		inline void setInputImages(Tensor &inFeatMaps);
 
 		inline void setInputLabels(Mat &labels);
 		
@@ -49,6 +78,28 @@ namespace convnet
 
 		inline float getCurrObjCost();
 
+		// time the algorithms of every conv pass when builChains(true) 
+		// initializes the layers, choices are kept in cacheFile and reused 
+		// for layers with the same key (ConvLayer::getTuneKey)
+		inline void setConvAutotune(const bool isAutotune, 
+									const string &cacheFile = "convtune.txt");
+
+		// run the leading conv / pool / activ / dropout layers on 
+		// TENSOR_NCHW8C maps, builChains(true) puts reorder layers 
+		// around them
+		inline void setBlockedLayout(const bool isBlocked);
+
+		// ReLU / LeakyReLU / Linear activation layers overwrite the maps 
+		// of the layer before them and keep a bit mask for bprop, except 
+		// at the input
+		inline void setInPlaceActiv(const bool isInPlace);
+
+		// share buffers between workspaces and maps of disjoint lifetimes,
+		// builChains(true) prints the planned and the naive bytes; with
+		// ACTIV_PLAN_INFERENCE only the outputs of the last layer stay
+		// valid after fprop()
+		inline void setActivPlan(const ActivPlan activPlan);
+
 		// create a convolution layer
 		void createConvLayer(const WeightGeometry &wparams, const StrideGeometry &strides,
 						     const PadGeometry &padding, const LearnGeometry &lparams,
@@ -62,14 +113,22 @@ namespace convnet
 
 
 		// create a activation layer
-		void createActivLayer(const string activFuncName, const int numThreads = 1);
+		// slope is used by "LeakyReLU", alpha by "ELU"
+		void createActivLayer(const string activFuncName, const int numThreads = 1,
+							  const MathAccuracy accuracy = MATH_ACCURATE,
+							  const float slope = 0.01f, const float alpha = 1.0f);
 
 		// create a FC activation layer
-		void createFCActivLayer(const string activFuncName, const int numThreads = 1);
+		void createFCActivLayer(const string activFuncName, const int numThreads = 1,
+								const MathAccuracy accuracy = MATH_ACCURATE,
+								const float slope = 0.01f, const float alpha = 1.0f);
 		
 		// create a concatenation layer
 		void createConcatLayer(const WeightGeometry &wparams, const int numThreads = 1);
 
+		// create a global average pooling layer, one fc input per channel
+		void createGlobalPoolLayer(const int numThreads = 1);
+
 		// create a fully-connected layer
 		void createFCNLayer(const WeightGeometry &wparams, const LearnGeometry &lparams,
 							const bool isDzDx, const int numThreads = 1);
@@ -77,7 +136,7 @@ namespace convnet
 		
 		// create a dropout layer
 		void createDropoutLayer(const bool isStatisMask, const float dropoutRate,
-							    const int numThreads = 1, const Mat4D &mask = Mat4D ());
+							    const int numThreads = 1, const Tensor &mask = Tensor ());
 
 		// create a FC dropout layer
 		void createFCDropoutLayer(const bool isStatisMask, const float dropoutRate,
@@ -86,6 +145,18 @@ namespace convnet
 		// create a loss layer
 		void createLossLayer(const int numThreads = 1);
 
+		// create the last fc layer and softmax loss in one, training only 
+		// computes the classes of sampled negatives (numSampled) or of the 
+		// label clusters (numSampled clusters), see SampledSoftmaxLoss;
+		// lparams must keep the default OPTIM_SGD
+		void createSampledLossLayer(const WeightGeometry &wparams, const LearnGeometry &lparams,
+									const SoftmaxApprox approx, const int numSampled,
+									const bool isDzDx, const int numThreads = 1,
+									const Mat &classCounts = Mat());
+
+		// sampled loss layers compute all classes when isEval is true
+		void setEvaluation(const bool isEval);
+
 		// init each layer and build nodes chains 
 		void builChains(const bool isRebuild = false);
 				
@@ -95,9 +166,34 @@ namespace convnet
 		// backward pass
 		void bprop();
 
-		// update learning params
+		// update learning params; with gradient accumulation each call
+		// adds the grads of the last bprop and only every 
+		// numMicroBatches-th call updates, with the mean of their sums
 		void update();
 
+		// sum the grads of numMicroBatches fprop / bprop / update passes
+		// before update() applies them, the batch buffers only hold one
+		// micro batch; 1 (default) updates after every pass
+		inline void setGradAccumulation(const int numMicroBatches);
+
+		// micro batches summed since the last update
+		inline int getNumAccumulated();
+
+		// weights, grads and update state of the conv / fc layers, each
+		// one 64 byte aligned [1 x n] slab after builChains(true), for
+		// checkpoints or an all-reduce of the grads
+		inline Mat getParamArena();
+
+		inline Mat getGradArena();
+
+		inline Mat getStateArena();
+
+		// clear all grads in one pass
+		void zeroGrads();
+
+		// L2 norm of all grads
+		float getGradNorm();
+
 		// scale learning rate
 		void scaleLearningRate();
 
@@ -107,9 +203,61 @@ namespace convnet
 		// release model
 		void release();
 
+	private:
+		// init() with the cached choice or autotune() and record it
+		void initConvLayer(ConvLayer *layer, map<string, Vec3i> &tuneCache);
+
+		void loadConvTuneCache(map<string, Vec3i> &tuneCache);
+
+		void saveConvTuneCache(const map<string, Vec3i> &tuneCache);
+
+		// reorder into blocks in front of the first layer and back to 
+		// planes after the last layer that handles blocks
+		void insertReorderLayers();
+
+		bool isBlockedNode(const int index);
+
+		// move the parameter tensors of every layer into the arenas
+		void buildParamArenas();
+
+		void bindArena(FlatArena &arena, vector<Mat *> &tensors);
+
+		// the layers of the chain can sum their grads in the arena
+		void checkGradAccumulation();
+
+		// add the grads of the last bprop to gradSums, by update()
+		void accumulateGrads();
+
+		// workspaces for both plans, the maps for the inference plan
+		void planActivMaps();
+
+		// lifetimes of the maps of all layers over fprop, then interval
+		// coloring into activBuffers and re-linking the chain
+		void planInferenceMaps();
+
+		// the workspaces of the layers into workspaceBuffers
+		void planWorkspaces();
+
+		// last step of fprop that reads the outputs of node index
+		int getLastStep(const int index, const vector<const void *> &ouPtrs);
+
 	private:
 		vector<Layer *> nodeFunc;
 		vector<string > nodeName;
+		Tensor inFeatMaps;
+		FlatArena paramArena;
+		FlatArena gradArena;
+		FlatArena stateArena;
+		Mat gradSums;
+		vector<Mat> activBuffers;
+		vector<Mat> workspaceBuffers;
+		ActivPlan activPlan;
+		int numMicroBatches;
+		int numAccumulated;
+		bool isBlockedLayout;
+		bool isInPlaceActiv;
+		bool isConvAutotune;
+		string convTuneFile;
 	};
 
 
@@ -123,8 +271,9 @@ namespace convnet
 		return nodeName[index];
 	}
 
-	inline void NNets::setInputImages(Mat4D &inFeatMaps)
+	inline void NNets::setInputImages(Tensor &inFeatMaps)
 	{
+		this->inFeatMaps = inFeatMaps;
 		nodeFunc[0]->setNFCInFeatMaps(inFeatMaps);
 	}
 
@@ -160,6 +309,9 @@ namespace convnet
 				num += nodeFunc[i]->getFCWeights().total();
 				num += nodeFunc[i]->getBias().total();
 			}
+			else if (nodeName[i] == "sampledLoss") {
+				num += ((SampledSoftmaxLoss *)nodeFunc[i])->getNumberParams();
+			}
 		}
 		return num;
 	}
@@ -181,6 +333,56 @@ namespace convnet
 		}
 		return objCost;
 	}
+
+	inline Mat NNets::getParamArena()
+	{
+		return paramArena.getMat();
+	}
+
+	inline Mat NNets::getGradArena()
+	{
+		return gradArena.getMat();
+	}
+
+	inline Mat NNets::getStateArena()
+	{
+		return stateArena.getMat();
+	}
+
+	inline void NNets::setActivPlan(const ActivPlan activPlan)
+	{
+		this->activPlan = activPlan;
+	}
+
+	inline void NNets::setGradAccumulation(const int numMicroBatches)
+	{
+		argu::ASSERT(numMicroBatches < 1, " accumulate at least one micro batch !\n");
+		this->numMicroBatches = numMicroBatches;
+		this->numAccumulated = 0;
+		this->gradSums.release();
+		checkGradAccumulation();
+	}
+
+	inline int NNets::getNumAccumulated()
+	{
+		return this->numAccumulated;
+	}
+
+	inline void NNets::setBlockedLayout(const bool isBlocked)
+	{
+		this->isBlockedLayout = isBlocked;
+	}
+
+	inline void NNets::setInPlaceActiv(const bool isInPlace)
+	{
+		this->isInPlaceActiv = isInPlace;
+	}
+
+	inline void NNets::setConvAutotune(const bool isAutotune, const string &cacheFile)
+	{
+		this->isConvAutotune = isAutotune;
+		this->convTuneFile = cacheFile;
+	}
 }
 
 
@@ -4,8 +4,10 @@
 #include "../Utility/check.h"
 #include "poolLayer.h"
 
+#include <intrin.h>
 #include <algorithm>
 #include <climits>
+#include <limits>
 #include <opencv2/core/core.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 
@@ -19,75 +21,6 @@ namespace convnet
 	using namespace cv;
 	
 
-	class MaxOperator : public OperatorFunction
-	{
-	public:
-		MaxOperator() {}
-		virtual ~MaxOperator() {}
-
-		virtual void fprop(float *ouFeatMaps,
-						   const float *inFeatMaps, 
-						   const int inCols,
-						   const int r1, 
-						   const int r2, 
-						   const int c1, 
-						   const int c2);
-
-		virtual void bprop(float *upFeatMaps, 
-						   const float *inFeatMaps,
-						   const float *ouFeatMaps,
-						   const int inCols,
-						   const int r1, 
-						   const int r2, 
-						   const int c1, 
-						   const int c2);
-	};
-
-	void MaxOperator::fprop(float *ouFeatMaps,
-							const float *inFeatMaps,
-						    const int inCols,
-						    const int r1,
-						    const int r2,
-							const int c1,
-							const int c2)
-	{
-		float maxValue = -std::numeric_limits<float>::infinity();
-		for (int r = r1; r < r2; ++r) {
- 			for (int c = c1; c < c2; ++c) {
-				if (maxValue < CV_MAT_AT(inFeatMaps, r, c, inCols))
-					maxValue = CV_MAT_AT(inFeatMaps, r, c, inCols);
- 			}
-		}
-		*ouFeatMaps = maxValue;
-	}
-
-	void MaxOperator::bprop(float *upFeatMaps,
-						    const float *inFeatMaps,
-							const float *ouFeatMaps,
-						    const int inCols,
-							const int r1,
-						    const int r2,
-						    const int c1,
-							const int c2)
-	{
-		int maxR = 0;
-		int maxC = 0;
-		float maxValue = -std::numeric_limits<float>::infinity();
-		for (int r = r1; r < r2; ++r) {
-			for (int c = c1; c < c2; ++c) {
-				if (maxValue < CV_MAT_AT(inFeatMaps, r, c, inCols)) {
-					maxValue = CV_MAT_AT(inFeatMaps, r, c, inCols);
-					maxR = r;
-					maxC = c;
-				}
-			}
-		}
-		CV_MAT_AT(upFeatMaps, maxR, maxC, inCols) += *ouFeatMaps;
-	}
-
-
-
-
 	class AvgOperator : public OperatorFunction
 	{
 	public:
@@ -144,6 +77,545 @@ namespace convnet
 			}
 		}
 	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//							max pooling with argmax
+	//
+	//	Every output keeps the offset (wy * width + wx) of its maximum inside
+	//	the unclipped window, bprop then adds each delta to one input value
+	//	without looking at the inputs again. Blocked maps keep one offset per
+	//	channel of a block.
+	//
+	// ----------------------------------------------------------------------------
+	template <typename T>
+	static void maxPoolImage(Tensor &ouFeatMaps, T *index, const Tensor &inFeatMaps, const int i,
+							 const WeightGeometry &wparams, const StrideGeometry &strides,
+							 const PadGeometry &padding)
+	{
+		bool isBlocked = inFeatMaps.getLayout() == TENSOR_NCHW8C;
+		int numMaps = isBlocked ? inFeatMaps.getChnBlocks() : inFeatMaps.getChns();
+		int inRows = inFeatMaps.getRows();
+		int inCols = inFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+		const float minValue = -std::numeric_limits<float>::infinity();
+
+		int r0, r1, r2, c0, c1, c2;
+		for (int m = 0; m < numMaps; ++m) {
+			const float *inPtr = inFeatMaps.ptr(i, m);
+			float *ouPtr = ouFeatMaps.ptr(i, m);
+			T *idxPtr = index + m * ouFeatMaps.getChnStep();
+			for (int r = 0; r < ouRows; ++r) {
+				r0 = r * strides.stepRow - padding.top;
+				r1 = max(r0, 0);
+				r2 = min(r0 + wparams.height, inRows);
+				for (int c = 0; c < ouCols; ++c) {
+					c0 = c * strides.stepCol - padding.left;
+					c1 = max(c0, 0);
+					c2 = min(c0 + wparams.width, inCols);
+					int first = (r1 - r0) * wparams.width + (c1 - c0);
+
+					if (!isBlocked) {
+						float maxValue = minValue;
+						int maxIndex = first;
+						for (int y = r1; y < r2; ++y) {
+							for (int x = c1; x < c2; ++x) {
+								if (maxValue < inPtr[y * inCols + x]) {
+									maxValue = inPtr[y * inCols + x];
+									maxIndex = (y - r0) * wparams.width + (x - c0);
+								}
+							}
+						}
+						ouPtr[r * ouCols + c] = maxValue;
+						idxPtr[r * ouCols + c] = (T)maxIndex;
+						continue;
+					}
+
+					// 8 channels at once, offsets ride along as floats
+					__m128 max0 = _mm_set1_ps(minValue), max1 = max0;
+					__m128 arg0 = _mm_set1_ps((float)first), arg1 = arg0;
+					for (int y = r1; y < r2; ++y) {
+						for (int x = c1; x < c2; ++x) {
+							const float *src = inPtr + (y * inCols + x) * TENSOR_BLOCK_CHNS;
+							__m128 pos = _mm_set1_ps((float)((y - r0) * wparams.width + (x - c0)));
+							__m128 v0 = _mm_loadu_ps(src);
+							__m128 v1 = _mm_loadu_ps(src + 4);
+							__m128 gt0 = _mm_cmpgt_ps(v0, max0);
+							__m128 gt1 = _mm_cmpgt_ps(v1, max1);
+							arg0 = _mm_or_ps(_mm_and_ps(gt0, pos), _mm_andnot_ps(gt0, arg0));
+							arg1 = _mm_or_ps(_mm_and_ps(gt1, pos), _mm_andnot_ps(gt1, arg1));
+							max0 = _mm_max_ps(max0, v0);
+							max1 = _mm_max_ps(max1, v1);
+						}
+					}
+
+					float args[TENSOR_BLOCK_CHNS];
+					_mm_storeu_ps(ouPtr + (r * ouCols + c) * TENSOR_BLOCK_CHNS, max0);
+					_mm_storeu_ps(ouPtr + (r * ouCols + c) * TENSOR_BLOCK_CHNS + 4, max1);
+					_mm_storeu_ps(args, arg0);
+					_mm_storeu_ps(args + 4, arg1);
+					for (int k = 0; k < TENSOR_BLOCK_CHNS; ++k)
+						idxPtr[(r * ouCols + c) * TENSOR_BLOCK_CHNS + k] = (T)args[k];
+				}
+			}
+		}
+	}
+
+	// upFeatMaps are the inputs of fprop, they are overwritten by the delta
+	template <typename T>
+	static void maxUnpoolImage(Tensor &upFeatMaps, const Tensor &ouFeatMaps, const T *index, 
+							   const int i, const WeightGeometry &wparams, 
+							   const StrideGeometry &strides, const PadGeometry &padding)
+	{
+		bool isBlocked = upFeatMaps.getLayout() == TENSOR_NCHW8C;
+		int numMaps = isBlocked ? upFeatMaps.getChnBlocks() : upFeatMaps.getChns();
+		int numLanes = isBlocked ? TENSOR_BLOCK_CHNS : 1;
+		int inRows = upFeatMaps.getRows();
+		int inCols = upFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+
+		// window offset -> input offset
+		vector<int> steps(wparams.height * wparams.width);
+		for (int k = 0; k < steps.size(); ++k)
+			steps[k] = ((k / wparams.width) * inCols + k % wparams.width) * numLanes;
+
+		int r0, c0;
+		for (int m = 0; m < numMaps; ++m) {
+			float *upPtr = upFeatMaps.ptr(i, m);
+			memset(upPtr, 0, inRows * inCols * numLanes * sizeof(float));
+
+			const float *ouPtr = ouFeatMaps.ptr(i, m);
+			const T *idxPtr = index + m * ouFeatMaps.getChnStep();
+			for (int r = 0; r < ouRows; ++r) {
+				r0 = r * strides.stepRow - padding.top;
+				if (r0 + wparams.height <= 0 || r0 >= inRows)
+					continue;
+				for (int c = 0; c < ouCols; ++c) {
+					c0 = c * strides.stepCol - padding.left;
+					if (c0 + wparams.width <= 0 || c0 >= inCols)
+						continue;
+
+					// windows hanging over the border start outside the map
+					float *dst = upPtr + (r0 * inCols + c0) * numLanes;
+					int pos = (r * ouCols + c) * numLanes;
+					for (int k = 0; k < numLanes; ++k)
+						dst[steps[idxPtr[pos + k]] + k] += ouPtr[pos + k];
+				}
+			}
+		}
+	}
+
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//					compiled kernels for 2 x 2 / 3 x 3, stride 2
+	//
+	//	Outputs whose windows lie inside the map take unrolled loops with no
+	//	clipping, 4 adjacent outputs per SSE op; the rest go through the
+	//	clipped loop. IS_MAX pooling keeps the argmax as maxPoolImage does,
+	//	otherwise the window sums are written.
+	//
+	// ----------------------------------------------------------------------------
+
+	// 4 input columns SW apart
+	template <int SW>
+	static inline __m128 loadCols(const float *src);
+
+	template <>
+	inline __m128 loadCols<1>(const float *src)
+	{
+		return _mm_loadu_ps(src);
+	}
+
+	template <>
+	inline __m128 loadCols<2>(const float *src)
+	{
+		return _mm_shuffle_ps(_mm_loadu_ps(src), _mm_loadu_ps(src + 4), _MM_SHUFFLE(2, 0, 2, 0));
+	}
+
+	// first output of [begin, numOuts) whose window [o * step - pad, + win)
+	// starts inside the map, and the end of the run that also ends inside
+	static inline void interiorRange(int &begin, int &end, const int numOuts, const int inDims,
+									 const int win, const int step, const int pad)
+	{
+		begin = min(numOuts, (pad + step - 1) / step);
+		end = inDims + pad - win < 0 ? 0 : min(numOuts, (inDims + pad - win) / step + 1);
+		end = max(begin, end);
+	}
+
+	template <typename T, bool IS_MAX>
+	static inline void poolClipped(float *ouPtr, T *idxPtr, const float *inPtr,
+								   const int inRows, const int inCols, const int r0, const int c0,
+								   const int winHeight, const int winWidth)
+	{
+		int r1 = max(r0, 0), r2 = min(r0 + winHeight, inRows);
+		int c1 = max(c0, 0), c2 = min(c0 + winWidth, inCols);
+		float value = IS_MAX ? -std::numeric_limits<float>::infinity() : 0;
+		int maxIndex = (r1 - r0) * winWidth + (c1 - c0);
+		for (int y = r1; y < r2; ++y) {
+			for (int x = c1; x < c2; ++x) {
+				if (!IS_MAX)
+					value += inPtr[y * inCols + x];
+				else if (value < inPtr[y * inCols + x]) {
+					value = inPtr[y * inCols + x];
+					maxIndex = (y - r0) * winWidth + (x - c0);
+				}
+			}
+		}
+		*ouPtr = value;
+		if (IS_MAX)
+			*idxPtr = (T)maxIndex;
+	}
+
+	template <typename T, bool IS_MAX, int KH, int KW, int SH, int SW>
+	static void poolMap(float *ouPtr, T *idxPtr, const float *inPtr,
+						const int inRows, const int inCols, const int ouRows, const int ouCols,
+						const PadGeometry &padding)
+	{
+		int rBegin, rEnd, cBegin, cEnd;
+		interiorRange(rBegin, rEnd, ouRows, inRows, KH, SH, padding.top);
+		interiorRange(cBegin, cEnd, ouCols, inCols, KW, SW, padding.left);
+
+		// the 4-wide loads of the last taps read (4 * SW - 1) columns on
+		int cVecEnd = cBegin;
+		while (cVecEnd + 4 <= cEnd && (cVecEnd + 4) * SW - padding.left + KW - 1 < inCols)
+			cVecEnd += 4;
+
+		for (int r = 0; r < ouRows; ++r) {
+			int r0 = r * SH - padding.top;
+			bool isInside = r >= rBegin && r < rEnd;
+			for (int c = 0; c < ouCols; ++c) {
+				int c0 = c * SW - padding.left;
+				int o = r * ouCols + c;
+				if (!isInside || c < cBegin || c >= cEnd) {
+					poolClipped<T, IS_MAX>(ouPtr + o, IS_MAX ? idxPtr + o : NULL, inPtr, 
+										   inRows, inCols, r0, c0, KH, KW);
+				}
+				else if (c < cVecEnd) {
+					__m128 acc = _mm_set1_ps(IS_MAX ? -std::numeric_limits<float>::infinity() : 0);
+					__m128 arg = _mm_setzero_ps();
+					for (int kr = 0; kr < KH; ++kr) {
+						const float *src = inPtr + (r0 + kr) * inCols + c0;
+						for (int kc = 0; kc < KW; ++kc) {
+							__m128 v = loadCols<SW>(src + kc);
+							if (IS_MAX) {
+								__m128 gt = _mm_cmpgt_ps(v, acc);
+								__m128 pos = _mm_set1_ps((float)(kr * KW + kc));
+								arg = _mm_or_ps(_mm_and_ps(gt, pos), _mm_andnot_ps(gt, arg));
+								acc = _mm_max_ps(acc, v);
+							}
+							else
+								acc = _mm_add_ps(acc, v);
+						}
+					}
+					_mm_storeu_ps(ouPtr + o, acc);
+					if (IS_MAX) {
+						float args[4];
+						_mm_storeu_ps(args, arg);
+						for (int k = 0; k < 4; ++k)
+							idxPtr[o + k] = (T)args[k];
+					}
+					c += 3;
+				}
+				else {
+					const float *src = inPtr + r0 * inCols + c0;
+					float value = IS_MAX ? -std::numeric_limits<float>::infinity() : 0;
+					int maxIndex = 0;
+					for (int kr = 0; kr < KH; ++kr) {
+						for (int kc = 0; kc < KW; ++kc) {
+							if (!IS_MAX)
+								value += src[kr * inCols + kc];
+							else if (value < src[kr * inCols + kc]) {
+								value = src[kr * inCols + kc];
+								maxIndex = kr * KW + kc;
+							}
+						}
+					}
+					ouPtr[o] = value;
+					if (IS_MAX)
+						idxPtr[o] = (T)maxIndex;
+				}
+			}
+		}
+	}
+
+	// planar maps of image i, index is NULL for sums
+	template <typename T, bool IS_MAX, int KH, int KW, int SH, int SW>
+	static void poolImage(Tensor &ouFeatMaps, T *index, const Tensor &inFeatMaps, const int i,
+						  const PadGeometry &padding)
+	{
+		for (int ch = 0; ch < inFeatMaps.getChns(); ++ch) {
+			poolMap<T, IS_MAX, KH, KW, SH, SW>(ouFeatMaps.ptr(i, ch), 
+				IS_MAX ? index + ch * ouFeatMaps.getChnStep() : NULL, inFeatMaps.ptr(i, ch),
+				inFeatMaps.getRows(), inFeatMaps.getCols(), 
+				ouFeatMaps.getRows(), ouFeatMaps.getCols(), padding);
+		}
+	}
+
+	// window sums back to the planar maps of image i
+	template <int KH, int KW, int SH, int SW>
+	static void sumUnpoolImage(Tensor &upFeatMaps, const Tensor &ouFeatMaps, const int i,
+							   const PadGeometry &padding)
+	{
+		int inRows = upFeatMaps.getRows();
+		int inCols = upFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+		int rBegin, rEnd, cBegin, cEnd;
+		interiorRange(rBegin, rEnd, ouRows, inRows, KH, SH, padding.top);
+		interiorRange(cBegin, cEnd, ouCols, inCols, KW, SW, padding.left);
+
+		for (int ch = 0; ch < upFeatMaps.getChns(); ++ch) {
+			float *upPtr = upFeatMaps.ptr(i, ch);
+			const float *ouPtr = ouFeatMaps.ptr(i, ch);
+			memset(upPtr, 0, inRows * inCols * sizeof(float));
+			for (int r = 0; r < ouRows; ++r) {
+				int r0 = r * SH - padding.top;
+				bool isInside = r >= rBegin && r < rEnd;
+				for (int c = 0; c < ouCols; ++c) {
+					int c0 = c * SW - padding.left;
+					float delta = ouPtr[r * ouCols + c];
+					if (isInside && c >= cBegin && c < cEnd) {
+						float *dst = upPtr + r0 * inCols + c0;
+						for (int kr = 0; kr < KH; ++kr) {
+							for (int kc = 0; kc < KW; ++kc)
+								dst[kr * inCols + kc] += delta;
+						}
+						continue;
+					}
+
+					for (int y = max(r0, 0); y < min(r0 + KH, inRows); ++y) {
+						for (int x = max(c0, 0); x < min(c0 + KW, inCols); ++x)
+							upPtr[y * inCols + x] += delta;
+					}
+				}
+			}
+		}
+	}
+
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//					  separable pooling for large windows
+	//
+	//	A row pass pools every input row over the window width, a column
+	//	pass pools those results over the window height, so each output
+	//	costs O(1) whatever the window size. Maxima use van Herk / Gil-Werman:
+	//	the padded sequence is cut into blocks of the window length, a window
+	//	is the suffix max of one block and the prefix max of the next. Sums
+	//	use prefix sums, kept in double, and bprop of sums spreads each delta
+	//	through a 2D difference table.
+	//
+	// ----------------------------------------------------------------------------
+
+	// max of src[o * step, o * step + win) for o < numOuts, src holds len
+	// values; ties go to the earlier element as in maxPoolImage
+	static void runningMax(float *dst, int *arg, const float *src, const int len,
+						   const int win, const int step, const int numOuts,
+						   float *prefix, int *prefixArg, float *suffix, int *suffixArg)
+	{
+		for (int j = 0; j < len; ++j) {
+			bool isStart = j % win == 0;
+			if (isStart || src[j] > prefix[j - 1]) {
+				prefix[j] = src[j];
+				prefixArg[j] = j;
+			}
+			else {
+				prefix[j] = prefix[j - 1];
+				prefixArg[j] = prefixArg[j - 1];
+			}
+		}
+		for (int j = len - 1; j >= 0; --j) {
+			bool isEnd = j == len - 1 || (j + 1) % win == 0;
+			if (isEnd || src[j] >= suffix[j + 1]) {
+				suffix[j] = src[j];
+				suffixArg[j] = j;
+			}
+			else {
+				suffix[j] = suffix[j + 1];
+				suffixArg[j] = suffixArg[j + 1];
+			}
+		}
+
+		for (int o = 0; o < numOuts; ++o) {
+			int a = o * step;
+			int b = a + win - 1;
+			if (a % win == 0 || suffix[a] >= prefix[b]) {
+				dst[o] = suffix[a];
+				arg[o] = suffixArg[a];
+			}
+			else {
+				dst[o] = prefix[b];
+				arg[o] = prefixArg[b];
+			}
+		}
+	}
+
+	template <typename T>
+	static void slidingMaxImage(Tensor &ouFeatMaps, T *index, const Tensor &inFeatMaps, const int i,
+								const WeightGeometry &wparams, const StrideGeometry &strides,
+								const PadGeometry &padding)
+	{
+		int inRows = inFeatMaps.getRows();
+		int inCols = inFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+		int rowLen = (ouCols - 1) * strides.stepCol + wparams.width;
+		int colLen = (ouRows - 1) * strides.stepRow + wparams.height;
+		int seqLen = max(rowLen, colLen);
+		const float minValue = -std::numeric_limits<float>::infinity();
+
+		// padded sequence, block scans, and the row pass results
+		vector<float> seq(seqLen, minValue), prefix(seqLen), suffix(seqLen + 1);
+		vector<int> prefixArg(seqLen), suffixArg(seqLen + 1);
+		vector<float> rowMax(inRows * ouCols), colMax(ouRows);
+		vector<int> rowArg(inRows * ouCols), colArg(ouRows);
+
+		for (int ch = 0; ch < inFeatMaps.getChns(); ++ch) {
+			const float *inPtr = inFeatMaps.ptr(i, ch);
+			float *ouPtr = ouFeatMaps.ptr(i, ch);
+			T *idxPtr = index + ch * ouFeatMaps.getChnStep();
+
+			for (int y = 0; y < inRows; ++y) {
+				for (int x = 0; x < rowLen; ++x) {
+					int xi = x - padding.left;
+					seq[x] = xi >= 0 && xi < inCols ? inPtr[y * inCols + xi] : minValue;
+				}
+				runningMax(&rowMax[y * ouCols], &rowArg[y * ouCols], &seq[0], rowLen,
+						   wparams.width, strides.stepCol, ouCols,
+						   &prefix[0], &prefixArg[0], &suffix[0], &suffixArg[0]);
+
+				// a padding column only wins when the whole row of the window
+				// is -inf, the generic loop then keeps its first column
+				for (int c = 0; c < ouCols; ++c) {
+					int &xp = rowArg[y * ouCols + c];
+					if (xp < padding.left || xp >= padding.left + inCols)
+						xp = max(c * strides.stepCol, padding.left);
+				}
+			}
+
+			for (int c = 0; c < ouCols; ++c) {
+				for (int y = 0; y < colLen; ++y) {
+					int yi = y - padding.top;
+					seq[y] = yi >= 0 && yi < inRows ? rowMax[yi * ouCols + c] : minValue;
+				}
+				runningMax(&colMax[0], &colArg[0], &seq[0], colLen,
+						   wparams.height, strides.stepRow, ouRows,
+						   &prefix[0], &prefixArg[0], &suffix[0], &suffixArg[0]);
+
+				for (int r = 0; r < ouRows; ++r) {
+					int yp = colArg[r];
+					if (yp < padding.top || yp >= padding.top + inRows)
+						yp = max(r * strides.stepRow, padding.top);
+					int xp = yp - padding.top < inRows ? rowArg[(yp - padding.top) * ouCols + c] : 0;
+
+					ouPtr[r * ouCols + c] = colMax[r];
+					idxPtr[r * ouCols + c] = (T)((yp - r * strides.stepRow) * wparams.width +
+												 (xp - c * strides.stepCol));
+				}
+			}
+		}
+	}
+
+	// windows clipped to the map, as the generic loop sums them
+	static void slidingSumImage(Tensor &ouFeatMaps, const Tensor &inFeatMaps, const int i,
+								const WeightGeometry &wparams, const StrideGeometry &strides,
+								const PadGeometry &padding)
+	{
+		int inRows = inFeatMaps.getRows();
+		int inCols = inFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+
+		vector<double> rowPrefix(inCols + 1), colPrefix(inRows + 1);
+		vector<double> rowSum(inRows * ouCols);
+
+		for (int ch = 0; ch < inFeatMaps.getChns(); ++ch) {
+			const float *inPtr = inFeatMaps.ptr(i, ch);
+			float *ouPtr = ouFeatMaps.ptr(i, ch);
+
+			for (int y = 0; y < inRows; ++y) {
+				rowPrefix[0] = 0;
+				for (int x = 0; x < inCols; ++x)
+					rowPrefix[x + 1] = rowPrefix[x] + inPtr[y * inCols + x];
+				for (int c = 0; c < ouCols; ++c) {
+					int c0 = c * strides.stepCol - padding.left;
+					int c1 = min(max(c0, 0), inCols);
+					int c2 = max(min(c0 + wparams.width, inCols), c1);
+					rowSum[y * ouCols + c] = rowPrefix[c2] - rowPrefix[c1];
+				}
+			}
+
+			for (int c = 0; c < ouCols; ++c) {
+				colPrefix[0] = 0;
+				for (int y = 0; y < inRows; ++y)
+					colPrefix[y + 1] = colPrefix[y] + rowSum[y * ouCols + c];
+				for (int r = 0; r < ouRows; ++r) {
+					int r0 = r * strides.stepRow - padding.top;
+					int r1 = min(max(r0, 0), inRows);
+					int r2 = max(min(r0 + wparams.height, inRows), r1);
+					ouPtr[r * ouCols + c] = (float)(colPrefix[r2] - colPrefix[r1]);
+				}
+			}
+		}
+	}
+
+	// every delta is added to the corners of its window in a difference
+	// table, whose 2D prefix sums are the input deltas
+	static void slidingSumUnpoolImage(Tensor &upFeatMaps, const Tensor &ouFeatMaps, const int i,
+									  const WeightGeometry &wparams, const StrideGeometry &strides,
+									  const PadGeometry &padding)
+	{
+		int inRows = upFeatMaps.getRows();
+		int inCols = upFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+		int ldiff = inCols + 1;
+		vector<double> diff((inRows + 1) * ldiff);
+
+		for (int ch = 0; ch < upFeatMaps.getChns(); ++ch) {
+			float *upPtr = upFeatMaps.ptr(i, ch);
+			const float *ouPtr = ouFeatMaps.ptr(i, ch);
+			std::fill(diff.begin(), diff.end(), 0.0);
+
+			for (int r = 0; r < ouRows; ++r) {
+				int r0 = r * strides.stepRow - padding.top;
+				int r1 = max(r0, 0), r2 = min(r0 + wparams.height, inRows);
+				if (r1 >= r2)
+					continue;
+				for (int c = 0; c < ouCols; ++c) {
+					int c0 = c * strides.stepCol - padding.left;
+					int c1 = max(c0, 0), c2 = min(c0 + wparams.width, inCols);
+					if (c1 >= c2)
+						continue;
+					double delta = ouPtr[r * ouCols + c];
+					diff[r1 * ldiff + c1] += delta;
+					diff[r1 * ldiff + c2] -= delta;
+					diff[r2 * ldiff + c1] -= delta;
+					diff[r2 * ldiff + c2] += delta;
+				}
+			}
+
+			// rows then columns
+			for (int y = 0; y < inRows; ++y) {
+				for (int x = 1; x < inCols; ++x)
+					diff[y * ldiff + x] += diff[y * ldiff + x - 1];
+			}
+			for (int y = 1; y < inRows; ++y) {
+				for (int x = 0; x < inCols; ++x)
+					diff[y * ldiff + x] += diff[(y - 1) * ldiff + x];
+			}
+			for (int y = 0; y < inRows; ++y) {
+				for (int x = 0; x < inCols; ++x)
+					upPtr[y * inCols + x] = (float)diff[y * ldiff + x];
+			}
+		}
+	}
 }
 
 
@@ -153,7 +625,8 @@ namespace convnet
 	using namespace std;
 	using namespace cv;
 
-	PoolLayer::PoolLayer(Mat4D &inFeatMaps, const int numThreads) 
+	PoolLayer::PoolLayer(Tensor &inFeatMaps, const int numThreads) 
+		: poolOpt(NULL)
 	{
 		this->inFeatMaps = inFeatMaps;
 		this->numThreads = numThreads;
@@ -161,10 +634,11 @@ namespace convnet
 
 	PoolLayer::~PoolLayer()
 	{
-		inFeatMaps.clear();
-		ouFeatMaps.clear();
+		inFeatMaps.release();
+		ouFeatMaps.release();
+		maxIndices.release();
 		if (poolOpt != NULL) {
-			free(poolOpt);
+			delete poolOpt;
 			poolOpt = NULL;
 		}
 	}
@@ -173,8 +647,10 @@ namespace convnet
 	void PoolLayer::init()
 	{
 		// set pooling operator
-		if (!_strcmpi(poolMethod.c_str(), "Max"))
-			poolOpt = new MaxOperator;
+		// max pooling keeps its argmax instead of going through an operator
+		isMaxPool = !_strcmpi(poolMethod.c_str(), "Max");
+		if (isMaxPool)
+			poolOpt = NULL;
 		else if (!_strcmpi(poolMethod.c_str(), "Avg"))
 			poolOpt = new AvgOperator;
 		else
@@ -183,32 +659,68 @@ namespace convnet
 
 		// allocate space
 		int numImages = inFeatMaps.size();
-		int chns = inFeatMaps[0].size();
-		int rows = inFeatMaps[0][0].rows;
-		int cols = inFeatMaps[0][0].cols;
+		int chns = inFeatMaps.getChns();
+		int rows = inFeatMaps.getRows();
+		int cols = inFeatMaps.getCols();
 		int ouRows = (rows + padding.bottom + padding.top - wparams.height) / strides.stepRow + 1;
 		int ouCols = (cols + padding.left + padding.right - wparams.width) / strides.stepCol + 1;
 		
-		ouFeatMaps.resize(numImages);
-		for (int i = 0; i < numImages; ++i) {
-			ouFeatMaps[i].resize(chns);
-			for (int ch = 0; ch < chns; ++ch) {
-				ouFeatMaps[i][ch] = Mat::zeros(ouRows, ouCols, CV_32FC1);
-			}
+		// blocked maps stay blocked for the next convolution
+		if (inFeatMaps.getLayout() == TENSOR_NCHW8C)
+			ouFeatMaps.create(numImages, chns, ouRows, ouCols, TENSOR_NCHW8C);
+		else
+			ouFeatMaps.create(numImages, chns, ouRows, ouCols);
+
+		// offsets of the maxima inside their windows, one per output value;
+		// a byte covers windows up to 16 x 16
+		if (isMaxPool) {
+			int indexType = wparams.height * wparams.width <= 256 ? CV_8UC1 : CV_32SC1;
+			maxIndices = Mat::zeros(numImages, ouFeatMaps.getImageStep(), indexType);
+		}
+		else
+			maxIndices.release();
+
+		// compiled kernels for the usual geometries of planar maps, 
+		// separable passes for large or overlapping windows
+		poolKernel = POOL_GENERIC;
+		bool isPlanar = inFeatMaps.getLayout() != TENSOR_NCHW8C;
+		if (isPlanar && strides.stepRow == 2 && strides.stepCol == 2) {
+			if (wparams.height == 2 && wparams.width == 2)
+				poolKernel = POOL_2X2_S2;
+			else if (wparams.height == 3 && wparams.width == 3)
+				poolKernel = POOL_3X3_S2;
+		}
+		if (isPlanar && poolKernel == POOL_GENERIC) {
+			if (max(wparams.height, wparams.width) >= POOL_SLIDING_MIN_WINDOW ||
+				(strides.stepRow < wparams.height && strides.stepCol < wparams.width))
+				poolKernel = POOL_SLIDING;
 		}
 	}
 
 	void PoolLayer::fprop()
 	{
 		int numImages = inFeatMaps.size();
+		bool isBlocked = inFeatMaps.getLayout() == TENSOR_NCHW8C;
 
 		#ifdef _OPENMP
 		#pragma omp parallel for
 		#endif
 		
 		for (int i = 0; i < numImages; ++i) {
-			fpropOne(ouFeatMaps[i], inFeatMaps[i], 
-					 wparams, strides, padding, poolOpt);
+			if (isMaxPool)
+				fpropMax(i);
+			else if (poolKernel == POOL_2X2_S2)
+				poolImage<uchar, false, 2, 2, 2, 2>(ouFeatMaps, NULL, inFeatMaps, i, padding);
+			else if (poolKernel == POOL_3X3_S2)
+				poolImage<uchar, false, 3, 3, 2, 2>(ouFeatMaps, NULL, inFeatMaps, i, padding);
+			else if (poolKernel == POOL_SLIDING)
+				slidingSumImage(ouFeatMaps, inFeatMaps, i, wparams, strides, padding);
+			else if (isBlocked)
+				fpropBlocked(ouFeatMaps, inFeatMaps, i);
+			else {
+				fpropOne(ouFeatMaps[i], inFeatMaps[i], 
+						 wparams, strides, padding, poolOpt);
+			}
 		}
 
 		if (isScaledMaps) {
@@ -219,22 +731,41 @@ namespace convnet
 			#pragma omp parallel for
 			#endif
 
-			for (int i = 0; i < numImages; ++i)
-				scaleMaps(ouFeatMaps[i], pscale);
+			for (int i = 0; i < numImages; ++i) {
+				if (isBlocked) {
+					Mat view = ouFeatMaps.imageView(i);
+					view /= pscale;
+				}
+				else
+					scaleMaps(ouFeatMaps[i], pscale);
+			}
 		}
 	}
 
 	void PoolLayer::bprop()
 	{
 		int numImages = inFeatMaps.size();
+		bool isBlocked = inFeatMaps.getLayout() == TENSOR_NCHW8C;
 		
 		#ifdef _OPENMP
 		#pragma omp parallel for
 		#endif
 
 		for (int i = 0; i < numImages; ++i) {
-			bpropOne(inFeatMaps[i], inFeatMaps[i], ouFeatMaps[i], 
-					 wparams, strides, padding, poolOpt);
+			if (isMaxPool)
+				bpropMax(i);
+			else if (poolKernel == POOL_2X2_S2)
+				sumUnpoolImage<2, 2, 2, 2>(inFeatMaps, ouFeatMaps, i, padding);
+			else if (poolKernel == POOL_3X3_S2)
+				sumUnpoolImage<3, 3, 2, 2>(inFeatMaps, ouFeatMaps, i, padding);
+			else if (poolKernel == POOL_SLIDING)
+				slidingSumUnpoolImage(inFeatMaps, ouFeatMaps, i, wparams, strides, padding);
+			else if (isBlocked)
+				bpropBlocked(inFeatMaps, ouFeatMaps, i);
+			else {
+				bpropOne(inFeatMaps[i], inFeatMaps[i], ouFeatMaps[i], 
+						 wparams, strides, padding, poolOpt);
+			}
 		}
 
 		if (isScaledMaps) {
@@ -245,8 +776,14 @@ namespace convnet
 			#pragma omp parallel for
 			#endif
 			
-			for (int i = 0; i < numImages; ++i) 
-				scaleMaps(inFeatMaps[i], pscale);
+			for (int i = 0; i < numImages; ++i) {
+				if (isBlocked) {
+					Mat view = inFeatMaps.imageView(i);
+					view /= pscale;
+				}
+				else
+					scaleMaps(inFeatMaps[i], pscale);
+			}
 		}
 	}
 
@@ -343,4 +880,103 @@ namespace convnet
 		for (int ch = 0; ch < inoufeatMaps.size(); ch++)
 			inoufeatMaps[ch] /= area;
 	}
-}
\ No newline at end of file
+
+
+	void PoolLayer::fpropMax(const int i)
+	{
+		if (poolKernel == POOL_2X2_S2)
+			poolImage<uchar, true, 2, 2, 2, 2>(ouFeatMaps, maxIndices.ptr<uchar>(i), inFeatMaps, i, padding);
+		else if (poolKernel == POOL_3X3_S2)
+			poolImage<uchar, true, 3, 3, 2, 2>(ouFeatMaps, maxIndices.ptr<uchar>(i), inFeatMaps, i, padding);
+		else if (poolKernel == POOL_SLIDING && maxIndices.type() == CV_8UC1)
+			slidingMaxImage(ouFeatMaps, maxIndices.ptr<uchar>(i), inFeatMaps, i, wparams, strides, padding);
+		else if (poolKernel == POOL_SLIDING)
+			slidingMaxImage(ouFeatMaps, maxIndices.ptr<int>(i), inFeatMaps, i, wparams, strides, padding);
+		else if (maxIndices.type() == CV_8UC1)
+			maxPoolImage(ouFeatMaps, maxIndices.ptr<uchar>(i), inFeatMaps, i, wparams, strides, padding);
+		else
+			maxPoolImage(ouFeatMaps, maxIndices.ptr<int>(i), inFeatMaps, i, wparams, strides, padding);
+	}
+
+	void PoolLayer::bpropMax(const int i)
+	{
+		if (maxIndices.type() == CV_8UC1)
+			maxUnpoolImage(inFeatMaps, ouFeatMaps, maxIndices.ptr<uchar>(i), i, wparams, strides, padding);
+		else
+			maxUnpoolImage(inFeatMaps, ouFeatMaps, maxIndices.ptr<int>(i), i, wparams, strides, padding);
+	}
+
+	// average pooling, the scaling is left to scaleMaps
+	void PoolLayer::fpropBlocked(Tensor &ouFeatMaps, const Tensor &inFeatMaps, const int i)
+	{
+		const int B = TENSOR_BLOCK_CHNS;
+		int inRows = inFeatMaps.getRows();
+		int inCols = inFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+
+		int r1, r2, c1, c2;
+		for (int cb = 0; cb < inFeatMaps.getChnBlocks(); ++cb) {
+			const float *inPtr = inFeatMaps.ptr(i, cb);
+			float *ouPtr = ouFeatMaps.ptr(i, cb);
+			for (int r = 0; r < ouRows; ++r) {
+				r1 = r * strides.stepRow - padding.top;
+				r2 = min(r1 + wparams.height, inRows);
+				r1 = max(r1, 0);
+				for (int c = 0; c < ouCols; ++c) {
+					c1 = c * strides.stepCol - padding.left;
+					c2 = min(c1 + wparams.width, inCols);
+					c1 = max(c1, 0);
+
+					__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+					for (int y = r1; y < r2; ++y) {
+						for (int x = c1; x < c2; ++x) {
+							const float *src = inPtr + (y * inCols + x) * B;
+							acc0 = _mm_add_ps(acc0, _mm_loadu_ps(src));
+							acc1 = _mm_add_ps(acc1, _mm_loadu_ps(src + 4));
+						}
+					}
+					_mm_storeu_ps(ouPtr + (r * ouCols + c) * B, acc0);
+					_mm_storeu_ps(ouPtr + (r * ouCols + c) * B + 4, acc1);
+				}
+			}
+		}
+	}
+
+	// the inputs are not needed, the delta is summed straight into them
+	void PoolLayer::bpropBlocked(Tensor &upFeatMaps, const Tensor &ouFeatMaps, const int i)
+	{
+		const int B = TENSOR_BLOCK_CHNS;
+		int inRows = upFeatMaps.getRows();
+		int inCols = upFeatMaps.getCols();
+		int ouRows = ouFeatMaps.getRows();
+		int ouCols = ouFeatMaps.getCols();
+		memset(upFeatMaps.ptr(i), 0, upFeatMaps.getImageStep() * sizeof(float));
+
+		int r1, r2, c1, c2;
+		for (int cb = 0; cb < upFeatMaps.getChnBlocks(); ++cb) {
+			float *upPtr = upFeatMaps.ptr(i, cb);
+			const float *ouPtr = ouFeatMaps.ptr(i, cb);
+			for (int r = 0; r < ouRows; ++r) {
+				r1 = r * strides.stepRow - padding.top;
+				r2 = min(r1 + wparams.height, inRows);
+				r1 = max(r1, 0);
+				for (int c = 0; c < ouCols; ++c) {
+					c1 = c * strides.stepCol - padding.left;
+					c2 = min(c1 + wparams.width, inCols);
+					c1 = max(c1, 0);
+
+					__m128 delta0 = _mm_loadu_ps(ouPtr + (r * ouCols + c) * B);
+					__m128 delta1 = _mm_loadu_ps(ouPtr + (r * ouCols + c) * B + 4);
+					for (int y = r1; y < r2; ++y) {
+						for (int x = c1; x < c2; ++x) {
+							float *dst = upPtr + (y * inCols + x) * B;
+							_mm_storeu_ps(dst, _mm_add_ps(_mm_loadu_ps(dst), delta0));
+							_mm_storeu_ps(dst + 4, _mm_add_ps(_mm_loadu_ps(dst + 4), delta1));
+						}
+					}
+				}
+			}
+		}
+	}
+}
@@ -3,6 +3,7 @@
 #pragma once
 
 #include "../Utility/types.h"
+#include "../Utility/tensor.h"
 #include "../utility/param.h"
 #include "layer.h"
 #include <cassert>   // assert 
@@ -31,16 +32,30 @@ namespace convnet
 
 
 
+	// pooling geometries of planar maps with their own compiled kernels,
+	// POOL_SLIDING pools large (at least POOL_SLIDING_MIN_WINDOW on a side)
+	// or overlapping windows in separable passes whose cost does not grow
+	// with the window; the others go through the generic loops
+	enum PoolKernel
+	{
+		POOL_GENERIC = 0,
+		POOL_2X2_S2 = 1,
+		POOL_3X3_S2 = 2,
+		POOL_SLIDING = 3
+	};
+
+	enum { POOL_SLIDING_MIN_WINDOW = 5 };
+
 	class PoolLayer : public Layer
 	{
 	public:
-		PoolLayer() {}
+		PoolLayer() : poolOpt(NULL) {}
 
-		PoolLayer(Mat4D &inFeatMaps, const int numThreads = 1);
+		PoolLayer(Tensor &inFeatMaps, const int numThreads = 1);
 
 		~PoolLayer();
 
-		inline void setNFCInFeatMaps(Mat4D &inFeatMaps);
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
 
 		inline void setWeightGeometry(const int width, const int height);
 
@@ -54,7 +69,9 @@ namespace convnet
 
 		inline void setNumThreads(const int numThreads = 1);
 
-		inline Mat4D &getNFCOuFeatMaps();
+		inline Tensor &getNFCOuFeatMaps();
+
+		inline void getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps);
 
 		void init();
 
@@ -80,22 +97,36 @@ namespace convnet
 
 		void scaleMaps(Mat3D &upFeatMaps, const float area);
 
+		// image i, either layout
+		void fpropMax(const int i);
+
+		void bpropMax(const int i);
+
+		// image i of TENSOR_NCHW8C maps, one vector op covers the 8 
+		// channels of a block
+		void fpropBlocked(Tensor &ouFeatMaps, const Tensor &inFeatMaps, const int i);
+
+		void bpropBlocked(Tensor &upFeatMaps, const Tensor &ouFeatMaps, const int i);
+
 
 	private:
 		// feature maps
-		Mat4D inFeatMaps;
-		Mat4D ouFeatMaps;
+		Tensor inFeatMaps;
+		Tensor ouFeatMaps;
 		WeightGeometry wparams;
 		StrideGeometry strides;
 		PadGeometry padding;
 		OperatorFunction *poolOpt;
+		Mat maxIndices; // [numImages] x [output image], uchar or int
+		PoolKernel poolKernel;
 
 		string poolMethod;
+		bool isMaxPool;
 		bool isScaledMaps;
 		int numThreads;
 	};
 
-	inline void PoolLayer::setNFCInFeatMaps(Mat4D &inFeatMaps)
+	inline void PoolLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
 	{
 		this->inFeatMaps = inFeatMaps;
 	}
@@ -131,10 +162,16 @@ namespace convnet
 		this->numThreads = numThreads;
 	}
 
-	inline Mat4D &PoolLayer::getNFCOuFeatMaps()
+	inline Tensor &PoolLayer::getNFCOuFeatMaps()
 	{
 		return this->ouFeatMaps;
 	}
+
+	inline void PoolLayer::getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
 }
 
 
@@ -0,0 +1,50 @@
+/*
+*/
+
+#include "../Utility/check.h"
+#include "reorderLayer.h"
+
+namespace convnet
+{
+	ReorderLayer::ReorderLayer(Tensor &inFeatMaps, const int numThreads)
+	{
+		this->inFeatMaps = inFeatMaps;
+		this->numThreads = numThreads;
+		this->layout = TENSOR_NCHW;
+		this->isDzDx = true;
+	}
+
+	ReorderLayer::~ReorderLayer()
+	{
+		inFeatMaps.release();
+		ouFeatMaps.release();
+	}
+
+	void ReorderLayer::init()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+
+		ouFeatMaps.create(inFeatMaps.size(), inFeatMaps.getChns(), 
+						  inFeatMaps.getRows(), inFeatMaps.getCols(), layout);
+	}
+
+	void ReorderLayer::fprop()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+		NONFC_OUTPUT_INIT(ouFeatMaps);
+
+		inFeatMaps.reorderTo(ouFeatMaps);
+	}
+
+	void ReorderLayer::bprop()
+	{
+		NONFC_INPUT_INIT(inFeatMaps);
+		NONFC_OUTPUT_INIT(ouFeatMaps);
+
+		if (!isDzDx)
+			return;
+
+		// the delta goes back in the layout of the layer before
+		ouFeatMaps.reorderTo(inFeatMaps);
+	}
+}
@@ -0,0 +1,88 @@
+#ifndef _CONVNET_CNN_REORDERLAYER_H_
+#define _CONVNET_CNN_REORDERLAYER_H_
+#pragma once
+
+#include "../Utility/types.h"
+#include "../Utility/tensor.h"
+#include "layer.h"
+#include <opencv2/core/core.hpp>
+
+namespace convnet
+{
+	// --------------------------------------------------------------
+	//
+	// @brief copies the input maps into another TensorLayout, e.g.
+	//		  into TENSOR_NCHW8C in front of the first convolution and
+	//		  back to TENSOR_NCHW before layers that read planes
+	//
+	// --------------------------------------------------------------
+	class ReorderLayer : public Layer
+	{
+	public:
+		ReorderLayer() : layout(TENSOR_NCHW), isDzDx(true) {}
+
+		ReorderLayer(Tensor &inFeatMaps, const int numThreads = 1);
+
+		virtual ~ReorderLayer();
+
+		inline void setNFCInFeatMaps(Tensor &inFeatMaps);
+
+		inline void setLayout(const TensorLayout layout);
+
+		// false in front of the first layer, the images need no delta
+		inline void setDzDxFlag(const bool flag);
+
+		inline void setNumThreads(const int numThreads = 1);
+
+		inline Tensor &getNFCOuFeatMaps();
+
+		inline void getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps);
+
+		void init();
+
+		void fprop();
+
+		void bprop();
+
+	private:
+		Tensor inFeatMaps;
+		Tensor ouFeatMaps;
+		TensorLayout layout;
+
+		int numThreads;
+		bool isDzDx;
+	};
+
+	inline void ReorderLayer::setNFCInFeatMaps(Tensor &inFeatMaps)
+	{
+		this->inFeatMaps = inFeatMaps;
+	}
+
+	inline void ReorderLayer::setLayout(const TensorLayout layout)
+	{
+		this->layout = layout;
+	}
+
+	inline void ReorderLayer::setDzDxFlag(const bool flag)
+	{
+		this->isDzDx = flag;
+	}
+
+	inline void ReorderLayer::setNumThreads(const int numThreads)
+	{
+		this->numThreads = numThreads;
+	}
+
+	inline Tensor &ReorderLayer::getNFCOuFeatMaps()
+	{
+		return this->ouFeatMaps;
+	}
+
+	inline void ReorderLayer::getNFCActivMaps(vector<Tensor *> &outputs, vector<Tensor *> &temps)
+	{
+		if (!ouFeatMaps.empty())
+			outputs.push_back(&ouFeatMaps);
+	}
+}
+
+#endif // reorder layer
@@ -0,0 +1,582 @@
+/* *
+ *
+ */
+
+#include "../Utility/check.h"
+#include "../Utility/mmul.h"
+#include "../Utility/vecmath.h"
+#include "sampledLoss.h"
+
+#include <ctime>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// softmax of n scores in place, returns -log p[label]
+	static float softmaxRow(float *scores, const int n, const int label)
+	{
+		float maxScore = scores[0];
+		for (int k = 1; k < n; ++k)
+			maxScore = max(maxScore, scores[k]);
+
+		float labelScore = scores[label] - maxScore;
+		for (int k = 0; k < n; ++k)
+			scores[k] -= maxScore;
+		vecExp(scores, scores, n, MATH_ACCURATE);
+
+		float sum = 0;
+		for (int k = 0; k < n; ++k)
+			sum += scores[k];
+
+		float invSum = 1.0f / sum;
+		for (int k = 0; k < n; ++k)
+			scores[k] *= invSum;
+
+		return std::log(sum) - labelScore;
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								Sampled softmax loss
+	//
+	// ----------------------------------------------------------------------------
+
+	SampledSoftmaxLoss::SampledSoftmaxLoss()
+		: numClusters(0), clusterSize(0), approx(SOFTMAX_SAMPLED), objCost(0),
+		  numSampled(0), numThreads(1), isEval(false), isDzDx(true) {}
+
+	SampledSoftmaxLoss::~SampledSoftmaxLoss()
+	{
+		inFeatMaps.release();
+		ouFeatMaps.release();
+		labels.release();
+	}
+
+	void SampledSoftmaxLoss::init()
+	{
+		FC_INPUT_INIT(inFeatMaps);
+
+		int numImages = inFeatMaps.rows;
+		int numClasses = wparams.numWeights;
+		int weightChns = wparams.weightChns;
+		argu::ASSERT(inFeatMaps.cols != weightChns, " input dims do not match weights !\n");
+		argu::ASSERT(numClasses < 2, " at least two classes are needed !\n");
+
+	#if _DEBUG
+		srand(0);
+		sampler = RNG(0);
+	#else
+		srand(unsigned int(time(NULL)));
+		sampler = RNG((uint64)time(NULL));
+	#endif
+
+		weights = Mat::zeros(numClasses, weightChns, CV_32FC1);
+		cv::randn(weights, 0, 1);
+		if (wparams.initWeightScale > 0)
+			weights *= wparams.initWeightScale;
+
+		weightMoments = Mat::zeros(numClasses, weightChns, CV_32FC1);
+		bias = Mat::zeros(1, numClasses, CV_32FC1);
+		biasMoments = Mat::zeros(1, numClasses, CV_32FC1);
+		sampleCosts = Mat::zeros(numImages, 1, CV_32FC1);
+
+		int maxActive = 0;
+		if (approx == SOFTMAX_SAMPLED) {
+			argu::ASSERT(numSampled <= 0 || numSampled >= numClasses,
+						 " number of sampled classes should be in (0, numClasses) !\n");
+
+			// labels of the batch join the sampled classes
+			maxActive = numSampled + numImages;
+			activeWeights = Mat::zeros(maxActive, weightChns, CV_32FC1);
+			activeLogits = Mat::zeros(1, numImages * maxActive, CV_32FC1);
+			sampledProbs = Mat::zeros(numImages, 1 + numSampled, CV_32FC1);
+			logExpected = Mat::zeros(1, maxActive, CV_32FC1);
+			labelSlots.assign(numImages, -1);
+
+			// proposal of counts^0.75
+			cumProbs.clear();
+			if (!classCounts.empty()) {
+				argu::ASSERT((int)classCounts.total() != numClasses,
+							 " one count per class is needed !\n");
+
+				const float *countPtr = CV_MAT_PRF(classCounts);
+				int numSeen = 0;
+				double total = 0;
+				cumProbs.resize(numClasses);
+				for (int k = 0; k < numClasses; ++k) {
+					total += std::pow((double)max(countPtr[k], 0.0f), 0.75);
+					cumProbs[k] = total;
+					numSeen += countPtr[k] > 0;
+				}
+				argu::ASSERT(numSeen <= numSampled, " fewer seen classes than samples !\n");
+				for (int k = 0; k < numClasses; ++k)
+					cumProbs[k] /= total;
+			}
+		}
+		else {
+			numClusters = numSampled > 0 ? numSampled : (int)std::ceil(std::sqrt((double)numClasses));
+			clusterSize = (numClasses + numClusters - 1) / numClusters;
+			numClusters = (numClasses + clusterSize - 1) / clusterSize;
+			maxActive = min(numImages, numClusters) * clusterSize;
+
+			clusterWeights = Mat::zeros(numClusters, weightChns, CV_32FC1);
+			cv::randn(clusterWeights, 0, 1);
+			if (wparams.initWeightScale > 0)
+				clusterWeights *= wparams.initWeightScale;
+
+			clusterMoments = Mat::zeros(numClusters, weightChns, CV_32FC1);
+			clusterGrads = Mat::zeros(numClusters, weightChns, CV_32FC1);
+			clusterBias = Mat::zeros(1, numClusters, CV_32FC1);
+			clusterBiasMoments = Mat::zeros(1, numClusters, CV_32FC1);
+			clusterBiasGrads = Mat::zeros(1, numClusters, CV_32FC1);
+			clusterProbs = Mat::zeros(numImages, numClusters, CV_32FC1);
+			sortedInFeatMaps = Mat::zeros(numImages, weightChns, CV_32FC1);
+			sortedDelta = Mat::zeros(numImages, weightChns, CV_32FC1);
+			pathProbs = Mat::zeros(1, numImages * clusterSize, CV_32FC1);
+			sortedRows.assign(numImages, 0);
+			clusterOffsets.assign(numClusters + 1, 0);
+		}
+
+		weightGrads = Mat::zeros(maxActive, weightChns, CV_32FC1);
+		biasGrads = Mat::zeros(1, maxActive, CV_32FC1);
+		classSlots.assign(numClasses, -1);
+		activeRows.clear();
+		objCost = 0;
+	}
+
+	void SampledSoftmaxLoss::fprop()
+	{
+		FC_INPUT_INIT(inFeatMaps);
+		argu::ASSERT((int)labels.total() < inFeatMaps.rows, " fewer labels than images !\n");
+
+		for (int a = 0; a < activeRows.size(); ++a)
+			classSlots[activeRows[a]] = -1;
+		activeRows.clear();
+		activeClusters.clear();
+
+		if (isEval)
+			fpropFull();
+		else if (approx == SOFTMAX_SAMPLED)
+			fpropSampled();
+		else
+			fpropHierarchical();
+
+		const float *costPtr = CV_MAT_PRF(sampleCosts);
+		double cost = 0;
+		for (int i = 0; i < inFeatMaps.rows; ++i)
+			cost += costPtr[i];
+		objCost = (float)(cost / inFeatMaps.rows);
+	}
+
+	void SampledSoftmaxLoss::bprop()
+	{
+		argu::ASSERT(isEval, " no bprop for the full softmax !\n");
+
+		if (approx == SOFTMAX_SAMPLED)
+			bpropSampled();
+		else
+			bpropHierarchical();
+	}
+
+	void SampledSoftmaxLoss::update()
+	{
+		if (activeRows.empty())
+			return;
+
+		int numActive = activeRows.size();
+		layerUpdater.SGDUpdateRows(weights, weightMoments, bias, biasMoments,
+								   weightGrads.rowRange(0, numActive),
+								   biasGrads.colRange(0, numActive), activeRows);
+
+		if (approx == SOFTMAX_HIERARCHICAL)
+			clusterUpdater.SGDUpdate(clusterWeights, clusterMoments, clusterBias,
+									 clusterBiasMoments, clusterGrads, clusterBiasGrads);
+	}
+
+	void SampledSoftmaxLoss::scaleLearningRate()
+	{
+		layerUpdater.scaleLearningRate();
+		clusterUpdater.scaleLearningRate();
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+	void SampledSoftmaxLoss::fpropFull()
+	{
+		int numImages = inFeatMaps.rows;
+		int weightChns = inFeatMaps.cols;
+		int numClasses = weights.rows;
+		if (ouFeatMaps.rows != numImages || ouFeatMaps.cols != numClasses)
+			ouFeatMaps = Mat::zeros(numImages, numClasses, CV_32FC1);
+
+		float *probs = CV_MAT_PRF(ouFeatMaps);
+		fastMatMul(probs, CV_MAT_PRF(inFeatMaps), CV_MAT_PRF(weights),
+				   numImages, weightChns, numClasses, weightChns, false, true);
+
+		bool isTree = approx == SOFTMAX_HIERARCHICAL;
+		if (isTree)
+			fastMatMul(CV_MAT_PRF(clusterProbs), CV_MAT_PRF(inFeatMaps), CV_MAT_PRF(clusterWeights),
+					   numImages, weightChns, numClusters, weightChns, false, true);
+
+		const float *biasPtr = CV_MAT_PRF(bias);
+		const float *clusterBiasPtr = CV_MAT_PRF(clusterBias);
+		float *costPtr = CV_MAT_PRF(sampleCosts);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			int label = getLabel(i);
+			argu::ASSERT(label < 0 || label >= numClasses, " label out of range !\n");
+
+			float *row = probs + i * numClasses;
+			for (int k = 0; k < numClasses; ++k)
+				row[k] += biasPtr[k];
+
+			if (!isTree) {
+				costPtr[i] = softmaxRow(row, numClasses, label);
+				continue;
+			}
+
+			// p(class) = p(cluster) p(class | cluster)
+			float *clusterRow = CV_MAT_PRF(clusterProbs) + i * numClusters;
+			for (int c = 0; c < numClusters; ++c)
+				clusterRow[c] += clusterBiasPtr[c];
+			costPtr[i] = softmaxRow(clusterRow, numClusters, label / clusterSize);
+
+			for (int c = 0; c < numClusters; ++c) {
+				int k0 = c * clusterSize;
+				int size = min(numClasses, k0 + clusterSize) - k0;
+				bool isLabelCluster = c == label / clusterSize;
+				float pathCost = softmaxRow(row + k0, size, isLabelCluster ? label - k0 : 0);
+				if (isLabelCluster)
+					costPtr[i] += pathCost;
+
+				for (int k = 0; k < size; ++k)
+					row[k0 + k] *= clusterRow[c];
+			}
+		}
+	}
+
+	void SampledSoftmaxLoss::fpropSampled()
+	{
+		int numImages = inFeatMaps.rows;
+		int weightChns = inFeatMaps.cols;
+		int numClasses = weights.rows;
+
+		drawCandidates();
+
+		// labels missed by the sampler follow the samples
+		for (int i = 0; i < numImages; ++i) {
+			int label = getLabel(i);
+			argu::ASSERT(label < 0 || label >= numClasses, " label out of range !\n");
+			if (classSlots[label] < 0) {
+				classSlots[label] = activeRows.size();
+				activeRows.push_back(label);
+			}
+			labelSlots[i] = classSlots[label];
+		}
+
+		// expected count of a class in numTries draws without repeats
+		int numActive = activeRows.size();
+		float *logExpPtr = CV_MAT_PRF(logExpected);
+		for (int a = 0; a < numActive; ++a) {
+			double q = getSampleProb(activeRows[a]);
+			logExpPtr[a] = (float)std::log(-expm1(numTries * log1p(-q)));
+		}
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int a = 0; a < numActive; ++a)
+			memcpy(activeWeights.ptr<float>(a), weights.ptr<float>(activeRows[a]),
+				   weightChns * sizeof(float));
+
+		float *logits = CV_MAT_PRF(activeLogits);
+		fastMatMul(logits, CV_MAT_PRF(inFeatMaps), CV_MAT_PRF(activeWeights),
+				   numImages, weightChns, numActive, weightChns, false, true);
+
+		const float *biasPtr = CV_MAT_PRF(bias);
+		float *costPtr = CV_MAT_PRF(sampleCosts);
+		int numCols = 1 + numSampled;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		// [true class, samples], corrected by log expected counts
+		for (int i = 0; i < numImages; ++i) {
+			const float *row = logits + i * numActive;
+			float *probs = sampledProbs.ptr<float>(i);
+			int slot = labelSlots[i];
+
+			probs[0] = row[slot] + biasPtr[activeRows[slot]] - logExpPtr[slot];
+			for (int j = 0; j < numSampled; ++j) {
+				if (j == slot)
+					probs[1 + j] = -FLT_MAX;
+				else
+					probs[1 + j] = row[j] + biasPtr[activeRows[j]] - logExpPtr[j];
+			}
+
+			costPtr[i] = softmaxRow(probs, numCols, 0);
+		}
+	}
+
+	void SampledSoftmaxLoss::bpropSampled()
+	{
+		int numImages = inFeatMaps.rows;
+		int weightChns = inFeatMaps.cols;
+		int numActive = activeRows.size();
+		float scale = 1.0f / numImages;
+		float *delta = CV_MAT_PRF(activeLogits);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float *row = delta + i * numActive;
+			const float *probs = sampledProbs.ptr<float>(i);
+			int slot = labelSlots[i];
+
+			memset(row, 0, numActive * sizeof(float));
+			for (int j = 0; j < numSampled; ++j)
+				if (j != slot) row[j] = probs[1 + j] * scale;
+			row[slot] += (probs[0] - 1) * scale;
+		}
+
+		// weight grads [numActive x weightChns] = delta^T * x
+		fastMatMul(CV_MAT_PRF(weightGrads), delta, CV_MAT_PRF(inFeatMaps),
+				   numImages, numActive, numImages, weightChns, true, false);
+
+		float *biasGradPtr = CV_MAT_PRF(biasGrads);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int a = 0; a < numActive; ++a) {
+			float sum = 0;
+			for (int i = 0; i < numImages; ++i)
+				sum += delta[i * numActive + a];
+			biasGradPtr[a] = sum;
+		}
+
+		if (isDzDx)
+			fastMatMul(CV_MAT_PRF(inFeatMaps), delta, CV_MAT_PRF(activeWeights),
+					   numImages, numActive, numActive, weightChns, false, false);
+	}
+
+	void SampledSoftmaxLoss::fpropHierarchical()
+	{
+		int numImages = inFeatMaps.rows;
+		int weightChns = inFeatMaps.cols;
+		int numClasses = weights.rows;
+
+		// group the rows by the cluster of their label
+		fill(clusterOffsets.begin(), clusterOffsets.end(), 0);
+		for (int i = 0; i < numImages; ++i) {
+			int label = getLabel(i);
+			argu::ASSERT(label < 0 || label >= numClasses, " label out of range !\n");
+			clusterOffsets[label / clusterSize + 1]++;
+		}
+
+		for (int c = 0; c < numClusters; ++c) {
+			if (clusterOffsets[c + 1] > 0) {
+				activeClusters.push_back(c);
+				int k1 = min(numClasses, (c + 1) * clusterSize);
+				for (int k = c * clusterSize; k < k1; ++k) {
+					classSlots[k] = activeRows.size();
+					activeRows.push_back(k);
+				}
+			}
+			clusterOffsets[c + 1] += clusterOffsets[c];
+		}
+
+		vector<int> ends(clusterOffsets.begin(), clusterOffsets.end() - 1);
+		for (int i = 0; i < numImages; ++i)
+			sortedRows[ends[getLabel(i) / clusterSize]++] = i;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int r = 0; r < numImages; ++r)
+			memcpy(sortedInFeatMaps.ptr<float>(r), inFeatMaps.ptr<float>(sortedRows[r]),
+				   weightChns * sizeof(float));
+
+		// p(cluster)
+		float *clusterPtr = CV_MAT_PRF(clusterProbs);
+		fastMatMul(clusterPtr, CV_MAT_PRF(inFeatMaps), CV_MAT_PRF(clusterWeights),
+				   numImages, weightChns, numClusters, weightChns, false, true);
+
+		const float *clusterBiasPtr = CV_MAT_PRF(clusterBias);
+		float *costPtr = CV_MAT_PRF(sampleCosts);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float *row = clusterPtr + i * numClusters;
+			for (int c = 0; c < numClusters; ++c)
+				row[c] += clusterBiasPtr[c];
+			costPtr[i] = softmaxRow(row, numClusters, getLabel(i) / clusterSize);
+		}
+
+		// p(class | cluster), one gemm per cluster over its rows
+		int numActive = activeClusters.size();
+		const float *biasPtr = CV_MAT_PRF(bias);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int t = 0; t < numActive; ++t) {
+			int c = activeClusters[t];
+			int r0 = clusterOffsets[c];
+			int n = clusterOffsets[c + 1] - r0;
+			int k0 = c * clusterSize;
+			int size = min(numClasses, k0 + clusterSize) - k0;
+
+			float *probs = CV_MAT_PRF(pathProbs) + r0 * clusterSize;
+			fastMatMul(probs, sortedInFeatMaps.ptr<float>(r0), weights.ptr<float>(k0),
+					   n, weightChns, size, weightChns, false, true);
+
+			for (int r = 0; r < n; ++r) {
+				int i = sortedRows[r0 + r];
+				float *row = probs + r * size;
+				for (int k = 0; k < size; ++k)
+					row[k] += biasPtr[k0 + k];
+				costPtr[i] += softmaxRow(row, size, getLabel(i) - k0);
+			}
+		}
+	}
+
+	void SampledSoftmaxLoss::bpropHierarchical()
+	{
+		int numImages = inFeatMaps.rows;
+		int weightChns = inFeatMaps.cols;
+		int numClasses = weights.rows;
+		float scale = 1.0f / numImages;
+		float *clusterPtr = CV_MAT_PRF(clusterProbs);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float *row = clusterPtr + i * numClusters;
+			for (int c = 0; c < numClusters; ++c)
+				row[c] *= scale;
+			row[getLabel(i) / clusterSize] -= scale;
+		}
+
+		fastMatMul(CV_MAT_PRF(clusterGrads), clusterPtr, CV_MAT_PRF(inFeatMaps),
+				   numImages, numClusters, numImages, weightChns, true, false);
+		reduce(clusterProbs, clusterBiasGrads, 0, REDUCE_SUM, CV_32FC1);
+
+		// every cluster but the last holds clusterSize classes, so
+		// active cluster t owns grads rows from t * clusterSize
+		int numActive = activeClusters.size();
+		float *biasGradPtr = CV_MAT_PRF(biasGrads);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int t = 0; t < numActive; ++t) {
+			int c = activeClusters[t];
+			int r0 = clusterOffsets[c];
+			int n = clusterOffsets[c + 1] - r0;
+			int k0 = c * clusterSize;
+			int size = min(numClasses, k0 + clusterSize) - k0;
+			int g0 = t * clusterSize;
+
+			float *delta = CV_MAT_PRF(pathProbs) + r0 * clusterSize;
+			for (int r = 0; r < n; ++r) {
+				float *row = delta + r * size;
+				for (int k = 0; k < size; ++k)
+					row[k] *= scale;
+				row[getLabel(sortedRows[r0 + r]) - k0] -= scale;
+			}
+
+			fastMatMul(weightGrads.ptr<float>(g0), delta, sortedInFeatMaps.ptr<float>(r0),
+					   n, size, n, weightChns, true, false);
+
+			for (int k = 0; k < size; ++k) {
+				float sum = 0;
+				for (int r = 0; r < n; ++r)
+					sum += delta[r * size + k];
+				biasGradPtr[g0 + k] = sum;
+			}
+
+			if (isDzDx)
+				fastMatMul(sortedDelta.ptr<float>(r0), delta, weights.ptr<float>(k0),
+						   n, size, size, weightChns, false, false);
+		}
+
+		if (!isDzDx)
+			return;
+
+		fastMatMul(CV_MAT_PRF(inFeatMaps), clusterPtr, CV_MAT_PRF(clusterWeights),
+				   numImages, numClusters, numClusters, weightChns, false, false);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int r = 0; r < numImages; ++r) {
+			float *dst = inFeatMaps.ptr<float>(sortedRows[r]);
+			const float *src = sortedDelta.ptr<float>(r);
+			for (int d = 0; d < weightChns; ++d)
+				dst[d] += src[d];
+		}
+	}
+
+	void SampledSoftmaxLoss::drawCandidates()
+	{
+		int numClasses = weights.rows;
+		double logRange = std::log(numClasses + 1.0);
+		const double *cum = cumProbs.empty() ? NULL : &cumProbs[0];
+
+		numTries = 0;
+		while ((int)activeRows.size() < numSampled) {
+			double u = sampler.uniform(0.0, 1.0);
+			int k = 0;
+			if (cum == NULL)
+				k = (int)std::exp(u * logRange) - 1;
+			else
+				k = (int)(upper_bound(cum, cum + numClasses, u) - cum);
+			k = min(max(k, 0), numClasses - 1);
+
+			numTries++;
+			if (classSlots[k] < 0) {
+				classSlots[k] = activeRows.size();
+				activeRows.push_back(k);
+			}
+		}
+	}
+
+	double SampledSoftmaxLoss::getSampleProb(const int k)
+	{
+		// log-uniform, P(k) = log((k + 2) / (k + 1)) / log(numClasses + 1)
+		if (cumProbs.empty())
+			return std::log((k + 2.0) / (k + 1.0)) / std::log(weights.rows + 1.0);
+		return cumProbs[k] - (k > 0 ? cumProbs[k - 1] : 0);
+	}
+}
@@ -0,0 +1,285 @@
+#ifndef _CONVNET_CNN_SAMPLEDLOSS_H_
+#define _CONVNET_CNN_SAMPLEDLOSS_H_
+#pragma once
+
+#include "../Utility/param.h"
+#include "layer.h"
+#include "updater.h"
+#include <string>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	enum SoftmaxApprox
+	{
+		SOFTMAX_SAMPLED = 0,		// true class against sampled negatives
+		SOFTMAX_HIERARCHICAL = 1	// softmax over clusters, then in the cluster
+	};
+
+	// --------------------------------------------------------------
+	//
+	// @brief last fc layer and softmax loss for many classes
+	//
+	//	weights are [numClasses x weightChns], one row per class,
+	//	and only the rows a batch touches are computed,
+	//	differentiated and updated during training:
+	//
+	//	SOFTMAX_SAMPLED draws numSampled distinct classes per batch,
+	//	log-uniform (classes sorted by decreasing frequency) or
+	//	from classCounts^0.75, and subtracts log of their expected
+	//	counts from the logits. A sampled class that is the label
+	//	of a row is left out of that row.
+	//
+	//	SOFTMAX_HIERARCHICAL puts class k in cluster k / clusterSize
+	//	and learns p(cluster) p(class | cluster), a row computes
+	//	the clusters plus the classes of its own cluster.
+	//
+	//	setEvaluation(true) computes the probabilities of all
+	//	classes instead, getFCOuFeatMaps is only valid then.
+	//
+	//	update() applies momentum SGD to the touched rows, the
+	//	other optimizers are not supported.
+	//
+	// --------------------------------------------------------------
+	class SampledSoftmaxLoss : public Layer
+	{
+	public:
+		SampledSoftmaxLoss();
+
+		~SampledSoftmaxLoss();
+
+		inline void setFCInFeatMaps(Mat &inFeatMaps);
+
+		inline void setLabels(Mat &labels);
+
+		inline void setWeightGeometry(const int numClasses,
+									  const int weightChns,
+									  const float initWeightScale);
+
+		inline void setUpdaterParams(const float biasLearningRate,
+									 const float biasMomentRate,
+									 const float biasLearningRateScale,
+									 const float weightLearningRate,
+									 const float weightMomentRate,
+									 const float weightLearningRateScale,
+									 const float weightDecay);
+
+		// numSampled negatives, or clusters (<= 0 for sqrt(numClasses))
+		inline void setApproximation(const SoftmaxApprox approx, const int numSampled);
+
+		// [1 x numClasses] training counts, empty for log-uniform
+		inline void setClassFrequency(const Mat &classCounts);
+
+		// [numImages x 1] losses of the last fprop
+		inline Mat &getSampleCosts();
+
+		inline void setEvaluation(const bool isEval);
+
+		inline void setDzDxFlag(const bool flag);
+
+		inline void setNumThreads(const int numThreads = 1);
+
+		inline Mat &getFCOuFeatMaps();
+
+		inline float getCurrObjCost();
+
+		inline Mat &getFCWeights();
+
+		inline Mat &getBias();
+
+		inline long int getNumberParams();
+
+		void init();
+
+		void fprop();
+
+		void bprop();
+
+		void update();
+
+		void scaleLearningRate();
+
+	private:
+		inline int getLabel(const int i);
+
+		void fpropFull();
+
+		void fpropSampled();
+
+		void bpropSampled();
+
+		void fpropHierarchical();
+
+		void bpropHierarchical();
+
+		// distinct classes into activeRows[0, numSampled)
+		void drawCandidates();
+
+		double getSampleProb(const int k);
+
+	private:
+		Mat inFeatMaps;
+		Mat ouFeatMaps;
+		Mat labels;
+		Mat weights;
+		Mat weightMoments;
+		Mat bias;
+		Mat biasMoments;
+		Mat weightGrads;		// [rows touched x weightChns]
+		Mat biasGrads;
+		vector<int> activeRows;	// classes the grads belong to
+		Mat sampleCosts;
+
+		// SOFTMAX_SAMPLED
+		Mat activeWeights;
+		Mat activeLogits;		// [numImages x activeRows], delta in bprop
+		Mat sampledProbs;		// [numImages x (1 + numSampled)]
+		Mat logExpected;		// log expected count of each active row
+		vector<int> labelSlots;
+		vector<int> classSlots;	// -1 or place in activeRows
+		Mat classCounts;
+		vector<double> cumProbs;
+		RNG sampler;
+		int numTries;
+
+		// SOFTMAX_HIERARCHICAL
+		Mat clusterWeights;
+		Mat clusterMoments;
+		Mat clusterBias;
+		Mat clusterBiasMoments;
+		Mat clusterGrads;
+		Mat clusterBiasGrads;
+		Mat clusterProbs;		// [numImages x numClusters]
+		Mat sortedInFeatMaps;	// rows grouped by the cluster of their label
+		Mat sortedDelta;
+		Mat pathProbs;			// [n x clusterSize] blocks, one per cluster
+		vector<int> sortedRows;
+		vector<int> clusterOffsets;
+		vector<int> activeClusters;
+		int numClusters;
+		int clusterSize;
+
+		WeightGeometry wparams;
+		Updater layerUpdater;
+		Updater clusterUpdater;
+		SoftmaxApprox approx;
+		float objCost;
+		int numSampled;
+		int numThreads;
+		bool isEval;
+		bool isDzDx;
+	};
+
+
+	inline void SampledSoftmaxLoss::setFCInFeatMaps(Mat &inFeatMaps)
+	{
+		this->inFeatMaps = inFeatMaps;
+	}
+
+	inline void SampledSoftmaxLoss::setLabels(Mat &labels)
+	{
+		this->labels = labels;
+	}
+
+	inline void SampledSoftmaxLoss::setWeightGeometry(const int numClasses,
+													  const int weightChns,
+													  const float initWeightScale)
+	{
+		wparams.set(1, numClasses, weightChns, 1, 1, initWeightScale);
+	}
+
+	inline void SampledSoftmaxLoss::setUpdaterParams(const float biasLearningRate,
+													 const float biasMomentRate,
+													 const float biasLearningRateScale,
+													 const float weightLearningRate,
+													 const float weightMomentRate,
+													 const float weightLearningRateScale,
+													 const float weightDecay)
+	{
+		layerUpdater.setUpdaterParams(biasLearningRate, biasMomentRate,
+									  biasLearningRateScale, weightLearningRate,
+									  weightMomentRate, weightLearningRateScale,
+									  weightDecay);
+		clusterUpdater.setUpdaterParams(biasLearningRate, biasMomentRate,
+										biasLearningRateScale, weightLearningRate,
+										weightMomentRate, weightLearningRateScale,
+										weightDecay);
+	}
+
+	inline void SampledSoftmaxLoss::setApproximation(const SoftmaxApprox approx,
+													 const int numSampled)
+	{
+		this->approx = approx;
+		this->numSampled = numSampled;
+	}
+
+	inline void SampledSoftmaxLoss::setClassFrequency(const Mat &classCounts)
+	{
+		this->classCounts = classCounts;
+	}
+
+	inline Mat &SampledSoftmaxLoss::getSampleCosts()
+	{
+		return this->sampleCosts;
+	}
+
+	inline void SampledSoftmaxLoss::setEvaluation(const bool isEval)
+	{
+		this->isEval = isEval;
+	}
+
+	inline void SampledSoftmaxLoss::setDzDxFlag(const bool flag)
+	{
+		this->isDzDx = flag;
+	}
+
+	inline void SampledSoftmaxLoss::setNumThreads(const int numThreads)
+	{
+		this->numThreads = numThreads;
+	}
+
+	inline Mat &SampledSoftmaxLoss::getFCOuFeatMaps()
+	{
+		return this->ouFeatMaps;
+	}
+
+	inline float SampledSoftmaxLoss::getCurrObjCost()
+	{
+		Mat ww;
+		pow(weights, 2, ww);
+		float decay = (float)sum(ww)[0];
+		if (!clusterWeights.empty()) {
+			pow(clusterWeights, 2, ww);
+			decay += (float)sum(ww)[0];
+		}
+		return objCost + decay * 0.5f * layerUpdater.getWeightDecay();
+	}
+
+	inline Mat &SampledSoftmaxLoss::getFCWeights()
+	{
+		return this->weights;
+	}
+
+	inline Mat &SampledSoftmaxLoss::getBias()
+	{
+		return this->bias;
+	}
+
+	inline long int SampledSoftmaxLoss::getNumberParams()
+	{
+		return weights.total() + bias.total() + clusterWeights.total() + clusterBias.total();
+	}
+
+	inline int SampledSoftmaxLoss::getLabel(const int i)
+	{
+		if (labels.type() == CV_32SC1)
+			return ((const int *)labels.data)[i];
+		return (int)((const float *)labels.data)[i];
+	}
+}
+
+#endif // sampled softmax loss
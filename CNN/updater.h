@@ -4,8 +4,10 @@
 
 #include "../Utility/types.h"
 #include "../Utility/param.h"
+#include "../Utility/optim.h"
 #include <opencv2/core/core.hpp>
 #include <iostream>
+#include <vector>
 
 namespace convnet
 {	
@@ -15,7 +17,7 @@ namespace convnet
 	class Updater
 	{
 	public:
-		Updater() {}
+		Updater() : numSteps(0) {}
 		~Updater() {}
 
 		inline void setUpdaterParams(const float biasLearningRate,
@@ -32,6 +34,34 @@ namespace convnet
 
 		inline float getWeightDecay();
 
+		inline void setOptimizer(const OptimMethod optimMethod,
+								 const float varianceRate,
+								 const float epsilon);
+
+		// variances are allocated for every method but SGD
+		inline bool isVarianceKept();
+
+		// one more update step, for the bias correction of Adam/AdamW
+		inline void nextStep();
+
+		// add one block per weight group and one for the bias, for 
+		// updateParamBlocks, at the current update step
+		inline void getParamBlocks(vector<ParamBlock> &blocks,
+								   Mat3D &weights, Mat3D &weightMoments,
+								   Mat3D &weightVariances,
+								   Mat &bias, Mat &biasMoments, 
+								   Mat &biasVariances,
+								   const Mat3D &weightGrads,
+								   const Mat &biasGrads);
+
+		inline void getParamBlocks(vector<ParamBlock> &blocks,
+								   Mat &weights, Mat &weightMoments,
+								   Mat &weightVariances,
+								   Mat &bias, Mat &biasMoments,
+								   Mat &biasVariances,
+								   const Mat &weightGrads,
+								   const Mat &biasGrads);
+
 		inline void SGDUpdate(Mat3D &weights, Mat3D &weightMoments,
 							  Mat &bias, Mat &biasMoments,
 							  const Mat3D &weightGrads,
@@ -42,10 +72,23 @@ namespace convnet
 							  const Mat &weightGrads,
 							  const Mat &biasGrads);
 
+		// momentum SGD on the listed rows of weights and the matching 
+		// bias columns only, row r of the grads belongs to rows[r]
+		inline void SGDUpdateRows(Mat &weights, Mat &weightMoments,
+								  Mat &bias, Mat &biasMoments,
+								  const Mat &weightGrads,
+								  const Mat &biasGrads,
+								  const vector<int> &rows);
+
 		inline void scaleLearningRate();
 
+	private:
+		inline ParamBlock getParamBlock(Mat &params, Mat &moments, Mat &variances, 
+										const Mat &grads, const bool isBias);
+
 	private:
 		LearnGeometry lparams;
+		int numSteps;
 	};
 
 
@@ -79,6 +122,70 @@ namespace convnet
 	}
 
 
+	inline void Updater::setOptimizer(const OptimMethod optimMethod,
+									  const float varianceRate,
+									  const float epsilon)
+	{
+		lparams.setOptimizer(optimMethod, varianceRate, epsilon);
+	}
+
+	inline bool Updater::isVarianceKept()
+	{
+		return convnet::isVarianceKept(lparams.optimMethod);
+	}
+
+	inline void Updater::nextStep()
+	{
+		numSteps++;
+	}
+
+	inline void Updater::getParamBlocks(vector<ParamBlock> &blocks,
+										Mat3D &weights, Mat3D &weightMoments,
+										Mat3D &weightVariances,
+										Mat &bias, Mat &biasMoments,
+										Mat &biasVariances,
+										const Mat3D &weightGrads,
+										const Mat &biasGrads)
+	{
+		blocks.push_back(getParamBlock(bias, biasMoments, biasVariances, biasGrads, true));
+		for (int g = 0; g < weights.size(); ++g) {
+			Mat variances = weightVariances.empty() ? Mat() : weightVariances[g];
+			blocks.push_back(getParamBlock(weights[g], weightMoments[g], variances, 
+										   weightGrads[g], false));
+		}
+	}
+
+	inline void Updater::getParamBlocks(vector<ParamBlock> &blocks,
+										Mat &weights, Mat &weightMoments,
+										Mat &weightVariances,
+										Mat &bias, Mat &biasMoments,
+										Mat &biasVariances,
+										const Mat &weightGrads,
+										const Mat &biasGrads)
+	{
+		blocks.push_back(getParamBlock(bias, biasMoments, biasVariances, biasGrads, true));
+		blocks.push_back(getParamBlock(weights, weightMoments, weightVariances, weightGrads, false));
+	}
+
+	inline ParamBlock Updater::getParamBlock(Mat &params, Mat &moments, Mat &variances,
+											 const Mat &grads, const bool isBias)
+	{
+		ParamBlock block;
+		block.weights = (float *)params.data;
+		block.moments = (float *)moments.data;
+		block.variances = (float *)variances.data;
+		block.grads = (const float *)grads.data;
+		block.total = params.total();
+		block.method = lparams.optimMethod;
+		block.learningRate = isBias ? lparams.biasLearningRate : lparams.weightLearningRate;
+		block.momentRate = isBias ? lparams.biasMomentRate : lparams.weightMomentRate;
+		block.varianceRate = lparams.varianceRate;
+		block.epsilon = lparams.epsilon;
+		block.weightDecay = lparams.weightDecay >= 0 ? lparams.weightDecay : 0;
+		block.step = numSteps;
+		return block;
+	}
+
 	inline void Updater::SGDUpdate(Mat3D &weights, Mat3D &weightMoments, 
 								   Mat &bias, Mat &biasMoments, 
 								   const Mat3D &weightGrads, 
@@ -89,14 +196,15 @@ namespace convnet
 			wd = lparams.weightDecay;
 
 		// update bias
-		biasMoments = lparams.biasMomentRate * biasMoments + lparams.biasLearningRate * (biasGrads + wd * bias);
-		bias -= biasMoments;
+		sgdMomentumUpdate((float *)bias.data, (float *)biasMoments.data, 
+						  (const float *)biasGrads.data, bias.total(),
+						  lparams.biasLearningRate, lparams.biasMomentRate, wd);
 
 		// update weights
 		for (int g = 0; g < weights.size(); ++g) {
-			weightMoments[g] = lparams.weightMomentRate * weightMoments[g] + 
-				lparams.weightLearningRate * (weightGrads[g] + wd * weights[g]);
-			weights[g] -= weightMoments[g];
+			sgdMomentumUpdate((float *)weights[g].data, (float *)weightMoments[g].data,
+							  (const float *)weightGrads[g].data, weights[g].total(),
+							  lparams.weightLearningRate, lparams.weightMomentRate, wd);
 		}
 	}
 
@@ -110,13 +218,43 @@ namespace convnet
 		if (lparams.weightDecay >= 0)
 			wd = lparams.weightDecay;
 
-		biasMoments = lparams.biasMomentRate * biasMoments + lparams.biasLearningRate * (biasGrads + wd * bias);
-		bias -= biasMoments;
+		sgdMomentumUpdate((float *)bias.data, (float *)biasMoments.data,
+						  (const float *)biasGrads.data, bias.total(),
+						  lparams.biasLearningRate, lparams.biasMomentRate, wd);
+
+		sgdMomentumUpdate((float *)weights.data, (float *)weightMoments.data,
+						  (const float *)weightGrads.data, weights.total(),
+						  lparams.weightLearningRate, lparams.weightMomentRate, wd);
+	}
+
+	inline void Updater::SGDUpdateRows(Mat &weights, Mat &weightMoments,
+									   Mat &bias, Mat &biasMoments,
+									   const Mat &weightGrads,
+									   const Mat &biasGrads,
+									   const vector<int> &rows)
+	{
+		float wd = 0;
+		if (lparams.weightDecay >= 0)
+			wd = lparams.weightDecay;
+
+		int numRows = rows.size();
+		int dims = weights.cols;
+		float *biasPtr = (float *)bias.data;
+		float *biasMomentPtr = (float *)biasMoments.data;
+		const float *biasGradPtr = (const float *)biasGrads.data;
 
-		weightMoments = lparams.weightMomentRate * weightMoments +
-			            lparams.weightLearningRate * (weightGrads + wd * weights);
-		weights -= weightMoments;
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
 
+		for (int r = 0; r < numRows; ++r) {
+			int k = rows[r];
+			sgdMomentumUpdate(weights.ptr<float>(k), weightMoments.ptr<float>(k), 
+							  weightGrads.ptr<float>(r), dims,
+							  lparams.weightLearningRate, lparams.weightMomentRate, wd);
+			sgdMomentumUpdate(biasPtr + k, biasMomentPtr + k, biasGradPtr + r, 1,
+							  lparams.biasLearningRate, lparams.biasMomentRate, wd);
+		}
 	}
 
 	inline void Updater::scaleLearningRate()
@@ -0,0 +1,86 @@
+/**
+ */
+
+#include "../Utility/check.h"
+#include "../CNN/convLayer.h"
+
+#include <ctime>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+
+using namespace convnet;
+using namespace std;
+
+
+void allocateMaps(Tensor &maps, const int numImages, const int chns,
+				  const int rows, const int cols)
+{
+	maps.create(numImages, chns, rows, cols);
+	for (int i = 0; i < numImages; ++i) {
+		for (int ch = 0; ch < chns; ++ch)
+			cv::randn(maps[i][ch], 0, 1);
+	}
+}
+
+
+// average milliseconds of one fprop + bprop (weights and dz/dx)
+double timeConvLayer(const ConvAlgorithm convAlgo, const int numImages,
+					 const int inChns, const int ouChns, const int mapSize,
+					 const int winSize, const int numRepeats)
+{
+	Tensor inFeatMaps;
+	allocateMaps(inFeatMaps, numImages, inChns, mapSize, mapSize);
+
+	ConvLayer layer(inFeatMaps);
+	layer.setWeightGeometry(1, ouChns, inChns, winSize, winSize, 0.01f);
+	layer.setStrideGeometry(1, 1);
+	layer.setPadGeometry(winSize / 2, winSize / 2, winSize / 2, winSize / 2);
+	layer.setDzDxFlag(true);
+	layer.setConvAlgorithm(convAlgo);
+	layer.init();
+
+	// warm up, the filter transforms are built here
+	layer.fprop();
+	layer.bprop();
+
+	int64 start = getTickCount();
+	for (int t = 0; t < numRepeats; ++t) {
+		layer.fprop();
+		layer.bprop();
+	}
+	return (getTickCount() - start) * 1000.0 / getTickFrequency() / numRepeats;
+}
+
+
+int main()
+{
+	// --------------------------------------------------------------------------
+	//
+	//						im2col vs fft convolution
+	//
+	//	same padding, stride 1, 32 -> 32 channels, minibatch of 32; speedup > 1
+	//	means the fft path is faster
+	//
+	// --------------------------------------------------------------------------
+	const int numImages = 32;
+	const int inChns = 32;
+	const int ouChns = 32;
+	const int numRepeats = 5;
+	const int winSizes[] = { 5, 7, 9, 11 };
+	const int mapSizes[] = { 8, 16, 32, 64 };
+
+	printf("%6s %6s %12s %12s %9s \n", "win", "map", "im2col(ms)", "fft(ms)", "speedup");
+	for (int w = 0; w < sizeof(winSizes) / sizeof(int); ++w) {
+		for (int m = 0; m < sizeof(mapSizes) / sizeof(int); ++m) {
+			double im2colTime = timeConvLayer(CONV_IM2COL, numImages, inChns, ouChns,
+											  mapSizes[m], winSizes[w], numRepeats);
+			double fftTime = timeConvLayer(CONV_FFT, numImages, inChns, ouChns,
+										   mapSizes[m], winSizes[w], numRepeats);
+			printf("%6d %6d %12.2f %12.2f %9.2f \n", winSizes[w], mapSizes[m],
+				   im2colTime, fftTime, im2colTime / fftTime);
+		}
+	}
+
+	return 0;
+}
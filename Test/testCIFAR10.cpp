@@ -4,6 +4,7 @@
 #include "../IMDB/cifar.h"
 #include "../CNN/nnets.h"
 #include <ctime>
+#include <string>
 #include <vector>
 #include <algorithm>
 #include <opencv2/opencv.hpp>
@@ -110,7 +111,7 @@ void contrastNormalize(Mat4D &images)
 	}
 }
 
-void createFastCNNModel(NNets &model, Mat4D &inFeatMaps, 
+void createFastCNNModel(NNets &model, Tensor &inFeatMaps, 
 					    Mat &labels, const int numThreads,
 						const bool verbose = true)
 {
@@ -189,6 +190,7 @@ void createFastCNNModel(NNets &model, Mat4D &inFeatMaps,
 
 	model.setInputImages(inFeatMaps);
 	model.setInputLabels(labels);
+	model.setInPlaceActiv(true);
 	model.builChains(true);
 
 	if (verbose) {
@@ -199,9 +201,12 @@ void createFastCNNModel(NNets &model, Mat4D &inFeatMaps,
 }
 
 
-void createCompCNNModel(NNets &model, Mat4D &inFeatMaps, 
+// isGlobalPool: average each map of pool3 into one fc input instead of 
+// concatenating the 3 x 3 maps
+void createCompCNNModel(NNets &model, Tensor &inFeatMaps, 
 						Mat &labels, const int numThreads, 
-						const bool verbose = true)
+						const bool verbose = true,
+						const bool isGlobalPool = false)
 {
 	WeightGeometry wparams;
 	StrideGeometry strides;
@@ -256,12 +261,19 @@ void createCompCNNModel(NNets &model, Mat4D &inFeatMaps,
 	padding.set(0, 0, 0, 0);
 	model.createPoolLayer(wparams, strides, padding, "Avg", true, numThreads);
 
-	// concat layer
-	wparams.set(-1, -1, -1, 3, 3, -1);
-	model.createConcatLayer(wparams, numThreads);
+	if (isGlobalPool) {
+		// global pooling layer, 64 fc inputs for any image size
+		model.createGlobalPoolLayer(numThreads);
+		wparams.set(-1, 64, 64, -1, -1, 0.1f);
+	}
+	else {
+		// concat layer
+		wparams.set(-1, -1, -1, 3, 3, -1);
+		model.createConcatLayer(wparams, numThreads);
+		wparams.set(-1, 64, 64 * 3 * 3, -1, -1, 0.1f);
+	}
 
 	// fc4 layer
-	wparams.set(-1, 64, 64 * 3 * 3, -1, -1, 0.1f);
 	lparams.set(0.002f, 0.9f, 0.1f, 0.001f, 0.9f, 0.1f, 1.0f);
 	model.createFCNLayer(wparams, lparams, true, numThreads);
 
@@ -278,6 +290,7 @@ void createCompCNNModel(NNets &model, Mat4D &inFeatMaps,
 
 	model.setInputImages(inFeatMaps);
 	model.setInputLabels(labels);
+	model.setInPlaceActiv(true);
 	model.builChains(true);
 
 	if (verbose) {
@@ -289,17 +302,16 @@ void createCompCNNModel(NNets &model, Mat4D &inFeatMaps,
 
 
 
-void getBatchData(Mat4D &batchData, Mat &batchLabel,
+void getBatchData(Tensor &batchData, Mat &batchLabel,
 			      const Mat4D &data, const Mat &label, const vector<int> &index,
 				  const int batchSize, const int batchIdx)
 {
 	int bs = batchIdx * batchSize;
 	int be = min((batchIdx + 1)*batchSize, (int)data.size());
-	int rows = batchData[0][0].rows;
-	int cols = batchData[0][0].cols;
+	int dims = batchData.getMapDims();
 	for (int i = bs; i < be; ++i) {
 		for (int ch = 0; ch < 3; ++ch)
-			memcpy(batchData[i - bs][ch].data, data[index[i]][ch].data, rows * cols * sizeof(float));
+			memcpy(batchData.ptr(i - bs, ch), data[index[i]][ch].data, dims * sizeof(float));
 		label.col(index[i]).copyTo(batchLabel.col(i - bs));
 	}
 }
@@ -328,7 +340,9 @@ void predict(int &numCorrect, const Mat &probs, const Mat &labels)
 }
 
 
-int main()
+// argv[1] picks the model: "fast" (default), "comp" or "gap" (comp with
+// global average pooling)
+int main(int argc, char **argv)
 {
 	Mat4D trainImages(50000);
 	Mat4D validImages(10000);
@@ -383,17 +397,15 @@ int main()
 	const int epochs = 10;
 	const int batchSize = 100;
 
-	Mat4D batchImages(batchSize);
+	Tensor batchImages(batchSize, 3, 32, 32);
 	Mat batchLabels(1, batchSize, CV_32FC1);
-	for (int i = 0; i < batchSize; ++i) {
-		batchImages[i].resize(3);
-		batchImages[i][0] = Mat::zeros(32, 32, CV_32FC1);
-		batchImages[i][1] = Mat::zeros(32, 32, CV_32FC1);
-		batchImages[i][2] = Mat::zeros(32, 32, CV_32FC1);
-	}
 
 	NNets model;
-	createFastCNNModel(model, batchImages, batchLabels, numThreads, true);
+	string modelName = argc > 1 ? argv[1] : "fast";
+	if (modelName == "comp" || modelName == "gap")
+		createCompCNNModel(model, batchImages, batchLabels, numThreads, true, modelName == "gap");
+	else
+		createFastCNNModel(model, batchImages, batchLabels, numThreads, true);
 	
 	vector<int> trainIndex(trainImages.size());
 	vector<int> validIndex(validImages.size());
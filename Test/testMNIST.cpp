@@ -50,7 +50,7 @@ void abstractDataMean(Mat3D &images, const Mat &meanImage)
 }
 
 
-void createLeNetModel(NNets &model, Mat4D &inFeatMaps,
+void createLeNetModel(NNets &model, Tensor &inFeatMaps,
 				      Mat &labels, const int numThreads,
 				      const bool verbose = true)
 {
@@ -118,17 +118,16 @@ void createLeNetModel(NNets &model, Mat4D &inFeatMaps,
 }
 
 
-void getBatchData(Mat4D &batchData, Mat &batchLabel,
+void getBatchData(Tensor &batchData, Mat &batchLabel,
 				  const Mat3D &data, const Mat &label, 
 				  const vector<int> &index, const int batchSize, 
 				  const int batchIdx)
 {
 	int bs = batchIdx * batchSize;
 	int be = std::min((batchIdx + 1)*batchSize, (int)data.size());
-	int rows = batchData[0][0].rows;
-	int cols = batchData[0][0].cols;
+	int dims = batchData.getMapDims();
 	for (int i = bs; i < be; ++i) {
-		memcpy(batchData[i - bs][0].data, data[index[i]].data, rows * rows * sizeof(float));
+		memcpy(batchData.ptr(i - bs), data[index[i]].data, dims * sizeof(float));
 		label.col(index[i]).copyTo(batchLabel.col(i - bs));
 	}
 }
@@ -190,12 +189,8 @@ int main()
 
 
 	printf("Allocating spaces \n");
-	Mat4D batchImages(batchSize);
+	Tensor batchImages(batchSize, 1, 28, 28);
 	Mat batchLabels(1, batchSize, CV_32FC1);
-	for (int i = 0; i < batchSize; ++i) {
-		batchImages[i].resize(1);
-		batchImages[i][0] = Mat::zeros(28, 28, CV_32FC1);
-	}
 
 	printf("Creating CNN Model \n");
 	NNets model;
@@ -0,0 +1,30 @@
+#include "arena.h"
+
+namespace convnet
+{
+	void FlatArena::create(const vector<Size> &shapes)
+	{
+		int lineDims = TENSOR_ALIGN_BYTES / sizeof(float);
+
+		this->shapes = shapes;
+		offsets.resize(shapes.size());
+		total = 0;
+		for (int i = 0; i < shapes.size(); ++i) {
+			offsets[i] = total;
+			total += (shapes[i].area() + lineDims - 1) / lineDims * lineDims;
+		}
+
+		// over-allocate so that the first view can start on an aligned address
+		slab = Mat::zeros(1, total + lineDims, CV_32FC1);
+		base = (float *)alignPtr(slab.data, TENSOR_ALIGN_BYTES);
+	}
+
+	void FlatArena::release()
+	{
+		slab.release();
+		base = NULL;
+		total = 0;
+		offsets.clear();
+		shapes.clear();
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef _CONVNET_UTILITY_ARENA_H_
+#define _CONVNET_UTILITY_ARENA_H_
+#pragma once
+
+#include "tensor.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief one zero-filled float slab cut into Mat views
+	//
+	//	Every view starts on a TENSOR_ALIGN_BYTES line, the gaps
+	//	between views stay zero, so a pass over getMat() (zeroing,
+	//	norms, copies) sees all views at once.
+	//
+	// --------------------------------------------------------------
+	class FlatArena
+	{
+	public:
+		FlatArena() : base(NULL), total(0) {}
+
+		~FlatArena() {}
+
+		void create(const vector<Size> &shapes);
+
+		// views share the slab, they keep it alive after release()
+		inline Mat getView(const int i);
+
+		// the whole slab, [1 x total] including the gaps
+		inline Mat getMat();
+
+		inline int getNumViews();
+
+		inline bool empty();
+
+		void release();
+
+	private:
+		Mat slab;
+		float *base;
+		int total;
+		vector<int> offsets;
+		vector<Size> shapes;
+	};
+
+
+	inline Mat FlatArena::getView(const int i)
+	{
+		int start = (int)(base - (float *)slab.data) + offsets[i];
+		Mat view = slab.colRange(start, start + shapes[i].area());
+		return view.reshape(1, shapes[i].height);
+	}
+
+	inline Mat FlatArena::getMat()
+	{
+		int start = (int)(base - (float *)slab.data);
+		return slab.colRange(start, start + total);
+	}
+
+	inline int FlatArena::getNumViews()
+	{
+		return shapes.size();
+	}
+
+	inline bool FlatArena::empty()
+	{
+		return base == NULL;
+	}
+}
+
+#endif // arena.h
@@ -0,0 +1,368 @@
+#include "check.h"
+#include "blockedconv.h"
+#include <intrin.h>
+#include <string.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// output pixels per step of fprop, input channels per step of wgrad
+	enum { BLOCKED_STEP_PIXELS = 4, BLOCKED_STEP_CHNS = 4 };
+
+	static const int B = TENSOR_BLOCK_CHNS;
+	static const int BB = TENSOR_BLOCK_CHNS * TENSOR_BLOCK_CHNS;
+
+
+	bool BlockedConv::isSupported(const WeightGeometry &wparams)
+	{
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		return wparams.numGroups == 1 ||
+			   (wparams.weightChns % B == 0 && groupWeights % B == 0);
+	}
+
+	void BlockedConv::init(const WeightGeometry &wparams,
+						   const StrideGeometry &strides,
+						   const PadGeometry &padding,
+						   const int numImages,
+						   const int inChns,
+						   const int inRows,
+						   const int inCols,
+						   const int ouRows,
+						   const int ouCols)
+	{
+		this->wparams = wparams;
+		this->strides = strides;
+		this->padding = padding;
+		this->numImages = numImages;
+		this->inChns = inChns;
+		this->inRows = inRows;
+		this->inCols = inCols;
+		this->ouRows = ouRows;
+		this->ouCols = ouCols;
+
+		padRows = inRows + padding.top + padding.bottom;
+		padCols = inCols + padding.left + padding.right;
+
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		groupInBlocks = (wparams.weightChns + B - 1) / B;
+		groupOuBlocks = (groupWeights + B - 1) / B;
+
+		int numTaps = wparams.height * wparams.width;
+		packedWeights = Mat::zeros(wparams.numGroups * groupOuBlocks,
+								   groupInBlocks * numTaps * BB, CV_32FC1);
+
+		int inBlocks = (inChns + B - 1) / B;
+		int padDims = inBlocks * padRows * padCols * B;
+		paddedImages = Mat::zeros(numImages, padDims, CV_32FC1);
+
+	#ifdef _OPENMP
+		int numThreads = omp_get_max_threads();
+	#else
+		int numThreads = 1;
+	#endif
+		paddedDeltas.resize(numThreads);
+		for (int t = 0; t < numThreads; ++t)
+			paddedDeltas[t] = Mat::zeros(1, padDims, CV_32FC1);
+	}
+
+	void BlockedConv::fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+							const Mat3D &weights, const Mat &bias)
+	{
+		packWeights(weights, false);
+		padImages(inFeatMaps);
+
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numOuBlocks = packedWeights.rows;
+		int winHeight = wparams.height;
+		int winWidth = wparams.width;
+		int stepRow = strides.stepRow;
+		int stepCol = strides.stepCol;
+		const float *biasPtr = bias.empty() ? NULL : CV_MAT_PRF(bias);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int t = 0; t < numImages * numOuBlocks; ++t) {
+			int i = t / numOuBlocks;
+			int ob = t % numOuBlocks;
+			int g = ob / groupOuBlocks;
+			int kb = ob % groupOuBlocks;
+			const float *image = paddedImages.ptr<float>(i) +
+								 g * groupInBlocks * padRows * padCols * B;
+			const float *taps = packedWeights.ptr<float>(ob);
+			float *ouPtr = ouFeatMaps.ptr(i, ob);
+
+			float blockBias[TENSOR_BLOCK_CHNS] = { 0 };
+			for (int ko = 0; ko < min(B, groupWeights - kb * B) && biasPtr != NULL; ++ko)
+				blockBias[ko] = biasPtr[g * groupWeights + kb * B + ko];
+			__m128 bias0 = _mm_loadu_ps(blockBias);
+			__m128 bias1 = _mm_loadu_ps(blockBias + 4);
+
+			for (int y = 0; y < ouRows; ++y) {
+				for (int x = 0; x < ouCols; x += BLOCKED_STEP_PIXELS) {
+					int numPixels = min((int)BLOCKED_STEP_PIXELS, ouCols - x);
+					__m128 acc[BLOCKED_STEP_PIXELS][2];
+					for (int p = 0; p < BLOCKED_STEP_PIXELS; ++p) {
+						acc[p][0] = bias0;
+						acc[p][1] = bias1;
+					}
+
+					for (int cb = 0; cb < groupInBlocks; ++cb) {
+						int numChns = min(B, wparams.weightChns - cb * B);
+						for (int kr = 0; kr < winHeight; ++kr) {
+							const float *row = image + ((cb * padRows + y * stepRow + kr) *
+														padCols + x * stepCol) * B;
+							for (int kc = 0; kc < winWidth; ++kc) {
+								const float *src = row + kc * B;
+								const float *w = taps + ((cb * winHeight + kr) * winWidth + kc) * BB;
+								for (int ci = 0; ci < numChns; ++ci, w += B) {
+									__m128 w0 = _mm_loadu_ps(w);
+									__m128 w1 = _mm_loadu_ps(w + 4);
+									for (int p = 0; p < numPixels; ++p) {
+										__m128 in = _mm_set1_ps(src[p * stepCol * B + ci]);
+										acc[p][0] = _mm_add_ps(acc[p][0], _mm_mul_ps(in, w0));
+										acc[p][1] = _mm_add_ps(acc[p][1], _mm_mul_ps(in, w1));
+									}
+								}
+							}
+						}
+					}
+
+					float *dst = ouPtr + (y * ouCols + x) * B;
+					for (int p = 0; p < numPixels; ++p) {
+						_mm_storeu_ps(dst + p * B, acc[p][0]);
+						_mm_storeu_ps(dst + p * B + 4, acc[p][1]);
+					}
+				}
+			}
+		}
+	}
+
+	void BlockedConv::bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+								   const Tensor &inFeatMaps, const bool isInputCached)
+	{
+		if (!isInputCached)
+			padImages(inFeatMaps);
+
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numOuBlocks = packedWeights.rows;
+		int winHeight = wparams.height;
+		int winWidth = wparams.width;
+		int numTaps = winHeight * winWidth;
+		int stepRow = strides.stepRow;
+		int stepCol = strides.stepCol;
+
+		// one (output block, input block) pair of a group per task
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int t = 0; t < numOuBlocks * groupInBlocks; ++t) {
+			int ob = t / groupInBlocks;
+			int cb = t % groupInBlocks;
+			int g = ob / groupOuBlocks;
+			int kb = ob % groupOuBlocks;
+			int numWeights = min(B, groupWeights - kb * B);
+			int numChns = min(B, wparams.weightChns - cb * B);
+			int imageOffset = (g * groupInBlocks + cb) * padRows * padCols * B;
+			float tile[BLOCKED_STEP_CHNS * TENSOR_BLOCK_CHNS];
+
+			for (int kr = 0; kr < winHeight; ++kr) {
+				for (int kc = 0; kc < winWidth; ++kc) {
+					for (int c0 = 0; c0 < numChns; c0 += BLOCKED_STEP_CHNS) {
+						__m128 acc[BLOCKED_STEP_CHNS][2];
+						for (int q = 0; q < BLOCKED_STEP_CHNS; ++q)
+							acc[q][0] = acc[q][1] = _mm_setzero_ps();
+
+						for (int i = 0; i < numImages; ++i) {
+							const float *image = paddedImages.ptr<float>(i) + imageOffset;
+							const float *delta = currLayerDelta.ptr(i, ob);
+							for (int y = 0; y < ouRows; ++y) {
+								const float *src = image + ((y * stepRow + kr) * padCols + kc) * B + c0;
+								const float *dy = delta + y * ouCols * B;
+								for (int x = 0; x < ouCols; ++x, src += stepCol * B, dy += B) {
+									__m128 d0 = _mm_loadu_ps(dy);
+									__m128 d1 = _mm_loadu_ps(dy + 4);
+									for (int q = 0; q < BLOCKED_STEP_CHNS; ++q) {
+										__m128 in = _mm_set1_ps(src[q]);
+										acc[q][0] = _mm_add_ps(acc[q][0], _mm_mul_ps(in, d0));
+										acc[q][1] = _mm_add_ps(acc[q][1], _mm_mul_ps(in, d1));
+									}
+								}
+							}
+						}
+
+						for (int q = 0; q < BLOCKED_STEP_CHNS; ++q) {
+							_mm_storeu_ps(tile + q * B, acc[q][0]);
+							_mm_storeu_ps(tile + q * B + 4, acc[q][1]);
+						}
+
+						int tap = kr * winWidth + kc;
+						for (int q = 0; q < min((int)BLOCKED_STEP_CHNS, numChns - c0); ++q) {
+							int c = cb * B + c0 + q;
+							for (int ko = 0; ko < numWeights; ++ko)
+								weightGrads[g].at<float>(kb * B + ko, c * numTaps + tap) = tile[q * B + ko];
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void BlockedConv::bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+								const Mat3D &weights)
+	{
+		packWeights(weights, true);
+
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numOuBlocks = packedWeights.rows;
+		int inBlocks = prevLayerDelta.getChnBlocks();
+		int winHeight = wparams.height;
+		int winWidth = wparams.width;
+		int stepRow = strides.stepRow;
+		int stepCol = strides.stepCol;
+
+		// no more threads than padded buffers made by init()
+		#ifdef _OPENMP
+		#pragma omp parallel for num_threads((int)paddedDeltas.size())
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+		#ifdef _OPENMP
+			float *buffer = CV_MAT_PRF(paddedDeltas[omp_get_thread_num()]);
+		#else
+			float *buffer = CV_MAT_PRF(paddedDeltas[0]);
+		#endif
+			memset(buffer, 0, paddedDeltas[0].cols * sizeof(float));
+
+			// every output pixel scatters into the padded input pixels it saw
+			for (int ob = 0; ob < numOuBlocks; ++ob) {
+				int g = ob / groupOuBlocks;
+				int kb = ob % groupOuBlocks;
+				int numWeights = min(B, groupWeights - kb * B);
+				const float *taps = packedWeights.ptr<float>(ob);
+				const float *delta = currLayerDelta.ptr(i, ob);
+				float *image = buffer + g * groupInBlocks * padRows * padCols * B;
+
+				for (int y = 0; y < ouRows; ++y) {
+					for (int x = 0; x < ouCols; ++x) {
+						const float *dy = delta + (y * ouCols + x) * B;
+						for (int cb = 0; cb < groupInBlocks; ++cb) {
+							for (int kr = 0; kr < winHeight; ++kr) {
+								float *dst = image + ((cb * padRows + y * stepRow + kr) *
+													  padCols + x * stepCol) * B;
+								for (int kc = 0; kc < winWidth; ++kc, dst += B) {
+									const float *w = taps + ((cb * winHeight + kr) * winWidth + kc) * BB;
+									__m128 acc0 = _mm_loadu_ps(dst);
+									__m128 acc1 = _mm_loadu_ps(dst + 4);
+									for (int ko = 0; ko < numWeights; ++ko, w += B) {
+										__m128 d = _mm_set1_ps(dy[ko]);
+										acc0 = _mm_add_ps(acc0, _mm_mul_ps(d, _mm_loadu_ps(w)));
+										acc1 = _mm_add_ps(acc1, _mm_mul_ps(d, _mm_loadu_ps(w + 4)));
+									}
+									_mm_storeu_ps(dst, acc0);
+									_mm_storeu_ps(dst + 4, acc1);
+								}
+							}
+						}
+					}
+				}
+			}
+
+			// crop the padding
+			for (int b = 0; b < inBlocks; ++b) {
+				float *dst = prevLayerDelta.ptr(i, b);
+				const float *src = buffer + ((b * padRows + padding.top) * padCols + padding.left) * B;
+				for (int r = 0; r < inRows; ++r)
+					memcpy(dst + r * inCols * B, src + r * padCols * B, inCols * B * sizeof(float));
+			}
+		}
+	}
+
+	void BlockedConv::bpropBias(Mat &biasGrads, const Tensor &currLayerDelta)
+	{
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numOuBlocks = currLayerDelta.getChnBlocks();
+		int ouDims = currLayerDelta.getMapDims();
+		float *biasGradPtr = CV_MAT_PRF(biasGrads);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int ob = 0; ob < numOuBlocks; ++ob) {
+			__m128 acc0 = _mm_setzero_ps();
+			__m128 acc1 = _mm_setzero_ps();
+			for (int i = 0; i < currLayerDelta.size(); ++i) {
+				const float *dy = currLayerDelta.ptr(i, ob);
+				for (int p = 0; p < ouDims; ++p, dy += B) {
+					acc0 = _mm_add_ps(acc0, _mm_loadu_ps(dy));
+					acc1 = _mm_add_ps(acc1, _mm_loadu_ps(dy + 4));
+				}
+			}
+
+			float sums[TENSOR_BLOCK_CHNS];
+			_mm_storeu_ps(sums, acc0);
+			_mm_storeu_ps(sums + 4, acc1);
+
+			int g = ob / groupOuBlocks;
+			int kb = ob % groupOuBlocks;
+			for (int ko = 0; ko < min(B, groupWeights - kb * B); ++ko)
+				biasGradPtr[g * groupWeights + kb * B + ko] = sums[ko];
+		}
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+
+	// the borders of the buffers stay zero
+	void BlockedConv::padImages(const Tensor &inFeatMaps)
+	{
+		int inBlocks = inFeatMaps.getChnBlocks();
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float *image = paddedImages.ptr<float>(i);
+			for (int b = 0; b < inBlocks; ++b) {
+				const float *src = inFeatMaps.ptr(i, b);
+				float *dst = image + ((b * padRows + padding.top) * padCols + padding.left) * B;
+				for (int r = 0; r < inRows; ++r)
+					memcpy(dst + r * padCols * B, src + r * inCols * B, inCols * B * sizeof(float));
+			}
+		}
+	}
+
+	// [8 in][8 out] per tap, or [8 out][8 in] for dgrad
+	void BlockedConv::packWeights(const Mat3D &weights, const bool isTransposed)
+	{
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numTaps = wparams.height * wparams.width;
+
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int k = 0; k < groupWeights; ++k) {
+				const float *src = weights[g].ptr<float>(k);
+				float *dst = packedWeights.ptr<float>(g * groupOuBlocks + k / B);
+				int ko = k % B;
+				for (int c = 0; c < wparams.weightChns; ++c) {
+					int ci = c % B;
+					int offset = isTransposed ? ko * B + ci : ci * B + ko;
+					for (int tap = 0; tap < numTaps; ++tap)
+						dst[((c / B) * numTaps + tap) * BB + offset] = src[c * numTaps + tap];
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,103 @@
+#ifndef _CONVNET_UTILITY_BLOCKEDCONV_H_
+#define _CONVNET_UTILITY_BLOCKEDCONV_H_
+#pragma once
+
+#include "types.h"
+#include "tensor.h"
+#include "param.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief convolution of TENSOR_NCHW8C maps into TENSOR_NCHW8C
+	//		  maps
+	//
+	//	A pixel of a channel block is 8 adjacent floats, so every
+	//	tap is one broadcast of an input channel times one load of
+	//	the 8 output channels' weights, and stores go straight to
+	//	the output block without scattering rows of a gemm result.
+	//	An 8-wide block is two SSE registers; the inner loop keeps
+	//	4 output pixels x 8 output channels in 8 accumulators.
+	//
+	//	Weights are packed per output block as [in block][kh][kw]
+	//	[8 in][8 out] for fprop / wgrad and [..][8 out][8 in] for
+	//	dgrad, channels past the end of a group are zero. Groups
+	//	have to start on a block, i.e. grouped layers need multiples
+	//	of 8 channels per group on both sides.
+	//
+	// --------------------------------------------------------------
+	class BlockedConv
+	{
+	public:
+		BlockedConv() {}
+
+		~BlockedConv() {}
+
+		static bool isSupported(const WeightGeometry &wparams);
+
+		void init(const WeightGeometry &wparams,
+				  const StrideGeometry &strides,
+				  const PadGeometry &padding,
+				  const int numImages,
+				  const int inChns,
+				  const int inRows,
+				  const int inCols,
+				  const int ouRows,
+				  const int ouCols);
+
+		void fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+				   const Mat3D &weights, const Mat &bias);
+
+		// isInputCached: fprop left the padded inputs
+		void bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+						  const Tensor &inFeatMaps, const bool isInputCached);
+
+		void bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+					   const Mat3D &weights);
+
+		// sums of the delta maps per output channel
+		void bpropBias(Mat &biasGrads, const Tensor &currLayerDelta);
+
+		// the padded deltas, cleared by each bpropData
+		inline void getWorkspaces(vector<Mat *> &workspaces);
+
+	private:
+		void padImages(const Tensor &inFeatMaps);
+
+		void packWeights(const Mat3D &weights, const bool isTransposed);
+
+	private:
+		Mat packedWeights; // [numWeights blocks] x [in blocks x kh x kw x 8 x 8]
+		Mat paddedImages;  // [numImages] x [inChns blocks x padRows x padCols x 8]
+		Mat3D paddedDeltas; // one [inChns blocks x padRows x padCols x 8] buffer per thread
+		WeightGeometry wparams;
+		StrideGeometry strides;
+		PadGeometry padding;
+
+		int numImages;
+		int inChns;
+		int inRows;
+		int inCols;
+		int ouRows;
+		int ouCols;
+		int padRows;
+		int padCols;
+		int groupInBlocks;
+		int groupOuBlocks;
+	};
+
+
+	inline void BlockedConv::getWorkspaces(vector<Mat *> &workspaces)
+	{
+		for (int t = 0; t < paddedDeltas.size(); ++t)
+			workspaces.push_back(&paddedDeltas[t]);
+	}
+}
+
+#endif // blockedconv.h
@@ -63,9 +63,9 @@ namespace convnet
 	{ \
 		argu::ASSERT(inFeatMaps.empty() == true, \
 					 " input feature maps should not be empty !\n"); \
-		argu::ASSERT(inFeatMaps[0].empty() == true, \
+		argu::ASSERT(inFeatMaps.getChns() <= 0, \
 					 " input feature maps do not have legal channels !\n"); \
-		argu::ASSERT(inFeatMaps[0][0].rows <= 0 || inFeatMaps[0][0].cols <= 0, \
+		argu::ASSERT(inFeatMaps.getRows() <= 0 || inFeatMaps.getCols() <= 0, \
 					 " input feature maps do not have values !\n");	\
 	}
 	#endif
@@ -86,9 +86,9 @@ namespace convnet
 	{ \
 		argu::ASSERT(ouFeatMaps.empty() == true, \
 				     " output feature maps should not be empty !\n"); \
-		argu::ASSERT(ouFeatMaps[0].empty() == true, \
+		argu::ASSERT(ouFeatMaps.getChns() <= 0, \
 					 " output feature maps do not have legal channels !\n"); \
-		argu::ASSERT(ouFeatMaps[0][0].rows <= 0 || inFeatMaps[0][0].cols <= 0, \
+		argu::ASSERT(ouFeatMaps.getRows() <= 0 || ouFeatMaps.getCols() <= 0, \
 					 " output feature maps do not have values !\n");	\
 	}
 	#endif
@@ -117,9 +117,9 @@ namespace convnet
 	{ \
 		argu::ASSERT(mask.empty() == true, \
 					 " mask should not be empty !\n"); \
-		argu::ASSERT(mask[0].empty() == true, \
+		argu::ASSERT(mask.getChns() <= 0, \
 					 " mask do not have legal channels !\n"); \
-		argu::ASSERT(mask[0][0].rows <= 0 || inFeatMaps[0][0].cols <= 0, \
+		argu::ASSERT(mask.getRows() <= 0 || mask.getCols() <= 0, \
 					 " mask do not have values !\n");	\
 	}
 	#endif
@@ -0,0 +1,199 @@
+#include "check.h"
+#include "directconv.h"
+#include <intrin.h>
+#include <string.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// output channels and output pixels updated per step
+	enum { DIRECT_BLOCK_CHNS = 4, DIRECT_BLOCK_PIXELS = 8 };
+
+	// ouPtrs[0 .. numChns) [ouRows x ouCols] = taps * padded image + bias
+	static void convolveBlock(float *const *ouPtrs, const int numChns,
+							  const float *image, const int chns,
+							  const int padRows, const int padCols,
+							  const int winHeight, const int winWidth,
+							  const int stepRow, const int ouRows, const int ouCols,
+							  const float *taps, const float *bias)
+	{
+		int padDims = padRows * padCols;
+		float tile[DIRECT_BLOCK_CHNS * DIRECT_BLOCK_PIXELS];
+
+		for (int y = 0; y < ouRows; ++y) {
+			for (int x = 0; x < ouCols; x += DIRECT_BLOCK_PIXELS) {
+				__m128 a00 = _mm_set1_ps(bias[0]), a01 = a00;
+				__m128 a10 = _mm_set1_ps(bias[1]), a11 = a10;
+				__m128 a20 = _mm_set1_ps(bias[2]), a21 = a20;
+				__m128 a30 = _mm_set1_ps(bias[3]), a31 = a30;
+
+				const float *tap = taps;
+				for (int c = 0; c < chns; ++c) {
+					const float *src = image + c * padDims + y * stepRow * padCols + x;
+					for (int kr = 0; kr < winHeight; ++kr, src += padCols) {
+						for (int kc = 0; kc < winWidth; ++kc, tap += DIRECT_BLOCK_CHNS) {
+							__m128 in0 = _mm_loadu_ps(src + kc);
+							__m128 in1 = _mm_loadu_ps(src + kc + 4);
+							__m128 w = _mm_loadu_ps(tap);
+							__m128 w0 = _mm_shuffle_ps(w, w, 0x00);
+							__m128 w1 = _mm_shuffle_ps(w, w, 0x55);
+							__m128 w2 = _mm_shuffle_ps(w, w, 0xAA);
+							__m128 w3 = _mm_shuffle_ps(w, w, 0xFF);
+							a00 = _mm_add_ps(a00, _mm_mul_ps(w0, in0));
+							a01 = _mm_add_ps(a01, _mm_mul_ps(w0, in1));
+							a10 = _mm_add_ps(a10, _mm_mul_ps(w1, in0));
+							a11 = _mm_add_ps(a11, _mm_mul_ps(w1, in1));
+							a20 = _mm_add_ps(a20, _mm_mul_ps(w2, in0));
+							a21 = _mm_add_ps(a21, _mm_mul_ps(w2, in1));
+							a30 = _mm_add_ps(a30, _mm_mul_ps(w3, in0));
+							a31 = _mm_add_ps(a31, _mm_mul_ps(w3, in1));
+						}
+					}
+				}
+
+				_mm_storeu_ps(tile, a00);
+				_mm_storeu_ps(tile + 4, a01);
+				_mm_storeu_ps(tile + 8, a10);
+				_mm_storeu_ps(tile + 12, a11);
+				_mm_storeu_ps(tile + 16, a20);
+				_mm_storeu_ps(tile + 20, a21);
+				_mm_storeu_ps(tile + 24, a30);
+				_mm_storeu_ps(tile + 28, a31);
+
+				int numPixels = min((int)DIRECT_BLOCK_PIXELS, ouCols - x);
+				for (int k = 0; k < numChns; ++k)
+					memcpy(ouPtrs[k] + y * ouCols + x, tile + k * DIRECT_BLOCK_PIXELS,
+						   numPixels * sizeof(float));
+			}
+		}
+	}
+
+
+	bool DirectConv::isSupported(const WeightGeometry &wparams,
+								 const StrideGeometry &strides)
+	{
+		return wparams.weightChns <= DIRECT_CONV_MAX_CHNS && strides.stepCol == 1;
+	}
+
+	void DirectConv::init(const WeightGeometry &wparams,
+						  const StrideGeometry &strides,
+						  const PadGeometry &padding,
+						  const int inChns,
+						  const int inRows,
+						  const int inCols,
+						  const int ouRows,
+						  const int ouCols)
+	{
+		this->wparams = wparams;
+		this->strides = strides;
+		this->padding = padding;
+		this->inChns = inChns;
+		this->inRows = inRows;
+		this->inCols = inCols;
+		this->ouRows = ouRows;
+		this->ouCols = ouCols;
+
+		// the last pixel block of a row may read up to 8 columns past the
+		// padded image
+		padRows = inRows + padding.top + padding.bottom;
+		padCols = inCols + padding.left + padding.right + DIRECT_BLOCK_PIXELS;
+
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numBlocks = (groupWeights + DIRECT_BLOCK_CHNS - 1) / DIRECT_BLOCK_CHNS;
+		int numTaps = wparams.weightChns * wparams.height * wparams.width;
+		packedWeights = Mat::zeros(wparams.numGroups * numBlocks, numTaps * DIRECT_BLOCK_CHNS, CV_32FC1);
+
+	#ifdef _OPENMP
+		int numThreads = omp_get_max_threads();
+	#else
+		int numThreads = 1;
+	#endif
+		paddedImages.resize(numThreads);
+		for (int t = 0; t < numThreads; ++t)
+			paddedImages[t] = Mat::zeros(inChns * padRows, padCols, CV_32FC1);
+	}
+
+	void DirectConv::fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+						   const Mat3D &weights, const Mat &bias)
+	{
+		packWeights(weights);
+
+		int numImages = inFeatMaps.size();
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		int numBlocks = packedWeights.rows / wparams.numGroups;
+		int padDims = padRows * padCols;
+		const float *biasPtr = bias.empty() ? NULL : CV_MAT_PRF(bias);
+
+		// no more threads than padded buffers made by init()
+		#ifdef _OPENMP
+		#pragma omp parallel for num_threads((int)paddedImages.size())
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+		#ifdef _OPENMP
+			float *image = CV_MAT_PRF(paddedImages[omp_get_thread_num()]);
+		#else
+			float *image = CV_MAT_PRF(paddedImages[0]);
+		#endif
+
+			// the borders of the buffer stay zero
+			for (int ch = 0; ch < inChns; ++ch) {
+				const float *src = CV_MAT_PRF(inFeatMaps[i][ch]);
+				float *dst = image + ch * padDims + padding.top * padCols + padding.left;
+				for (int r = 0; r < inRows; ++r)
+					memcpy(dst + r * padCols, src + r * inCols, inCols * sizeof(float));
+			}
+
+			for (int g = 0; g < wparams.numGroups; ++g) {
+				for (int b = 0; b < numBlocks; ++b) {
+					int k0 = g * groupWeights + b * DIRECT_BLOCK_CHNS;
+					int numChns = min((int)DIRECT_BLOCK_CHNS, groupWeights - b * DIRECT_BLOCK_CHNS);
+
+					float *ouPtrs[DIRECT_BLOCK_CHNS];
+					float blockBias[DIRECT_BLOCK_CHNS] = { 0 };
+					for (int k = 0; k < numChns; ++k) {
+						ouPtrs[k] = CV_MAT_PRF(ouFeatMaps[i][k0 + k]);
+						blockBias[k] = biasPtr == NULL ? 0 : biasPtr[k0 + k];
+					}
+
+					convolveBlock(ouPtrs, numChns, image + g * groupChns * padDims, groupChns,
+								  padRows, padCols, wparams.height, wparams.width,
+								  strides.stepRow, ouRows, ouCols,
+								  packedWeights.ptr<float>(g * numBlocks + b), blockBias);
+				}
+			}
+		}
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+
+	// taps of 4 consecutive output channels side by side, channels past
+	// the end of a group stay zero
+	void DirectConv::packWeights(const Mat3D &weights)
+	{
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int numBlocks = packedWeights.rows / wparams.numGroups;
+		int numTaps = weights[0].cols;
+
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int k = 0; k < groupWeights; ++k) {
+				const float *src = weights[g].ptr<float>(k);
+				float *dst = packedWeights.ptr<float>(g * numBlocks + k / DIRECT_BLOCK_CHNS) +
+							 k % DIRECT_BLOCK_CHNS;
+				for (int d = 0; d < numTaps; ++d)
+					dst[d * DIRECT_BLOCK_CHNS] = src[d];
+			}
+		}
+	}
+}
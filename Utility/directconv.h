@@ -0,0 +1,74 @@
+#ifndef _CONVNET_UTILITY_DIRECTCONV_H_
+#define _CONVNET_UTILITY_DIRECTCONV_H_
+#pragma once
+
+#include "types.h"
+#include "tensor.h"
+#include "param.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// layers with at most this many channels per weight go direct
+	enum { DIRECT_CONV_MAX_CHNS = 4 };
+
+	// --------------------------------------------------------------
+	//
+	// @brief direct SSE convolution (forward only) for layers with
+	//		  few input channels, e.g. conv1 on gray / rgb images
+	//
+	//	With weightChns * wh * ww as small as 25 or 75 a gemm is
+	//	bound by packing its operands. Here every image is copied
+	//	once into a zero-padded buffer and each step of the inner
+	//	loop updates 4 output channels x 8 adjacent output pixels
+	//	(8 SSE accumulators) from two unaligned input loads and one
+	//	load of the 4 channels' taps, pre-arranged per tap.
+	//
+	// --------------------------------------------------------------
+	class DirectConv
+	{
+	public:
+		DirectConv() {}
+
+		~DirectConv() {}
+
+		static bool isSupported(const WeightGeometry &wparams,
+								const StrideGeometry &strides);
+
+		void init(const WeightGeometry &wparams,
+				  const StrideGeometry &strides,
+				  const PadGeometry &padding,
+				  const int inChns,
+				  const int inRows,
+				  const int inCols,
+				  const int ouRows,
+				  const int ouCols);
+
+		void fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+				   const Mat3D &weights, const Mat &bias);
+
+	private:
+		void packWeights(const Mat3D &weights);
+
+	private:
+		Mat packedWeights; // [groups x ceil(groupWeights / 4)] x [taps x 4]
+		Mat3D paddedImages; // one [inChns x padRows x padCols] buffer per thread
+		WeightGeometry wparams;
+		StrideGeometry strides;
+		PadGeometry padding;
+
+		int inChns;
+		int inRows;
+		int inCols;
+		int ouRows;
+		int ouCols;
+		int padRows;
+		int padCols;
+	};
+}
+
+#endif // directconv.h
@@ -0,0 +1,372 @@
+#include "check.h"
+#include "sgemm.h"
+#include "fftconv.h"
+#include <string.h>
+#include <opencv2/core/core.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// C = op(A) * op(B) on split real / imaginary planes, A is conjugated
+	// when conjA is set
+	static void complexMatMul(const bool transA, const bool transB, const bool conjA,
+							  const int M, const int N, const int K,
+							  const float *ARe, const float *AIm, const int lda,
+							  const float *BRe, const float *BIm, const int ldb,
+							  float *CRe, float *CIm, const int ldc)
+	{
+		float s = conjA ? 1.0f : -1.0f;
+		sgemm(transA, transB, M, N, K, 1.0f, ARe, lda, BRe, ldb, 0.0f, CRe, ldc);
+		sgemm(transA, transB, M, N, K, s, AIm, lda, BIm, ldb, 1.0f, CRe, ldc);
+		sgemm(transA, transB, M, N, K, 1.0f, ARe, lda, BIm, ldb, 0.0f, CIm, ldc);
+		sgemm(transA, transB, M, N, K, -s, AIm, lda, BRe, ldb, 1.0f, CIm, ldc);
+	}
+
+
+	bool FFTConv::isSupported(const WeightGeometry &wparams,
+							  const StrideGeometry &strides)
+	{
+		return wparams.width >= 5 && wparams.height >= 5 &&
+			   strides.stepRow == 1 && strides.stepCol == 1;
+	}
+
+	void FFTConv::init(const WeightGeometry &wparams,
+					   const PadGeometry &padding,
+					   const int numImages,
+					   const int inChns,
+					   const int inRows,
+					   const int inCols,
+					   const int ouRows,
+					   const int ouCols)
+	{
+		this->wparams = wparams;
+		this->padding = padding;
+		this->numImages = numImages;
+		this->inChns = inChns;
+		this->inRows = inRows;
+		this->inCols = inCols;
+		this->ouRows = ouRows;
+		this->ouCols = ouCols;
+
+		// the padded input fits into the grid, so neither the correlation
+		// nor the full convolution of dz/dx wraps around
+		fftRows = getOptimalDFTSize(inRows + padding.top + padding.bottom);
+		fftCols = getOptimalDFTSize(inCols + padding.left + padding.right);
+		specCols = fftCols / 2 + 1;
+		numBins = fftRows * specCols;
+
+		int groupChns = wparams.weightChns;
+		WRe = Mat::zeros(numBins * wparams.numWeights, groupChns, CV_32FC1);
+		WIm = Mat::zeros(WRe.size(), CV_32FC1);
+		dWRe = Mat::zeros(WRe.size(), CV_32FC1);
+		dWIm = Mat::zeros(WRe.size(), CV_32FC1);
+		XRe = Mat::zeros(numBins * inChns, numImages, CV_32FC1);
+		XIm = Mat::zeros(XRe.size(), CV_32FC1);
+		YRe = Mat::zeros(numBins * wparams.numWeights, numImages, CV_32FC1);
+		YIm = Mat::zeros(YRe.size(), CV_32FC1);
+		isFilterStale = true;
+	}
+
+	void FFTConv::fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+						const Mat3D &weights, const Mat &bias)
+	{
+		if (isFilterStale) {
+			transformFilters(weights);
+			isFilterStale = false;
+		}
+
+		transformInputs(inFeatMaps);
+
+		// Y(f, g) = conj(W(f, g)) * X(f, g) at every frequency bin f
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		const float *WRePtr = CV_MAT_PRF(WRe), *WImPtr = CV_MAT_PRF(WIm);
+		const float *XRePtr = CV_MAT_PRF(XRe), *XImPtr = CV_MAT_PRF(XIm);
+		float *YRePtr = CV_MAT_PRF(YRe), *YImPtr = CV_MAT_PRF(YIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int f = 0; f < numBins; ++f) {
+			for (int g = 0; g < wparams.numGroups; ++g) {
+				int wOffset = (f * numWeights + g * groupWeights) * groupChns;
+				int xOffset = (f * inChns + g * groupChns) * numImages;
+				int yOffset = (f * numWeights + g * groupWeights) * numImages;
+				complexMatMul(false, false, true, groupWeights, numImages, groupChns,
+							  WRePtr + wOffset, WImPtr + wOffset, groupChns,
+							  XRePtr + xOffset, XImPtr + xOffset, numImages,
+							  YRePtr + yOffset, YImPtr + yOffset, numImages);
+			}
+		}
+
+		transformOutputs(ouFeatMaps, bias);
+	}
+
+	void FFTConv::bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+							   const Tensor &inFeatMaps, const bool isInputCached)
+	{
+		if (!isInputCached)
+			transformInputs(inFeatMaps);
+		transformDeltas(currLayerDelta);
+
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		const float *XRePtr = CV_MAT_PRF(XRe), *XImPtr = CV_MAT_PRF(XIm);
+		const float *YRePtr = CV_MAT_PRF(YRe), *YImPtr = CV_MAT_PRF(YIm);
+		float *dWRePtr = CV_MAT_PRF(dWRe), *dWImPtr = CV_MAT_PRF(dWIm);
+
+		// dW(f, g) = conj(dY(f, g)) * X(f, g)^T
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int f = 0; f < numBins; ++f) {
+			for (int g = 0; g < wparams.numGroups; ++g) {
+				int wOffset = (f * numWeights + g * groupWeights) * groupChns;
+				int xOffset = (f * inChns + g * groupChns) * numImages;
+				int yOffset = (f * numWeights + g * groupWeights) * numImages;
+				complexMatMul(false, true, true, groupWeights, groupChns, numImages,
+							  YRePtr + yOffset, YImPtr + yOffset, numImages,
+							  XRePtr + xOffset, XImPtr + xOffset, numImages,
+							  dWRePtr + wOffset, dWImPtr + wOffset, groupChns);
+			}
+		}
+
+		untransformFilterGrads(weightGrads);
+	}
+
+	void FFTConv::bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+							const Mat3D &weights, const bool isDeltaCached)
+	{
+		if (isFilterStale) {
+			transformFilters(weights);
+			isFilterStale = false;
+		}
+		if (!isDeltaCached)
+			transformDeltas(currLayerDelta);
+
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		const float *WRePtr = CV_MAT_PRF(WRe), *WImPtr = CV_MAT_PRF(WIm);
+		const float *YRePtr = CV_MAT_PRF(YRe), *YImPtr = CV_MAT_PRF(YIm);
+		float *XRePtr = CV_MAT_PRF(XRe), *XImPtr = CV_MAT_PRF(XIm);
+
+		// dX(f, g) = W(f, g)^T * dY(f, g), written over X
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int f = 0; f < numBins; ++f) {
+			for (int g = 0; g < wparams.numGroups; ++g) {
+				int wOffset = (f * numWeights + g * groupWeights) * groupChns;
+				int xOffset = (f * inChns + g * groupChns) * numImages;
+				int yOffset = (f * numWeights + g * groupWeights) * numImages;
+				complexMatMul(true, false, false, groupChns, numImages, groupWeights,
+							  WRePtr + wOffset, WImPtr + wOffset, groupChns,
+							  YRePtr + yOffset, YImPtr + yOffset, numImages,
+							  XRePtr + xOffset, XImPtr + xOffset, numImages);
+			}
+		}
+
+		untransformInputGrads(prevLayerDelta);
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+	void FFTConv::forwardSpectrum(float *dstRe, float *dstIm, const int binStep,
+								  Mat &buffer, Mat &spectrum, const float *src,
+								  const int rows, const int cols, const int ld,
+								  const int offRow, const int offCol)
+	{
+		buffer.setTo(0);
+		for (int r = 0; r < rows; ++r)
+			memcpy(buffer.ptr<float>(offRow + r) + offCol, src + r * ld, cols * sizeof(float));
+
+		dft(buffer, spectrum, DFT_COMPLEX_OUTPUT);
+
+		for (int u = 0; u < fftRows; ++u) {
+			const float *s = spectrum.ptr<float>(u);
+			for (int v = 0; v < specCols; ++v) {
+				int f = u * specCols + v;
+				dstRe[f * binStep] = s[2 * v];
+				dstIm[f * binStep] = s[2 * v + 1];
+			}
+		}
+	}
+
+	void FFTConv::inverseSpectrum(Mat &buffer, Mat &spectrum, const float *srcRe,
+								  const float *srcIm, const int binStep)
+	{
+		// the dropped columns follow from hermitian symmetry
+		for (int u = 0; u < fftRows; ++u) {
+			float *s = spectrum.ptr<float>(u);
+			for (int v = 0; v < specCols; ++v) {
+				int f = u * specCols + v;
+				s[2 * v] = srcRe[f * binStep];
+				s[2 * v + 1] = srcIm[f * binStep];
+			}
+			int um = (fftRows - u) % fftRows;
+			for (int v = specCols; v < fftCols; ++v) {
+				int f = um * specCols + (fftCols - v);
+				s[2 * v] = srcRe[f * binStep];
+				s[2 * v + 1] = -srcIm[f * binStep];
+			}
+		}
+
+		dft(spectrum, buffer, DFT_INVERSE | DFT_SCALE | DFT_REAL_OUTPUT);
+	}
+
+	void FFTConv::transformFilters(const Mat3D &weights)
+	{
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		int winDims = wparams.height * wparams.width;
+		float *WRePtr = CV_MAT_PRF(WRe), *WImPtr = CV_MAT_PRF(WIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int k = 0; k < numWeights; ++k) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			const Mat &w = weights[k / groupWeights];
+			const float *wPtr = CV_MAT_PRF(w) + (k % groupWeights) * w.cols;
+			for (int c = 0; c < groupChns; ++c) {
+				forwardSpectrum(WRePtr + k * groupChns + c, WImPtr + k * groupChns + c,
+								numWeights * groupChns, buffer, spectrum, wPtr + c * winDims,
+								wparams.height, wparams.width, wparams.width, 0, 0);
+			}
+		}
+	}
+
+	void FFTConv::transformInputs(const Tensor &inFeatMaps)
+	{
+		float *XRePtr = CV_MAT_PRF(XRe), *XImPtr = CV_MAT_PRF(XIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			for (int c = 0; c < inChns; ++c) {
+				forwardSpectrum(XRePtr + c * numImages + i, XImPtr + c * numImages + i,
+								inChns * numImages, buffer, spectrum, CV_MAT_PRF(inFeatMaps[i][c]),
+								inRows, inCols, inCols, padding.top, padding.left);
+			}
+		}
+	}
+
+	void FFTConv::transformOutputs(Tensor &ouFeatMaps, const Mat &bias)
+	{
+		int numWeights = wparams.numWeights;
+		const float *YRePtr = CV_MAT_PRF(YRe), *YImPtr = CV_MAT_PRF(YIm);
+		const float *biasPtr = bias.empty() ? NULL : CV_MAT_PRF(bias);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			for (int k = 0; k < numWeights; ++k) {
+				inverseSpectrum(buffer, spectrum, YRePtr + k * numImages + i,
+								YImPtr + k * numImages + i, numWeights * numImages);
+
+				float b = biasPtr == NULL ? 0 : biasPtr[k];
+				float *ouMapPtr = CV_MAT_PRF(ouFeatMaps[i][k]);
+				for (int r = 0; r < ouRows; ++r) {
+					const float *src = buffer.ptr<float>(r);
+					for (int c = 0; c < ouCols; ++c)
+						CV_MAT_AT(ouMapPtr, r, c, ouCols) = src[c] + b;
+				}
+			}
+		}
+	}
+
+	void FFTConv::transformDeltas(const Tensor &currLayerDelta)
+	{
+		int numWeights = wparams.numWeights;
+		float *YRePtr = CV_MAT_PRF(YRe), *YImPtr = CV_MAT_PRF(YIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			for (int k = 0; k < numWeights; ++k) {
+				forwardSpectrum(YRePtr + k * numImages + i, YImPtr + k * numImages + i,
+								numWeights * numImages, buffer, spectrum,
+								CV_MAT_PRF(currLayerDelta[i][k]), ouRows, ouCols, ouCols, 0, 0);
+			}
+		}
+	}
+
+	void FFTConv::untransformFilterGrads(Mat3D &weightGrads)
+	{
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		int winDims = wparams.height * wparams.width;
+		const float *dWRePtr = CV_MAT_PRF(dWRe), *dWImPtr = CV_MAT_PRF(dWIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int k = 0; k < numWeights; ++k) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			Mat &dw = weightGrads[k / groupWeights];
+			float *dwPtr = CV_MAT_PRF(dw) + (k % groupWeights) * dw.cols;
+			for (int c = 0; c < groupChns; ++c) {
+				inverseSpectrum(buffer, spectrum, dWRePtr + k * groupChns + c,
+								dWImPtr + k * groupChns + c, numWeights * groupChns);
+				for (int r = 0; r < wparams.height; ++r)
+					memcpy(dwPtr + c * winDims + r * wparams.width, buffer.ptr<float>(r),
+						   wparams.width * sizeof(float));
+			}
+		}
+	}
+
+	void FFTConv::untransformInputGrads(Tensor &prevLayerDelta)
+	{
+		const float *XRePtr = CV_MAT_PRF(XRe), *XImPtr = CV_MAT_PRF(XIm);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			Mat buffer(fftRows, fftCols, CV_32FC1);
+			Mat spectrum(fftRows, fftCols, CV_32FC2);
+			for (int c = 0; c < inChns; ++c) {
+				inverseSpectrum(buffer, spectrum, XRePtr + c * numImages + i,
+								XImPtr + c * numImages + i, inChns * numImages);
+
+				// crop the padding away
+				float *deltaPtr = CV_MAT_PRF(prevLayerDelta[i][c]);
+				for (int r = 0; r < inRows; ++r)
+					memcpy(deltaPtr + r * inCols, buffer.ptr<float>(padding.top + r) + padding.left,
+						   inCols * sizeof(float));
+			}
+		}
+	}
+}
@@ -0,0 +1,141 @@
+#ifndef _CONVNET_UTILITY_FFTCONV_H_
+#define _CONVNET_UTILITY_FFTCONV_H_
+#pragma once
+
+#include "types.h"
+#include "tensor.h"
+#include "param.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief FFT based convolution for stride-1 layers with large
+	//		  (5 x 5 and up) weights
+	//
+	//	Padded inputs, weights and deltas are transformed once onto
+	//	a common fftRows x fftCols grid, large enough that no
+	//	circular wrap-around reaches the valid outputs. Only the
+	//	fftCols / 2 + 1 non-redundant columns of each real spectrum
+	//	are kept, split into real and imaginary planes laid out as
+	//	[bin x channel x image], so that the channel mixing at every
+	//	frequency bin is one complex matrix multiplication per group:
+	//
+	//		fprop: Y  = conj(W) * X
+	//		wgrad: dW = conj(dY) * X^T
+	//		dgrad: dX = W^T * dY
+	//
+	//	The weight spectra are cached until setFilterStale() and
+	//	the input spectra of fprop are reused by wgrad when both
+	//	passes run on this engine.
+	//
+	// --------------------------------------------------------------
+	class FFTConv
+	{
+	public:
+		FFTConv() : isFilterStale(true) {}
+
+		~FFTConv() {}
+
+		static bool isSupported(const WeightGeometry &wparams,
+								const StrideGeometry &strides);
+
+		void init(const WeightGeometry &wparams,
+				  const PadGeometry &padding,
+				  const int numImages,
+				  const int inChns,
+				  const int inRows,
+				  const int inCols,
+				  const int ouRows,
+				  const int ouCols);
+
+		// weight spectra are recomputed on next fprop
+		inline void setFilterStale();
+
+		// buffers written before they are read in each pass, i.e. free
+		// between fprop and bprop; X only if bpropWeights rebuilds it
+		inline void getWorkspaces(vector<Mat *> &workspaces, const bool isInputCached);
+
+		void fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+				   const Mat3D &weights, const Mat &bias);
+
+		// wgrad, the input spectra are rebuilt from inFeatMaps unless
+		// fprop of this engine left them in X (isInputCached)
+		void bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+						  const Tensor &inFeatMaps, const bool isInputCached);
+
+		// dgrad, the delta spectra are rebuilt unless bpropWeights of
+		// this engine left them in Y (isDeltaCached); overwrites X
+		void bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+					   const Mat3D &weights, const bool isDeltaCached);
+
+	private:
+		// src [rows x cols] is placed at (offRow, offCol) of the fft grid,
+		// bin f of its half spectrum goes to dstRe/dstIm[f * binStep]
+		void forwardSpectrum(float *dstRe, float *dstIm, const int binStep,
+							 Mat &buffer, Mat &spectrum, const float *src,
+							 const int rows, const int cols, const int ld,
+							 const int offRow, const int offCol);
+
+		// real inverse of the half spectrum srcRe/srcIm[f * binStep]
+		void inverseSpectrum(Mat &buffer, Mat &spectrum, const float *srcRe,
+							 const float *srcIm, const int binStep);
+
+		void transformFilters(const Mat3D &weights);
+
+		void transformInputs(const Tensor &inFeatMaps);
+
+		void transformOutputs(Tensor &ouFeatMaps, const Mat &bias);
+
+		void transformDeltas(const Tensor &currLayerDelta);
+
+		void untransformFilterGrads(Mat3D &weightGrads);
+
+		void untransformInputGrads(Tensor &prevLayerDelta);
+
+	private:
+		Mat WRe, WIm;   // [numBins x numWeights x groupChns]
+		Mat XRe, XIm;   // [numBins x inChns x numImages]
+		Mat YRe, YIm;   // [numBins x numWeights x numImages]
+		Mat dWRe, dWIm; // same layout as W
+		WeightGeometry wparams;
+		PadGeometry padding;
+
+		int numImages;
+		int inChns;
+		int inRows;
+		int inCols;
+		int ouRows;
+		int ouCols;
+		int fftRows;
+		int fftCols;
+		int specCols;
+		int numBins;
+		bool isFilterStale;
+	};
+
+
+	inline void FFTConv::setFilterStale()
+	{
+		this->isFilterStale = true;
+	}
+
+	inline void FFTConv::getWorkspaces(vector<Mat *> &workspaces, const bool isInputCached)
+	{
+		workspaces.push_back(&YRe);
+		workspaces.push_back(&YIm);
+		workspaces.push_back(&dWRe);
+		workspaces.push_back(&dWIm);
+		if (!isInputCached) {
+			workspaces.push_back(&XRe);
+			workspaces.push_back(&XIm);
+		}
+	}
+}
+
+#endif // fftconv.h
@@ -37,6 +37,21 @@ namespace convnet
 				const int stepRow, const int stepCol,
 				const int padTop, const int padLeft,
 				const int padBottom, const int padRight);
+
+	// pointer versions write / read a [dims x blocks] block of a wider
+	// matrix with row stride ldcol, so the columns of several images
+	// can be laid side by side for one batched matrix multiplication
+	void im2col(float *colImage, const int ldcol, const vector<Mat> &images,
+				const int winHeight, const int winWidth,
+				const int stepRow, const int stepCol,
+				const int padTop, const int padLeft,
+				const int padBottom, const int padRight);
+
+	void col2im(vector<Mat> &images, const float *colImage, const int ldcol,
+				const int winHeight, const int winWidth,
+				const int stepRow, const int stepCol,
+				const int padTop, const int padLeft,
+				const int padBottom, const int padRight);
 }
 
 
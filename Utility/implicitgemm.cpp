@@ -0,0 +1,406 @@
+#include "check.h"
+#include "sgemm.h"
+#include "implicitgemm.h"
+#include <string.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+namespace convnet
+{
+	// entry (d, p) of the patch matrix described by t
+	static inline float gatherPatch(const PatchTables &t, const float *const *chnPtrs,
+									const int d, const int p)
+	{
+		int r = t.pixRows[p] + t.tapRows[d];
+		int c = t.pixCols[p] + t.tapCols[d];
+		if (t.stepRow != 1 || t.stepCol != 1) {
+			if (r < 0 || c < 0 || r % t.stepRow != 0 || c % t.stepCol != 0)
+				return 0;
+			r /= t.stepRow;
+			c /= t.stepCol;
+		}
+
+		if ((unsigned)r >= (unsigned)t.rows || (unsigned)c >= (unsigned)t.cols)
+			return 0;
+
+		return chnPtrs[t.tapChns[d]][r * t.cols + c];
+	}
+
+	// op(B) = patches of all images side by side, [taps x (images x pixels)];
+	// chnPtrs[i * mapStride + ch] is channel ch of image i
+	class PatchPanelB : public SgemmPanelB
+	{
+	public:
+		PatchPanelB(const PatchTables &t, const float *const *chnPtrs,
+					const int mapStride, const int numPixels)
+			: t(t), chnPtrs(chnPtrs), mapStride(mapStride), numPixels(numPixels) {}
+
+		void pack(float *dst, const int j0, const int nr,
+				  const int k0, const int kc) const
+		{
+			const float *const *imPtrs[SGEMM_PANEL_NR];
+			int pixels[SGEMM_PANEL_NR];
+			int pixOffs[SGEMM_PANEL_NR];
+			bool isInterior = true;
+			for (int j = 0; j < nr; ++j) {
+				imPtrs[j] = chnPtrs + ((j0 + j) / numPixels) * mapStride;
+				pixels[j] = (j0 + j) % numPixels;
+				pixOffs[j] = t.pixOffs[pixels[j]];
+				isInterior = isInterior && t.isInterior[pixels[j]];
+			}
+
+			for (int k = 0; k < kc; ++k) {
+				int d = k0 + k;
+				int tapChn = t.tapChns[d];
+				int tapOff = t.tapOffs[d];
+				float *out = dst + k * SGEMM_PANEL_NR;
+				int j = 0;
+				if (isInterior) {
+					for (; j < nr; ++j)
+						out[j] = imPtrs[j][tapChn][pixOffs[j] + tapOff];
+				}
+				else {
+					for (; j < nr; ++j)
+						out[j] = gatherPatch(t, imPtrs[j], d, pixels[j]);
+				}
+				for (; j < SGEMM_PANEL_NR; ++j)
+					out[j] = 0;
+			}
+		}
+
+	private:
+		const PatchTables &t;
+		const float *const *chnPtrs;
+		int mapStride;
+		int numPixels;
+	};
+
+	// op(B) = transposed patches of all images, [(images x pixels) x taps]
+	class PatchPanelBT : public SgemmPanelB
+	{
+	public:
+		PatchPanelBT(const PatchTables &t, const float *const *chnPtrs,
+					 const int mapStride, const int numPixels)
+			: t(t), chnPtrs(chnPtrs), mapStride(mapStride), numPixels(numPixels) {}
+
+		void pack(float *dst, const int j0, const int nr,
+				  const int k0, const int kc) const
+		{
+			for (int k = 0; k < kc; ++k) {
+				const float *const *imPtrs = chnPtrs + ((k0 + k) / numPixels) * mapStride;
+				int p = (k0 + k) % numPixels;
+				float *out = dst + k * SGEMM_PANEL_NR;
+				int j = 0;
+				if (t.isInterior[p]) {
+					int pixOff = t.pixOffs[p];
+					for (; j < nr; ++j) {
+						int d = j0 + j;
+						out[j] = imPtrs[t.tapChns[d]][pixOff + t.tapOffs[d]];
+					}
+				}
+				else {
+					for (; j < nr; ++j)
+						out[j] = gatherPatch(t, imPtrs, j0 + j, p);
+				}
+				for (; j < SGEMM_PANEL_NR; ++j)
+					out[j] = 0;
+			}
+		}
+
+	private:
+		const PatchTables &t;
+		const float *const *chnPtrs;
+		int mapStride;
+		int numPixels;
+	};
+
+	// maps of all images viewed as one [chns x (numImages x dims)] matrix,
+	// i.e. channel ch of image i at base + ch * ld + i * dims; NULL if the
+	// tensor is not channel major
+	static float *batchBlockOf(const Tensor &maps)
+	{
+		return maps.isChannelMajor() ? maps.ptr() : NULL;
+	}
+
+	// gather maps into / scatter maps out of a [chns x (numImages x dims)] matrix
+	static void packMaps(float *dst, const Tensor &maps, const int chns, const int dims)
+	{
+		int ld = maps.size() * dims;
+		for (int i = 0; i < maps.size(); ++i) {
+			for (int ch = 0; ch < chns; ++ch)
+				memcpy(dst + ch * ld + i * dims, maps[i][ch].data, dims * sizeof(float));
+		}
+	}
+
+	static void unpackMaps(Tensor &maps, const float *src, const int chns, const int dims)
+	{
+		int ld = maps.size() * dims;
+		for (int i = 0; i < maps.size(); ++i) {
+			for (int ch = 0; ch < chns; ++ch)
+				memcpy(maps[i][ch].data, src + ch * ld + i * dims, dims * sizeof(float));
+		}
+	}
+
+
+	bool ImplicitGemmConv::isPointwiseConv(const WeightGeometry &wparams,
+										   const StrideGeometry &strides,
+										   const PadGeometry &padding)
+	{
+		return wparams.width == 1 && wparams.height == 1 &&
+			   strides.stepRow == 1 && strides.stepCol == 1 &&
+			   padding.top == 0 && padding.left == 0 &&
+			   padding.bottom == 0 && padding.right == 0;
+	}
+
+	void ImplicitGemmConv::init(const WeightGeometry &wparams,
+								const StrideGeometry &strides,
+								const PadGeometry &padding,
+								const int numImages,
+								const int inChns,
+								const int inRows,
+								const int inCols,
+								const int ouRows,
+								const int ouCols)
+	{
+		this->wparams = wparams;
+		this->numImages = numImages;
+		this->inChns = inChns;
+		this->inDims = inRows * inCols;
+		this->ouDims = ouRows * ouCols;
+		this->isPointwise = isPointwiseConv(wparams, strides, padding);
+
+		int winHeight = wparams.height;
+		int winWidth = wparams.width;
+		int winDims = winHeight * winWidth;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+
+		// patches of the inputs, one column per output pixel
+		int numTaps = groupChns * winDims;
+		patches.tapChns.resize(numTaps);
+		patches.tapRows.resize(numTaps);
+		patches.tapCols.resize(numTaps);
+		patches.tapOffs.resize(numTaps);
+		for (int d = 0; d < numTaps; ++d) {
+			patches.tapChns[d] = d / winDims;
+			patches.tapRows[d] = (d / winWidth) % winHeight - padding.top;
+			patches.tapCols[d] = d % winWidth - padding.left;
+			patches.tapOffs[d] = patches.tapRows[d] * inCols + patches.tapCols[d];
+		}
+
+		patches.pixRows.resize(ouDims);
+		patches.pixCols.resize(ouDims);
+		patches.pixOffs.resize(ouDims);
+		patches.isInterior.resize(ouDims);
+		for (int p = 0; p < ouDims; ++p) {
+			int r = (p / ouCols) * strides.stepRow;
+			int c = (p % ouCols) * strides.stepCol;
+			patches.pixRows[p] = r;
+			patches.pixCols[p] = c;
+			patches.pixOffs[p] = r * inCols + c;
+			patches.isInterior[p] = r - padding.top >= 0 && r - padding.top + winHeight <= inRows &&
+									c - padding.left >= 0 && c - padding.left + winWidth <= inCols;
+		}
+		patches.rows = inRows;
+		patches.cols = inCols;
+		patches.stepRow = 1;
+		patches.stepCol = 1;
+
+		// patches of the delta maps for the transposed convolution, one
+		// column per input pixel; input (y, x) receives tap (kr, kc) of
+		// output ((y + top - kr) / stepRow, (x + left - kc) / stepCol)
+		numTaps = groupWeights * winDims;
+		deltaPatches.tapChns.resize(numTaps);
+		deltaPatches.tapRows.resize(numTaps);
+		deltaPatches.tapCols.resize(numTaps);
+		deltaPatches.tapOffs.resize(numTaps);
+		for (int d = 0; d < numTaps; ++d) {
+			deltaPatches.tapChns[d] = d / winDims;
+			deltaPatches.tapRows[d] = padding.top - (d / winWidth) % winHeight;
+			deltaPatches.tapCols[d] = padding.left - d % winWidth;
+			deltaPatches.tapOffs[d] = deltaPatches.tapRows[d] * ouCols + deltaPatches.tapCols[d];
+		}
+
+		bool isUnitStride = strides.stepRow == 1 && strides.stepCol == 1;
+		deltaPatches.pixRows.resize(inDims);
+		deltaPatches.pixCols.resize(inDims);
+		deltaPatches.pixOffs.resize(inDims);
+		deltaPatches.isInterior.resize(inDims);
+		for (int q = 0; q < inDims; ++q) {
+			int r = q / inCols;
+			int c = q % inCols;
+			deltaPatches.pixRows[q] = r;
+			deltaPatches.pixCols[q] = c;
+			deltaPatches.pixOffs[q] = r * ouCols + c;
+			deltaPatches.isInterior[q] = isUnitStride &&
+										 r + padding.top - winHeight + 1 >= 0 && r + padding.top < ouRows &&
+										 c + padding.left - winWidth + 1 >= 0 && c + padding.left < ouCols;
+		}
+		deltaPatches.rows = ouRows;
+		deltaPatches.cols = ouCols;
+		deltaPatches.stepRow = strides.stepRow;
+		deltaPatches.stepCol = strides.stepCol;
+
+		regroupedWeights = Mat::zeros(wparams.numGroups * groupChns, groupWeights * winDims, CV_32FC1);
+		mapPtrs.resize(numImages * max(inChns, wparams.numWeights));
+	}
+
+	void ImplicitGemmConv::fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+								 const Mat3D &weights, const Mat &bias)
+	{
+		int numWeights = wparams.numWeights;
+		int groupWeights = numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		int ld = numImages * ouDims;
+
+		for (int i = 0; i < numImages; ++i) {
+			for (int ch = 0; ch < inChns; ++ch)
+				mapPtrs[i * inChns + ch] = CV_MAT_PRF(inFeatMaps[i][ch]);
+		}
+
+		float *ouBlock = batchBlockOf(ouFeatMaps);
+		bool isScattered = ouBlock == NULL;
+		if (isScattered) {
+			workspace.create(numWeights, ld, CV_32FC1);
+			ouBlock = CV_MAT_PRF(workspace);
+		}
+
+		// start from the bias and accumulate W * patches on top
+		const float *biasPtr = bias.empty() ? NULL : CV_MAT_PRF(bias);
+		for (int k = 0; k < numWeights; ++k) {
+			float b = biasPtr == NULL ? 0 : biasPtr[k];
+			float *dst = ouBlock + k * ld;
+			for (int p = 0; p < ld; ++p)
+				dst[p] = b;
+		}
+
+		// a 1 x 1 convolution multiplies the input matrix itself
+		const float *inBlock = isPointwise ? batchBlockOf(inFeatMaps) : NULL;
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			if (inBlock != NULL) {
+				sgemm(false, false, groupWeights, ld, groupChns, 1.0f,
+					  CV_MAT_PRF(weights[g]), groupChns, inBlock + g * groupChns * ld, ld,
+					  1.0f, ouBlock + g * groupWeights * ld, ld);
+			}
+			else {
+				PatchPanelB panel(patches, &mapPtrs[g * groupChns], inChns, ouDims);
+				sgemm(false, groupWeights, ld, weights[g].cols, 1.0f,
+					  CV_MAT_PRF(weights[g]), weights[g].cols, panel,
+					  1.0f, ouBlock + g * groupWeights * ld, ld);
+			}
+		}
+
+		if (isScattered)
+			unpackMaps(ouFeatMaps, ouBlock, numWeights, ouDims);
+	}
+
+	void ImplicitGemmConv::bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+										const Tensor &inFeatMaps)
+	{
+		int numGroups = wparams.numGroups;
+		int groupWeights = wparams.numWeights / numGroups;
+		int groupChns = wparams.weightChns;
+		int ouLd = numImages * ouDims;
+		int inLd = numImages * inDims;
+
+		const float *deltaBlock = deltaBlockOf(currLayerDelta);
+		for (int i = 0; i < numImages; ++i) {
+			for (int ch = 0; ch < inChns; ++ch)
+				mapPtrs[i * inChns + ch] = CV_MAT_PRF(inFeatMaps[i][ch]);
+		}
+
+		const float *inputBlock = isPointwise ? batchBlockOf(inFeatMaps) : NULL;
+		for (int g = 0; g < numGroups; ++g) {
+			if (inputBlock != NULL) {
+				sgemm(false, true, groupWeights, groupChns, ouLd, 1.0f,
+					  deltaBlock + g * groupWeights * ouLd, ouLd, inputBlock + g * groupChns * inLd, inLd,
+					  0.0f, CV_MAT_PRF(weightGrads[g]), groupChns);
+			}
+			else {
+				PatchPanelBT panel(patches, &mapPtrs[g * groupChns], inChns, ouDims);
+				sgemm(false, groupWeights, weightGrads[g].cols, ouLd, 1.0f,
+					  deltaBlock + g * groupWeights * ouLd, ouLd, panel,
+					  0.0f, CV_MAT_PRF(weightGrads[g]), weightGrads[g].cols);
+			}
+		}
+	}
+
+	void ImplicitGemmConv::bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+									 const Mat3D &weights)
+	{
+		int numWeights = wparams.numWeights;
+		int numGroups = wparams.numGroups;
+		int groupWeights = numWeights / numGroups;
+		int groupChns = wparams.weightChns;
+		int winDims = wparams.height * wparams.width;
+		int ouLd = numImages * ouDims;
+		int inLd = numImages * inDims;
+
+		float *inBlock = batchBlockOf(prevLayerDelta);
+		bool isScattered = inBlock == NULL;
+		if (isScattered) {
+			dzdxBuffer.create(inChns, inLd, CV_32FC1);
+			inBlock = CV_MAT_PRF(dzdxBuffer);
+		}
+
+		// dz/dx of a 1 x 1 convolution is W^T * dY
+		if (isPointwise) {
+			const float *deltaBlock = deltaBlockOf(currLayerDelta);
+			for (int g = 0; g < numGroups; ++g) {
+				sgemm(true, false, groupChns, inLd, groupWeights, 1.0f,
+					  CV_MAT_PRF(weights[g]), groupChns, deltaBlock + g * groupWeights * ouLd, ouLd,
+					  0.0f, inBlock + g * groupChns * inLd, inLd);
+			}
+
+			if (isScattered)
+				unpackMaps(prevLayerDelta, inBlock, inChns, inDims);
+			return;
+		}
+
+		// W'(g)[c, k x wh x ww] = W(g)[k, c x wh x ww]
+		int tapDims = groupWeights * winDims;
+		for (int g = 0; g < numGroups; ++g) {
+			for (int k = 0; k < groupWeights; ++k) {
+				const float *src = CV_MAT_PRF(weights[g]) + k * weights[g].cols;
+				for (int c = 0; c < groupChns; ++c) {
+					float *dst = CV_MAT_PRF(regroupedWeights) + (g * groupChns + c) * tapDims + k * winDims;
+					memcpy(dst, src + c * winDims, winDims * sizeof(float));
+				}
+			}
+		}
+
+		for (int i = 0; i < numImages; ++i) {
+			for (int k = 0; k < numWeights; ++k)
+				mapPtrs[i * numWeights + k] = CV_MAT_PRF(currLayerDelta[i][k]);
+		}
+
+		for (int g = 0; g < numGroups; ++g) {
+			PatchPanelB panel(deltaPatches, &mapPtrs[g * groupWeights], numWeights, inDims);
+			sgemm(false, groupChns, inLd, tapDims, 1.0f,
+				  CV_MAT_PRF(regroupedWeights) + g * groupChns * tapDims, tapDims, panel,
+				  0.0f, inBlock + g * groupChns * inLd, inLd);
+		}
+
+		if (isScattered)
+			unpackMaps(prevLayerDelta, inBlock, inChns, inDims);
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+	// the delta maps as one [numWeights x (numImages x ouDims)] matrix,
+	// packed into workspace when they are not laid out that way
+	const float *ImplicitGemmConv::deltaBlockOf(const Tensor &currLayerDelta)
+	{
+		const float *deltaBlock = batchBlockOf(currLayerDelta);
+		if (deltaBlock == NULL) {
+			workspace.create(wparams.numWeights, numImages * ouDims, CV_32FC1);
+			packMaps(CV_MAT_PRF(workspace), currLayerDelta, wparams.numWeights, ouDims);
+			deltaBlock = CV_MAT_PRF(workspace);
+		}
+		return deltaBlock;
+	}
+}
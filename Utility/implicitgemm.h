@@ -0,0 +1,123 @@
+#ifndef _CONVNET_UTILITY_IMPLICITGEMM_H_
+#define _CONVNET_UTILITY_IMPLICITGEMM_H_
+#pragma once
+
+#include "types.h"
+#include "tensor.h"
+#include "param.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief offset tables describing a patch matrix without storing
+	//		  it, entry (d, p) reads map tapChns[d] at
+	//
+	//		r = pixRows[p] + tapRows[d], c = pixCols[p] + tapCols[d]
+	//
+	//	which must be a multiple of (stepRow, stepCol) and inside
+	//	rows x cols after division, zero otherwise. Pixels whose
+	//	whole patch is inside (isInterior) skip all tests and read
+	//	pixOffs[p] + tapOffs[d] directly.
+	//
+	// --------------------------------------------------------------
+	class PatchTables
+	{
+	public:
+		vector<int> tapChns;
+		vector<int> tapRows;
+		vector<int> tapCols;
+		vector<int> tapOffs;
+		vector<int> pixRows;
+		vector<int> pixCols;
+		vector<int> pixOffs;
+		vector<uchar> isInterior;
+		int rows;
+		int cols;
+		int stepRow;
+		int stepCol;
+	};
+
+
+	// --------------------------------------------------------------
+	//
+	// @brief implicit GEMM convolution, the im2col patch matrix is
+	//		  never materialized
+	//
+	//	Patches are gathered straight into the packing buffers of
+	//	sgemm through offset tables built once in init(), which also
+	//	take care of the padding borders. The images of the batch
+	//	are laid side by side along the columns, per group:
+	//
+	//		fprop: Y  = W * patches(X)
+	//		wgrad: dW += dY * patches(X)^T
+	//		dgrad: dX = W' * patches(dY)
+	//
+	//	where W' holds the weights regrouped per input channel and
+	//	patches(dY) walks the delta maps of the transposed
+	//	convolution, so no col2im scatter is needed either.
+	//
+	//	For 1 x 1 weights with unit stride and no padding the
+	//	patches are the inputs themselves; when the input tensor is
+	//	channel major, i.e. one [chns x (images x pixels)] matrix
+	//	(e.g. the outputs of a ConvLayer), all three passes are a plain gemm
+	//	on the feature map memory, W' = W^T and no gather is done.
+	//
+	// --------------------------------------------------------------
+	class ImplicitGemmConv
+	{
+	public:
+		ImplicitGemmConv() : isPointwise(false) {}
+
+		~ImplicitGemmConv() {}
+
+		static bool isPointwiseConv(const WeightGeometry &wparams,
+									const StrideGeometry &strides,
+									const PadGeometry &padding);
+
+		void init(const WeightGeometry &wparams,
+				  const StrideGeometry &strides,
+				  const PadGeometry &padding,
+				  const int numImages,
+				  const int inChns,
+				  const int inRows,
+				  const int inCols,
+				  const int ouRows,
+				  const int ouCols);
+
+		void fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+				   const Mat3D &weights, const Mat &bias);
+
+		void bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+						  const Tensor &inFeatMaps);
+
+		// run after bpropWeights when prevLayerDelta aliases the inputs
+		void bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+					   const Mat3D &weights);
+
+	private:
+		const float *deltaBlockOf(const Tensor &currLayerDelta);
+
+	private:
+		PatchTables patches;	  // [groupChns x wh x ww] x [ouRows x ouCols]
+		PatchTables deltaPatches; // [groupWeights x wh x ww] x [inRows x inCols]
+		Mat regroupedWeights;	  // [numGroups x groupChns] x [groupWeights x wh x ww]
+		Mat workspace;			  // outputs / deltas not stored as one matrix
+		Mat dzdxBuffer;			  // dz/dx when the inputs are not one matrix
+		vector<const float *> mapPtrs;
+		WeightGeometry wparams;
+
+		int numImages;
+		int inChns;
+		int inDims;
+		int ouDims;
+		bool isPointwise;
+	};
+}
+
+#endif // implicitgemm.h
@@ -0,0 +1,92 @@
+#include "memplan.h"
+#include <algorithm>
+
+namespace convnet
+{
+	// earlier first step, then larger buffer
+	struct BufferOrder
+	{
+		const vector<size_t> &bytes;
+		const vector<int> &firsts;
+
+		BufferOrder(const vector<size_t> &bytes, const vector<int> &firsts)
+			: bytes(bytes), firsts(firsts) {}
+
+		bool operator()(const int a, const int b) const
+		{
+			if (firsts[a] != firsts[b])
+				return firsts[a] < firsts[b];
+			return bytes[a] > bytes[b];
+		}
+	};
+
+	int MemoryPlanner::addBuffer(const size_t bytes, const int first, const int last)
+	{
+		bufferBytes.push_back(bytes);
+		firstSteps.push_back(first);
+		lastSteps.push_back(last);
+		return (int)bufferBytes.size() - 1;
+	}
+
+	void MemoryPlanner::plan()
+	{
+		int numBuffers = getNumBuffers();
+		vector<int> order(numBuffers);
+		for (int i = 0; i < numBuffers; ++i)
+			order[i] = i;
+		sort(order.begin(), order.end(), BufferOrder(bufferBytes, firstSteps));
+
+		// buffers come in order of their first step, so a slot is free
+		// once the last step of its latest buffer has passed
+		vector<int> slotLast;
+		slots.assign(numBuffers, -1);
+		slotBytes.clear();
+		for (int k = 0; k < numBuffers; ++k) {
+			int b = order[k];
+			int fit = -1, largest = -1;
+			for (int s = 0; s < slotBytes.size(); ++s) {
+				if (slotLast[s] >= firstSteps[b])
+					continue;
+				if (slotBytes[s] >= bufferBytes[b] && (fit < 0 || slotBytes[s] < slotBytes[fit]))
+					fit = s;
+				if (largest < 0 || slotBytes[s] > slotBytes[largest])
+					largest = s;
+			}
+
+			int s = fit >= 0 ? fit : largest;
+			if (s < 0) {
+				s = (int)slotBytes.size();
+				slotBytes.push_back(0);
+				slotLast.push_back(0);
+			}
+			slotBytes[s] = max(slotBytes[s], bufferBytes[b]);
+			slotLast[s] = lastSteps[b];
+			slots[b] = s;
+		}
+	}
+
+	void MemoryPlanner::clear()
+	{
+		bufferBytes.clear();
+		firstSteps.clear();
+		lastSteps.clear();
+		slots.clear();
+		slotBytes.clear();
+	}
+
+	size_t MemoryPlanner::getPlannedBytes()
+	{
+		size_t total = 0;
+		for (int s = 0; s < slotBytes.size(); ++s)
+			total += slotBytes[s];
+		return total;
+	}
+
+	size_t MemoryPlanner::getNaiveBytes()
+	{
+		size_t total = 0;
+		for (int i = 0; i < bufferBytes.size(); ++i)
+			total += bufferBytes[i];
+		return total;
+	}
+}
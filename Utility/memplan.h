@@ -0,0 +1,80 @@
+#ifndef _CONVNET_UTILITY_MEMPLAN_H_
+#define _CONVNET_UTILITY_MEMPLAN_H_
+#pragma once
+
+#include <vector>
+
+namespace convnet
+{
+	using namespace std;
+
+	// --------------------------------------------------------------
+	//
+	// @brief assigns buffers that are live over steps [first, last]
+	//		  to shared slots, buffers of one slot never overlap
+	//
+	//	Interval coloring: buffers are taken in order of their first
+	//	step and go to the free slot closest to their size, a free
+	//	slot that is too small grows, new slots are opened only when
+	//	no slot is free. The planned bytes are the sum of the slot
+	//	sizes, the naive bytes the sum of the buffer sizes.
+	//
+	// --------------------------------------------------------------
+	class MemoryPlanner
+	{
+	public:
+		MemoryPlanner() {}
+
+		~MemoryPlanner() {}
+
+		// index of the new buffer
+		int addBuffer(const size_t bytes, const int first, const int last);
+
+		void plan();
+
+		void clear();
+
+		inline int getNumBuffers();
+
+		inline int getNumSlots();
+
+		// valid after plan()
+		inline int getSlot(const int i);
+
+		inline size_t getSlotBytes(const int s);
+
+		size_t getPlannedBytes();
+
+		size_t getNaiveBytes();
+
+	private:
+		vector<size_t> bufferBytes;
+		vector<int> firstSteps;
+		vector<int> lastSteps;
+		vector<int> slots;
+		vector<size_t> slotBytes;
+	};
+
+
+	inline int MemoryPlanner::getNumBuffers()
+	{
+		return (int)bufferBytes.size();
+	}
+
+	inline int MemoryPlanner::getNumSlots()
+	{
+		return (int)slotBytes.size();
+	}
+
+	inline int MemoryPlanner::getSlot(const int i)
+	{
+		return this->slots[i];
+	}
+
+	inline size_t MemoryPlanner::getSlotBytes(const int s)
+	{
+		return this->slotBytes[s];
+	}
+}
+
+#endif // memplan.h
@@ -1,8 +1,8 @@
 #include "check.h"
 #include "mmul.h"
+#include "sgemm.h"
 #include <opencv2/core/core.hpp>
 #include <intrin.h>
-#include <arrayfire.h>
 #include <stdlib.h>
 
 namespace convnet
@@ -110,77 +110,28 @@ namespace convnet
 // 	}
 
 
+	// Z = op(X) * op(Y), X is [xrows x xcols] and Y is [yrows x ycols]
 	void fastMatMul(float *Z, const float *X, const float *Y,
 					const int xrows, const int xcols, 
 					const int yrows, const int ycols,
 					const bool trans1, const bool trans2)
 	{
-		af::array fastmat1(xcols, xrows, X, afHost);
-		af::array fastmat2(ycols, yrows, Y, afHost);
-		af::array fastdst;
-		float *res = NULL;
-		if (!trans1 && !trans2) {
-			fastdst = af::matmul(fastmat2, fastmat1);
-			res = fastdst.host<float>();
-			memcpy(Z, res, ycols * xrows * sizeof(float));
-		}
-		else if (trans1 && !trans2) {
-			fastdst = af::matmulNT(fastmat2, fastmat1);
-			res = fastdst.host<float>();
-			memcpy(Z, res, ycols * xcols * sizeof(float));
-		}
-		else if (!trans1 && trans2) {
-			fastdst = af::matmulTN(fastmat2, fastmat1);
-			res = fastdst.host<float>();
-			memcpy(Z, res, yrows * xrows * sizeof(float));
-		}
-		else if (trans1 && trans2) {
-			fastdst = af::matmul(fastmat1, fastmat2);
-			res = fastdst.host<float>();
-			memcpy(Z, res, xcols * yrows * sizeof(float));
-		}
-	#ifndef _DEBUG
-		if (res != NULL) delete[] res;
-	#endif
+		int M = trans1 ? xcols : xrows;
+		int K = trans1 ? xrows : xcols;
+		int N = trans2 ? yrows : ycols;
+		sgemm(trans1, trans2, M, N, K, 1.0f, X, xcols, Y, ycols, 0.0f, Z, N);
 	}
 
 
+	// Z += op(X) * op(Y)
 	void fastMatMulAdd(float *Z, const float *X, const float *Y,
 					   const int xrows, const int xcols,
 					   const int yrows, const int ycols,
 					   const bool trans1, const bool trans2)
 	{
-		af::array fastmat1(xcols, xrows, X);
-		af::array fastmat2(ycols, yrows, Y);
-		af::array fastdst;
-		int dstrows, dstcols;
-		if (!trans1 && !trans2) {
-			fastdst = af::matmul(fastmat2, fastmat1);
-			dstrows = ycols;
-			dstcols = xrows;
-		}
-		else if (trans1 && !trans2) {
-			fastdst = af::matmulNT(fastmat2, fastmat1);
-			dstrows = ycols;
-			dstcols = xcols;
-		}
-		else if (!trans1 && trans2) {
-			fastdst = af::matmulTN(fastmat2, fastmat1);
-			dstrows = yrows;
-			dstcols = xrows;
-		}
-		else if (trans1 && trans2) {
-			fastdst = af::matmul(fastmat1, fastmat2);
-			dstrows = xcols;
-			dstcols = yrows;
-		}
-
-		float *res = fastdst.host<float>();
-		for (int i = 0; i < dstrows * dstcols; ++i) {
-			Z[i] += res[i];
-		}
-	#ifndef _DEBUG
-		if (res != NULL) delete[] res;
-	#endif
+		int M = trans1 ? xcols : xrows;
+		int K = trans1 ? xrows : xcols;
+		int N = trans2 ? yrows : ycols;
+		sgemm(trans1, trans2, M, N, K, 1.0f, X, xcols, Y, ycols, 1.0f, Z, N);
 	}
 }
\ No newline at end of file
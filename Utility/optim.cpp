@@ -0,0 +1,222 @@
+#include "optim.h"
+#include <intrin.h>
+#include <cmath>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// floats per thread task, small buffers such as biases run in one
+	enum { OPTIM_CHUNK_DIMS = 16384 };
+
+	static void sgdMomentumChunk(float *weights, float *moments, const float *grads, const int n,
+								 const float learningRate, const float momentRate,
+								 const float weightDecay)
+	{
+		__m128 lr = _mm_set1_ps(learningRate);
+		__m128 mr = _mm_set1_ps(momentRate);
+		__m128 wd = _mm_set1_ps(weightDecay);
+
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 w = _mm_loadu_ps(weights + k);
+			__m128 g = _mm_add_ps(_mm_loadu_ps(grads + k), _mm_mul_ps(wd, w));
+			__m128 m = _mm_add_ps(_mm_mul_ps(mr, _mm_loadu_ps(moments + k)), _mm_mul_ps(lr, g));
+			_mm_storeu_ps(moments + k, m);
+			_mm_storeu_ps(weights + k, _mm_sub_ps(w, m));
+		}
+
+		for (; k < n; ++k) {
+			moments[k] = momentRate * moments[k] + learningRate * (grads[k] + weightDecay * weights[k]);
+			weights[k] -= moments[k];
+		}
+	}
+
+	// w = shrink w - stepSize m / (sqrt(v) varScale + eps), the bias 
+	// corrections of both moments are folded into stepSize and varScale
+	static void adamChunk(const ParamBlock &block, const int offset, const int n)
+	{
+		float *weights = block.weights + offset;
+		float *moments = block.moments + offset;
+		float *variances = block.variances + offset;
+		const float *grads = block.grads + offset;
+
+		bool isDecoupled = block.method == OPTIM_ADAMW;
+		float l2 = isDecoupled ? 0 : block.weightDecay;
+		float shrink = isDecoupled ? 1 - block.learningRate * block.weightDecay : 1;
+		float b1 = block.momentRate;
+		float b2 = block.varianceRate;
+		float stepSize = block.learningRate / (1 - (float)std::pow((double)b1, block.step));
+		float varScale = 1 / (float)std::sqrt(1 - std::pow((double)b2, block.step));
+
+		__m128 l2Ps = _mm_set1_ps(l2);
+		__m128 shrinkPs = _mm_set1_ps(shrink);
+		__m128 b1Ps = _mm_set1_ps(b1);
+		__m128 b2Ps = _mm_set1_ps(b2);
+		__m128 c1Ps = _mm_set1_ps(1 - b1);
+		__m128 c2Ps = _mm_set1_ps(1 - b2);
+		__m128 stepPs = _mm_set1_ps(stepSize);
+		__m128 scalePs = _mm_set1_ps(varScale);
+		__m128 epsPs = _mm_set1_ps(block.epsilon);
+
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 w = _mm_loadu_ps(weights + k);
+			__m128 g = _mm_add_ps(_mm_loadu_ps(grads + k), _mm_mul_ps(l2Ps, w));
+			__m128 m = _mm_add_ps(_mm_mul_ps(b1Ps, _mm_loadu_ps(moments + k)), _mm_mul_ps(c1Ps, g));
+			__m128 v = _mm_add_ps(_mm_mul_ps(b2Ps, _mm_loadu_ps(variances + k)), 
+								  _mm_mul_ps(c2Ps, _mm_mul_ps(g, g)));
+			__m128 den = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(v), scalePs), epsPs);
+			w = _mm_sub_ps(_mm_mul_ps(shrinkPs, w), _mm_div_ps(_mm_mul_ps(stepPs, m), den));
+			_mm_storeu_ps(moments + k, m);
+			_mm_storeu_ps(variances + k, v);
+			_mm_storeu_ps(weights + k, w);
+		}
+
+		for (; k < n; ++k) {
+			float g = grads[k] + l2 * weights[k];
+			moments[k] = b1 * moments[k] + (1 - b1) * g;
+			variances[k] = b2 * variances[k] + (1 - b2) * g * g;
+			weights[k] = shrink * weights[k] - 
+				stepSize * moments[k] / (std::sqrt(variances[k]) * varScale + block.epsilon);
+		}
+	}
+
+	// v = rho v + (1 - rho) g^2, m = mu m + lr g / (sqrt(v) + eps), w -= m
+	static void rmspropChunk(const ParamBlock &block, const int offset, const int n)
+	{
+		float *weights = block.weights + offset;
+		float *moments = block.moments + offset;
+		float *variances = block.variances + offset;
+		const float *grads = block.grads + offset;
+
+		float rho = block.varianceRate;
+		float mu = block.momentRate;
+		float lr = block.learningRate;
+		float wd = block.weightDecay;
+		float eps = block.epsilon;
+
+		__m128 rhoPs = _mm_set1_ps(rho);
+		__m128 c2Ps = _mm_set1_ps(1 - rho);
+		__m128 muPs = _mm_set1_ps(mu);
+		__m128 lrPs = _mm_set1_ps(lr);
+		__m128 wdPs = _mm_set1_ps(wd);
+		__m128 epsPs = _mm_set1_ps(eps);
+
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 w = _mm_loadu_ps(weights + k);
+			__m128 g = _mm_add_ps(_mm_loadu_ps(grads + k), _mm_mul_ps(wdPs, w));
+			__m128 v = _mm_add_ps(_mm_mul_ps(rhoPs, _mm_loadu_ps(variances + k)),
+								  _mm_mul_ps(c2Ps, _mm_mul_ps(g, g)));
+			__m128 step = _mm_div_ps(_mm_mul_ps(lrPs, g), _mm_add_ps(_mm_sqrt_ps(v), epsPs));
+			__m128 m = _mm_add_ps(_mm_mul_ps(muPs, _mm_loadu_ps(moments + k)), step);
+			_mm_storeu_ps(variances + k, v);
+			_mm_storeu_ps(moments + k, m);
+			_mm_storeu_ps(weights + k, _mm_sub_ps(w, m));
+		}
+
+		for (; k < n; ++k) {
+			float g = grads[k] + wd * weights[k];
+			variances[k] = rho * variances[k] + (1 - rho) * g * g;
+			moments[k] = mu * moments[k] + lr * g / (std::sqrt(variances[k]) + eps);
+			weights[k] -= moments[k];
+		}
+	}
+
+	// v += g^2, w -= lr g / (sqrt(v) + eps)
+	static void adagradChunk(const ParamBlock &block, const int offset, const int n)
+	{
+		float *weights = block.weights + offset;
+		float *variances = block.variances + offset;
+		const float *grads = block.grads + offset;
+
+		float lr = block.learningRate;
+		float wd = block.weightDecay;
+		float eps = block.epsilon;
+
+		__m128 lrPs = _mm_set1_ps(lr);
+		__m128 wdPs = _mm_set1_ps(wd);
+		__m128 epsPs = _mm_set1_ps(eps);
+
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 w = _mm_loadu_ps(weights + k);
+			__m128 g = _mm_add_ps(_mm_loadu_ps(grads + k), _mm_mul_ps(wdPs, w));
+			__m128 v = _mm_add_ps(_mm_loadu_ps(variances + k), _mm_mul_ps(g, g));
+			__m128 step = _mm_div_ps(_mm_mul_ps(lrPs, g), _mm_add_ps(_mm_sqrt_ps(v), epsPs));
+			_mm_storeu_ps(variances + k, v);
+			_mm_storeu_ps(weights + k, _mm_sub_ps(w, step));
+		}
+
+		for (; k < n; ++k) {
+			float g = grads[k] + wd * weights[k];
+			variances[k] += g * g;
+			weights[k] -= lr * g / (std::sqrt(variances[k]) + eps);
+		}
+	}
+
+	static void updateChunk(const ParamBlock &block, const int offset, const int n)
+	{
+		switch (block.method) {
+		case OPTIM_ADAM:
+		case OPTIM_ADAMW:
+			adamChunk(block, offset, n);
+			break;
+		case OPTIM_RMSPROP:
+			rmspropChunk(block, offset, n);
+			break;
+		case OPTIM_ADAGRAD:
+			adagradChunk(block, offset, n);
+			break;
+		default:
+			sgdMomentumChunk(block.weights + offset, block.moments + offset, block.grads + offset,
+							 n, block.learningRate, block.momentRate, block.weightDecay);
+		}
+	}
+
+
+	void sgdMomentumUpdate(float *weights, float *moments, const float *grads, const int n,
+						   const float learningRate, const float momentRate,
+						   const float weightDecay)
+	{
+		int numChunks = (n + OPTIM_CHUNK_DIMS - 1) / OPTIM_CHUNK_DIMS;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int c = 0; c < numChunks; ++c) {
+			int offset = c * OPTIM_CHUNK_DIMS;
+			int dims = std::min((int)OPTIM_CHUNK_DIMS, n - offset);
+			sgdMomentumChunk(weights + offset, moments + offset, grads + offset, dims,
+							 learningRate, momentRate, weightDecay);
+		}
+	}
+
+	void updateParamBlocks(const vector<ParamBlock> &blocks)
+	{
+		// (block, offset) of every chunk, so that small tensors of one
+		// layer share the threads with the large ones of another
+		vector<pair<int, int> > chunks;
+		for (int b = 0; b < blocks.size(); ++b)
+			for (int offset = 0; offset < blocks[b].total; offset += OPTIM_CHUNK_DIMS)
+				chunks.push_back(make_pair(b, offset));
+
+		int numChunks = chunks.size();
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int c = 0; c < numChunks; ++c) {
+			const ParamBlock &block = blocks[chunks[c].first];
+			int offset = chunks[c].second;
+			int dims = std::min((int)OPTIM_CHUNK_DIMS, block.total - offset);
+			updateChunk(block, offset, dims);
+		}
+	}
+}
@@ -0,0 +1,70 @@
+#ifndef _CONVNET_UTILITY_OPTIM_H_
+#define _CONVNET_UTILITY_OPTIM_H_
+#pragma once
+
+#include <vector>
+
+namespace convnet
+{
+	using namespace std;
+
+	enum OptimMethod
+	{
+		OPTIM_SGD = 0,		// momentum SGD
+		OPTIM_ADAM = 1,
+		OPTIM_ADAMW = 2,	// Adam with weight decay taken out of the moments
+		OPTIM_RMSPROP = 3,
+		OPTIM_ADAGRAD = 4
+	};
+
+	// --------------------------------------------------------------
+	//
+	// @brief one parameter tensor with its state and update rule
+	//
+	//	moments hold the momentum (SGD, RMSProp) or the first
+	//	moment (Adam), variances the second moment (Adam, RMSProp)
+	//	or the sum of squared grads (AdaGrad) and stay NULL for
+	//	SGD. momentRate is beta1 of Adam, varianceRate its beta2
+	//	and the decay of RMSProp.
+	//
+	// --------------------------------------------------------------
+	struct ParamBlock
+	{
+		float *weights;
+		float *moments;
+		float *variances;
+		const float *grads;
+		int total;
+		OptimMethod method;
+		float learningRate;
+		float momentRate;
+		float varianceRate;
+		float epsilon;
+		float weightDecay;
+		int step;			// 1 for the first update
+	};
+
+	inline bool isVarianceKept(const OptimMethod method)
+	{
+		return method != OPTIM_SGD;
+	}
+
+	// --------------------------------------------------------------
+	//
+	// @brief fused parameter updates over n continuous floats,
+	//		  every buffer is read once and written back in place,
+	//		  chunks of the buffers run on the OpenMP threads
+	//
+	// --------------------------------------------------------------
+
+	// moments = momentRate * moments + learningRate * (grads + weightDecay * weights)
+	// weights -= moments
+	void sgdMomentumUpdate(float *weights, float *moments, const float *grads, const int n,
+						   const float learningRate, const float momentRate, 
+						   const float weightDecay);
+
+	// all blocks in one parallel sweep over their chunks
+	void updateParamBlocks(const vector<ParamBlock> &blocks);
+}
+
+#endif // optim.h
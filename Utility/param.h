@@ -2,6 +2,7 @@
 #define _CONVNET_UTILITY_PARAM_H_
 #pragma once
 
+#include "optim.h"
 #include <string>
 
 namespace convnet
@@ -147,6 +148,9 @@ namespace convnet
 			, weightMomentRate(0.95)
 			, weightLearningRateScale(0.01)
 			, weightDecay(0.005)
+			, optimMethod(OPTIM_SGD)
+			, varianceRate(0.999f)
+			, epsilon(1e-8f)
 		{}
 
 		LearnGeometry(const float biasLearningRate, 
@@ -156,7 +160,9 @@ namespace convnet
 					  const float weightMomentRate,
 					  const float weightLearningRateScale,
 					  const float weightDecay)
-
+			: optimMethod(OPTIM_SGD)
+			, varianceRate(0.999f)
+			, epsilon(1e-8f)
 		{
 			this->set(biasLearningRate, biasMomentRate,
 					  biasLearningRateScale, weightLearningRate,
@@ -183,6 +189,17 @@ namespace convnet
 			this->weightDecay = weightDecay;
 		}
 
+		// momentRate is beta1 for Adam, varianceRate its beta2 and 
+		// the decay of RMSProp
+		inline void setOptimizer(const OptimMethod optimMethod,
+								 const float varianceRate = 0.999f,
+								 const float epsilon = 1e-8f)
+		{
+			this->optimMethod = optimMethod;
+			this->varianceRate = varianceRate;
+			this->epsilon = epsilon;
+		}
+
 	public:
 		float biasLearningRate; // bias learning rate
 		float biasMomentRate; // bias moment rate
@@ -191,6 +208,9 @@ namespace convnet
 		float weightMomentRate; // weight moment rate
 		float weightLearningRateScale; // weight learning rate scale
 		float weightDecay; // weight decay
+		OptimMethod optimMethod; // update rule
+		float varianceRate; // second moment rate
+		float epsilon; // added to the root of the second moment
 	};
 }
 
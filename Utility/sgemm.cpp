@@ -0,0 +1,314 @@
+#include "sgemm.h"
+#include <intrin.h>
+#include <string.h>
+#include <algorithm>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef _MSC_VER
+#define SGEMM_TLS __declspec(thread)
+#define SGEMM_ALIGN(n) __declspec(align(n))
+#else
+#define SGEMM_TLS __thread
+#define SGEMM_ALIGN(n) __attribute__((aligned(n)))
+#endif
+
+namespace convnet
+{
+	using namespace std;
+
+	// register tile of the micro-kernel (MR x NR) and cache blocks:
+	// a KC x NR sliver of B stays in L1, an MC x KC block of A in L2
+	// and a KC x NC panel of B in L3
+	enum
+	{
+		SGEMM_MR = 6,
+		SGEMM_NR = SGEMM_PANEL_NR,
+		SGEMM_MC = 120,
+		SGEMM_KC = 256,
+		SGEMM_NC = 512
+	};
+
+	// packing buffers live in thread-local storage, nothing is allocated per call
+	static SGEMM_TLS SGEMM_ALIGN(64) float packedA[SGEMM_MC * SGEMM_KC];
+	static SGEMM_TLS SGEMM_ALIGN(64) float packedB[SGEMM_KC * SGEMM_NC];
+
+	// -----------------------------------------------------------------
+	// packing
+	// -----------------------------------------------------------------
+
+	// pack rows [i0, i0 + MR) x cols [k0, k0 + kc) of op(A) into a
+	// k-major sliver, zero-filling rows past mr
+	static void packPanelA(float *dst, const float *A, const int lda,
+						   const bool transA, const int i0, const int mr,
+						   const int k0, const int kc)
+	{
+		if (!transA) {
+			for (int r = 0; r < mr; ++r) {
+				const float *a = A + (i0 + r) * lda + k0;
+				float *d = dst + r;
+				for (int k = 0; k < kc; ++k, d += SGEMM_MR)
+					*d = a[k];
+			}
+		}
+		else {
+			for (int k = 0; k < kc; ++k) {
+				const float *a = A + (k0 + k) * lda + i0;
+				float *d = dst + k * SGEMM_MR;
+				for (int r = 0; r < mr; ++r)
+					d[r] = a[r];
+			}
+		}
+
+		for (int r = mr; r < SGEMM_MR; ++r) {
+			float *d = dst + r;
+			for (int k = 0; k < kc; ++k, d += SGEMM_MR)
+				*d = 0;
+		}
+	}
+
+	// pack rows [k0, k0 + kc) x cols [j0, j0 + NR) of op(B) into a
+	// k-major sliver, zero-filling cols past nr
+	static void packPanelB(float *dst, const float *B, const int ldb,
+						   const bool transB, const int j0, const int nr,
+						   const int k0, const int kc)
+	{
+		if (!transB) {
+			for (int k = 0; k < kc; ++k) {
+				const float *b = B + (k0 + k) * ldb + j0;
+				float *d = dst + k * SGEMM_NR;
+				if (nr == SGEMM_NR) {
+					memcpy(d, b, SGEMM_NR * sizeof(float));
+				}
+				else {
+					int c = 0;
+					for (; c < nr; ++c) d[c] = b[c];
+					for (; c < SGEMM_NR; ++c) d[c] = 0;
+				}
+			}
+		}
+		else {
+			for (int c = 0; c < nr; ++c) {
+				const float *b = B + (j0 + c) * ldb + k0;
+				float *d = dst + c;
+				for (int k = 0; k < kc; ++k, d += SGEMM_NR)
+					*d = b[k];
+			}
+			for (int c = nr; c < SGEMM_NR; ++c) {
+				float *d = dst + c;
+				for (int k = 0; k < kc; ++k, d += SGEMM_NR)
+					*d = 0;
+			}
+		}
+	}
+
+	// -----------------------------------------------------------------
+	// micro-kernel: C[6 x 8] += alpha * packA[6 x kc] * packB[kc x 8]
+	// -----------------------------------------------------------------
+	static void microKernel(const int kc, const float alpha,
+							const float *pa, const float *pb,
+							float *C, const int ldc)
+	{
+		__m128 c00 = _mm_setzero_ps(), c01 = _mm_setzero_ps();
+		__m128 c10 = _mm_setzero_ps(), c11 = _mm_setzero_ps();
+		__m128 c20 = _mm_setzero_ps(), c21 = _mm_setzero_ps();
+		__m128 c30 = _mm_setzero_ps(), c31 = _mm_setzero_ps();
+		__m128 c40 = _mm_setzero_ps(), c41 = _mm_setzero_ps();
+		__m128 c50 = _mm_setzero_ps(), c51 = _mm_setzero_ps();
+		__m128 a, b0, b1;
+
+		for (int k = 0; k < kc; ++k) {
+			b0 = _mm_load_ps(pb);
+			b1 = _mm_load_ps(pb + 4);
+
+			a = _mm_set1_ps(pa[0]);
+			c00 = _mm_add_ps(c00, _mm_mul_ps(a, b0));
+			c01 = _mm_add_ps(c01, _mm_mul_ps(a, b1));
+			a = _mm_set1_ps(pa[1]);
+			c10 = _mm_add_ps(c10, _mm_mul_ps(a, b0));
+			c11 = _mm_add_ps(c11, _mm_mul_ps(a, b1));
+			a = _mm_set1_ps(pa[2]);
+			c20 = _mm_add_ps(c20, _mm_mul_ps(a, b0));
+			c21 = _mm_add_ps(c21, _mm_mul_ps(a, b1));
+			a = _mm_set1_ps(pa[3]);
+			c30 = _mm_add_ps(c30, _mm_mul_ps(a, b0));
+			c31 = _mm_add_ps(c31, _mm_mul_ps(a, b1));
+			a = _mm_set1_ps(pa[4]);
+			c40 = _mm_add_ps(c40, _mm_mul_ps(a, b0));
+			c41 = _mm_add_ps(c41, _mm_mul_ps(a, b1));
+			a = _mm_set1_ps(pa[5]);
+			c50 = _mm_add_ps(c50, _mm_mul_ps(a, b0));
+			c51 = _mm_add_ps(c51, _mm_mul_ps(a, b1));
+
+			pa += SGEMM_MR;
+			pb += SGEMM_NR;
+		}
+
+		__m128 va = _mm_set1_ps(alpha);
+		#define SGEMM_STORE_ROW(r, lo, hi) \
+		{ \
+			float *c = C + (r) * ldc; \
+			_mm_storeu_ps(c, _mm_add_ps(_mm_loadu_ps(c), _mm_mul_ps(va, lo))); \
+			_mm_storeu_ps(c + 4, _mm_add_ps(_mm_loadu_ps(c + 4), _mm_mul_ps(va, hi))); \
+		}
+		SGEMM_STORE_ROW(0, c00, c01);
+		SGEMM_STORE_ROW(1, c10, c11);
+		SGEMM_STORE_ROW(2, c20, c21);
+		SGEMM_STORE_ROW(3, c30, c31);
+		SGEMM_STORE_ROW(4, c40, c41);
+		SGEMM_STORE_ROW(5, c50, c51);
+		#undef SGEMM_STORE_ROW
+	}
+
+	// partial tiles on the right / bottom border go through a scratch tile
+	static void microKernelEdge(const int kc, const float alpha,
+								const float *pa, const float *pb,
+								float *C, const int ldc,
+								const int mr, const int nr)
+	{
+		SGEMM_ALIGN(16) float tile[SGEMM_MR * SGEMM_NR];
+		memset(tile, 0, sizeof(tile));
+		microKernel(kc, alpha, pa, pb, tile, SGEMM_NR);
+		for (int r = 0; r < mr; ++r) {
+			for (int c = 0; c < nr; ++c)
+				C[r * ldc + c] += tile[r * SGEMM_NR + c];
+		}
+	}
+
+	static void scaleMatrix(float *C, const int ldc, const int M,
+							const int N, const float beta)
+	{
+		for (int i = 0; i < M; ++i) {
+			float *c = C + i * ldc;
+			if (beta == 0) {
+				memset(c, 0, N * sizeof(float));
+			}
+			else {
+				for (int j = 0; j < N; ++j)
+					c[j] *= beta;
+			}
+		}
+	}
+
+	// op(B) stored as a row-major matrix
+	class MatrixPanelB
+	{
+	public:
+		MatrixPanelB(const float *B, const int ldb, const bool transB)
+			: B(B), ldb(ldb), transB(transB) {}
+
+		inline void pack(float *dst, const int j0, const int nr,
+						 const int k0, const int kc) const
+		{
+			packPanelB(dst, B, ldb, transB, j0, nr, k0, kc);
+		}
+
+	private:
+		const float *B;
+		int ldb;
+		bool transB;
+	};
+
+	// -----------------------------------------------------------------
+	// sgemm
+	// -----------------------------------------------------------------
+	template <class PanelB>
+	static void sgemmDriver(const bool transA,
+							const int M, const int N, const int K,
+							const float alpha, const float *A, const int lda,
+							const PanelB &panelB,
+							const float beta, float *C, const int ldc)
+	{
+		if (M <= 0 || N <= 0)
+			return;
+
+		if (beta != 1)
+			scaleMatrix(C, ldc, M, N, beta);
+
+		if (K <= 0 || alpha == 0)
+			return;
+
+		// the caller's buffers are shared by the whole team below
+		float *sharedA = packedA;
+		float *sharedB = packedB;
+
+	#ifdef _OPENMP
+		bool isParallel = !omp_in_parallel() && (double)M * N * K >= 64.0 * 64.0 * 64.0;
+		#pragma omp parallel if (isParallel)
+	#endif
+		{
+			for (int jc = 0; jc < N; jc += SGEMM_NC) {
+				int nc = min((int)SGEMM_NC, N - jc);
+				int numPanelsB = (nc + SGEMM_NR - 1) / SGEMM_NR;
+
+				for (int pc = 0; pc < K; pc += SGEMM_KC) {
+					int kc = min((int)SGEMM_KC, K - pc);
+
+					#ifdef _OPENMP
+					#pragma omp for
+					#endif
+					for (int p = 0; p < numPanelsB; ++p) {
+						int jr = p * SGEMM_NR;
+						panelB.pack(sharedB + p * SGEMM_NR * kc, jc + jr, 
+									min((int)SGEMM_NR, nc - jr), pc, kc);
+					}
+
+					for (int ic = 0; ic < M; ic += SGEMM_MC) {
+						int mc = min((int)SGEMM_MC, M - ic);
+						int numPanelsA = (mc + SGEMM_MR - 1) / SGEMM_MR;
+
+						#ifdef _OPENMP
+						#pragma omp for
+						#endif
+						for (int p = 0; p < numPanelsA; ++p) {
+							int ir = p * SGEMM_MR;
+							packPanelA(sharedA + p * SGEMM_MR * kc, A, lda, transA,
+									   ic + ir, min((int)SGEMM_MR, mc - ir), pc, kc);
+						}
+
+						// macro-kernel, each thread takes whole B slivers
+						#ifdef _OPENMP
+						#pragma omp for
+						#endif
+						for (int pj = 0; pj < numPanelsB; ++pj) {
+							int jr = pj * SGEMM_NR;
+							int nr = min((int)SGEMM_NR, nc - jr);
+							const float *pb = sharedB + pj * SGEMM_NR * kc;
+							for (int pi = 0; pi < numPanelsA; ++pi) {
+								int ir = pi * SGEMM_MR;
+								int mr = min((int)SGEMM_MR, mc - ir);
+								const float *pa = sharedA + pi * SGEMM_MR * kc;
+								float *c = C + (ic + ir) * ldc + jc + jr;
+								if (mr == SGEMM_MR && nr == SGEMM_NR)
+									microKernel(kc, alpha, pa, pb, c, ldc);
+								else
+									microKernelEdge(kc, alpha, pa, pb, c, ldc, mr, nr);
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void sgemm(const bool transA, const bool transB,
+			   const int M, const int N, const int K,
+			   const float alpha, const float *A, const int lda,
+			   const float *B, const int ldb,
+			   const float beta, float *C, const int ldc)
+	{
+		sgemmDriver(transA, M, N, K, alpha, A, lda, MatrixPanelB(B, ldb, transB), 
+					beta, C, ldc);
+	}
+
+	void sgemm(const bool transA,
+			   const int M, const int N, const int K,
+			   const float alpha, const float *A, const int lda,
+			   const SgemmPanelB &B,
+			   const float beta, float *C, const int ldc)
+	{
+		sgemmDriver(transA, M, N, K, alpha, A, lda, B, beta, C, ldc);
+	}
+}
@@ -0,0 +1,68 @@
+#ifndef _CONVNET_UTILITY_SGEMM_H_
+#define _CONVNET_UTILITY_SGEMM_H_
+#pragma once
+
+namespace convnet
+{
+	// --------------------------------------------------------------
+	//
+	// @brief single precision general matrix multiplication on
+	//		  row-major buffers
+	//
+	//		  C = alpha * op(A) * op(B) + beta * C
+	//
+	//	@param transA op(A) = A^T if true, A otherwise
+	//	@param transB op(B) = B^T if true, B otherwise
+	//	@param M rows of op(A) and C
+	//	@param N cols of op(B) and C
+	//	@param K cols of op(A) and rows of op(B)
+	//	@param lda row stride of A as stored (in floats)
+	//	@param ldb row stride of B as stored (in floats)
+	//	@param ldc row stride of C (in floats)
+	//
+	//	A and B are packed into thread-local, cache-sized panels
+	//	(GotoBLAS layout) and multiplied by a register-tiled SSE
+	//	micro-kernel, so no heap memory is touched per call. When
+	//	called outside of an OpenMP parallel region large products
+	//	are split over all threads.
+	//
+	// --------------------------------------------------------------
+	void sgemm(const bool transA, const bool transB,
+			   const int M, const int N, const int K,
+			   const float alpha, const float *A, const int lda,
+			   const float *B, const int ldb,
+			   const float beta, float *C, const int ldc);
+
+
+	// width of the op(B) slivers handed to SgemmPanelB::pack()
+	enum { SGEMM_PANEL_NR = 8 };
+
+	// --------------------------------------------------------------
+	//
+	// @brief source of op(B) for sgemm when B is never stored as a
+	//		  matrix (e.g. image patches gathered on the fly)
+	//
+	//	pack() writes rows [k0, k0 + kc) x cols [j0, j0 + nr) of
+	//	op(B) k-major into dst, i.e. dst[k * SGEMM_PANEL_NR + j],
+	//	and zero-fills cols nr .. SGEMM_PANEL_NR - 1. It may be
+	//	called from several threads at once.
+	//
+	// --------------------------------------------------------------
+	class SgemmPanelB
+	{
+	public:
+		virtual ~SgemmPanelB() {}
+
+		virtual void pack(float *dst, const int j0, const int nr,
+						  const int k0, const int kc) const = 0;
+	};
+
+	// C = alpha * op(A) * op(B) + beta * C with op(B) [K x N] packed by B
+	void sgemm(const bool transA,
+			   const int M, const int N, const int K,
+			   const float alpha, const float *A, const int lda,
+			   const SgemmPanelB &B,
+			   const float beta, float *C, const int ldc);
+}
+
+#endif // sgemm.h
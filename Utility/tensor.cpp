@@ -0,0 +1,156 @@
+#include "check.h"
+#include "tensor.h"
+#include <string.h>
+#include <opencv2/core/core.hpp>
+
+namespace convnet
+{
+	Tensor::Tensor()
+		: base(NULL), layout(TENSOR_NCHW), numImages(0), chns(0), rows(0), cols(0), 
+		  imageStep(0), chnStep(0)
+	{
+	}
+
+	Tensor::Tensor(const int numImages, const int chns, const int rows, const int cols,
+				   const TensorLayout layout)
+		: base(NULL), layout(TENSOR_NCHW), numImages(0), chns(0), rows(0), cols(0), 
+		  imageStep(0), chnStep(0)
+	{
+		create(numImages, chns, rows, cols, layout);
+	}
+
+	void Tensor::create(const int numImages, const int chns, const int rows, const int cols,
+						const TensorLayout layout)
+	{
+		this->layout = layout;
+		this->numImages = numImages;
+		this->chns = chns;
+		this->rows = rows;
+		this->cols = cols;
+
+		int mapDims = rows * cols;
+		if (layout == TENSOR_CNHW) {
+			imageStep = mapDims;
+			chnStep = numImages * mapDims;
+		}
+		else if (layout == TENSOR_NCHW8C) {
+			chnStep = mapDims * TENSOR_BLOCK_CHNS;
+			imageStep = getChnBlocks() * chnStep;
+		}
+		else {
+			imageStep = chns * mapDims;
+			chnStep = mapDims;
+		}
+
+		// over-allocate so that the first map can start on an aligned address
+		int pad = TENSOR_ALIGN_BYTES / sizeof(float);
+		slab = Mat::zeros(1, getTotal() + pad, CV_32FC1);
+		base = (float *)alignPtr(slab.data, TENSOR_ALIGN_BYTES);
+
+		buildViews();
+	}
+
+	void Tensor::release()
+	{
+		views.clear();
+		slab.release();
+		base = NULL;
+		layout = TENSOR_NCHW;
+		numImages = chns = rows = cols = 0;
+		imageStep = chnStep = 0;
+	}
+
+	void Tensor::rebind(const Mat &buffer)
+	{
+		float *aligned = (float *)alignPtr(buffer.data, TENSOR_ALIGN_BYTES);
+		argu::ASSERT(buffer.type() != CV_32FC1 || !buffer.isContinuous() ||
+					 aligned + getTotal() > (float *)buffer.data + buffer.total(),
+					 " buffer too small for the tensor !\n");
+
+		slab = buffer;
+		base = aligned;
+		buildViews();
+	}
+
+	Tensor Tensor::clone() const
+	{
+		Tensor dst;
+		if (!empty()) {
+			dst.create(numImages, chns, rows, cols, layout);
+			copyTo(dst);
+		}
+		return dst;
+	}
+
+	void Tensor::copyTo(Tensor &dst) const
+	{
+		argu::ASSERT(dst.layout != layout || dst.numImages != numImages || dst.chns != chns || 
+					 dst.rows != rows || dst.cols != cols, " tensors of different shapes !\n");
+
+		// every layout fills its slab without gaps
+		memcpy(dst.ptr(), ptr(), getTotal() * sizeof(float));
+	}
+
+	void Tensor::reorderTo(Tensor &dst) const
+	{
+		argu::ASSERT(dst.numImages != numImages || dst.chns != chns || 
+					 dst.rows != rows || dst.cols != cols, " tensors of different shapes !\n");
+		if (dst.layout == layout) {
+			copyTo(dst);
+			return;
+		}
+
+		int mapDims = rows * cols;
+		int B = TENSOR_BLOCK_CHNS;
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			for (int ch = 0; ch < chns; ++ch) {
+				if (layout == TENSOR_NCHW8C) {
+					const float *src = ptr(i, ch / B) + ch % B;
+					float *out = dst.ptr(i, ch);
+					for (int p = 0; p < mapDims; ++p)
+						out[p] = src[p * B];
+				}
+				else if (dst.layout == TENSOR_NCHW8C) {
+					const float *src = ptr(i, ch);
+					float *out = dst.ptr(i, ch / B) + ch % B;
+					for (int p = 0; p < mapDims; ++p)
+						out[p * B] = src[p];
+				}
+				else
+					memcpy(dst.ptr(i, ch), ptr(i, ch), mapDims * sizeof(float));
+			}
+		}
+	}
+
+	void Tensor::setTo(const float value)
+	{
+		int total = getTotal();
+		for (int k = 0; k < total; ++k)
+			base[k] = value;
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+	void Tensor::buildViews()
+	{
+		views.resize(numImages);
+		for (int i = 0; i < numImages; ++i) {
+			views[i].clear();
+			if (layout == TENSOR_NCHW8C)
+				continue;
+
+			views[i].resize(chns);
+			for (int ch = 0; ch < chns; ++ch)
+				views[i][ch] = Mat(rows, cols, CV_32FC1, ptr(i, ch));
+		}
+	}
+}
@@ -0,0 +1,237 @@
+#ifndef _CONVNET_UTILITY_TENSOR_H_
+#define _CONVNET_UTILITY_TENSOR_H_
+#pragma once
+
+#include "types.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// slabs start on a cache line, so do the maps whose offsets are
+	// multiples of 16 floats
+	enum { TENSOR_ALIGN_BYTES = 64 };
+
+	// channels per block of TENSOR_NCHW8C, one AVX register of floats
+	enum { TENSOR_BLOCK_CHNS = 8 };
+
+	enum TensorLayout
+	{
+		TENSOR_NCHW = 0,	// image, channel, row, col
+		TENSOR_CNHW = 1,	// channel major, what gemm writes for a batch
+		TENSOR_NCHW8C = 2	// image, channel block, row, col, 8 channels
+	};
+
+	// --------------------------------------------------------------
+	//
+	// @brief 4D float tensor [numImages x chns x rows x cols] held in
+	//		  one aligned slab with explicit strides
+	//
+	//	Map (i, ch) starts at ptr() + i * imageStep + ch * chnStep
+	//	and is rows x cols continuous floats. The default layout is
+	//	NCHW; the channel-major (CNHW) layout puts channel ch of all
+	//	images side by side, i.e. the maps are the blocks of one
+	//	[chns x (numImages x rows x cols)] matrix that gemm writes
+	//	in one go.
+	//
+	//	NCHW8C interleaves 8 channels per pixel so that one vector
+	//	op covers 8 channels; block cb of image i starts at
+	//	ptr(i, cb) with chnStep = rows x cols x 8, channels past
+	//	chns in the last block are padding. Its maps are not rows x
+	//	cols planes, so t[i][ch] is empty for it.
+	//
+	//	t[i][ch] is a cv::Mat header over map (i, ch) which does not
+	//	own its data; headers are built once by create(). Copies
+	//	of a tensor share the slab, so layers hand their outputs on
+	//	without copying, the same way cv::Mat does.
+	//
+	// --------------------------------------------------------------
+	class Tensor
+	{
+	public:
+		Tensor();
+
+		Tensor(const int numImages, const int chns, const int rows, const int cols,
+			   const TensorLayout layout = TENSOR_NCHW);
+
+		~Tensor() {}
+
+		// zero-filled slab, previous contents are released
+		void create(const int numImages, const int chns, const int rows, const int cols,
+					const TensorLayout layout = TENSOR_NCHW);
+
+		void release();
+
+		// keep shape and layout, the maps move to the first aligned line
+		// of buffer, which needs getTotal() floats past it; buffer is
+		// shared, its contents are kept
+		void rebind(const Mat &buffer);
+
+		// new slab with the same shape and layout
+		Tensor clone() const;
+
+		// dst must have the same shape and layout
+		void copyTo(Tensor &dst) const;
+
+		// dst must have the same shape, any layout
+		void reorderTo(Tensor &dst) const;
+
+		void setTo(const float value);
+
+		inline bool empty() const;
+
+		// number of images, so that t.size() and t[i][ch] read like the
+		// vector<vector<Mat>> they replace
+		inline int size() const;
+
+		inline Mat3D &operator[](const int i);
+
+		inline const Mat3D &operator[](const int i) const;
+
+		// map ch, or channel block ch of NCHW8C
+		inline float *ptr(const int i = 0, const int ch = 0) const;
+
+		// image i as one row of floats, for layouts where it is continuous
+		inline Mat imageView(const int i) const;
+
+		inline TensorLayout getLayout() const;
+
+		inline int getNumImages() const;
+
+		inline int getChns() const;
+
+		inline int getRows() const;
+
+		inline int getCols() const;
+
+		inline int getMapDims() const;
+
+		// ceil(chns / TENSOR_BLOCK_CHNS)
+		inline int getChnBlocks() const;
+
+		inline int getImageStep() const;
+
+		inline int getChnStep() const;
+
+		// floats in the slab, padding lanes of NCHW8C included
+		inline int getTotal() const;
+
+		// NCHW without gaps, image i is chns x rows x cols continuous floats
+		inline bool isPacked() const;
+
+		// maps of channel ch of all images are adjacent
+		inline bool isChannelMajor() const;
+
+	private:
+		void buildViews();
+
+	private:
+		Mat slab;
+		float *base;
+		vector<Mat3D> views;
+		TensorLayout layout;
+
+		int numImages;
+		int chns;
+		int rows;
+		int cols;
+		int imageStep;
+		int chnStep;
+	};
+
+
+	inline bool Tensor::empty() const
+	{
+		return this->numImages == 0;
+	}
+
+	inline int Tensor::size() const
+	{
+		return this->numImages;
+	}
+
+	inline Mat3D &Tensor::operator[](const int i)
+	{
+		return this->views[i];
+	}
+
+	inline const Mat3D &Tensor::operator[](const int i) const
+	{
+		return this->views[i];
+	}
+
+	inline float *Tensor::ptr(const int i, const int ch) const
+	{
+		return this->base + i * imageStep + ch * chnStep;
+	}
+
+	inline Mat Tensor::imageView(const int i) const
+	{
+		return Mat(1, imageStep, CV_32FC1, ptr(i));
+	}
+
+	inline TensorLayout Tensor::getLayout() const
+	{
+		return this->layout;
+	}
+
+	inline int Tensor::getNumImages() const
+	{
+		return this->numImages;
+	}
+
+	inline int Tensor::getChns() const
+	{
+		return this->chns;
+	}
+
+	inline int Tensor::getRows() const
+	{
+		return this->rows;
+	}
+
+	inline int Tensor::getCols() const
+	{
+		return this->cols;
+	}
+
+	inline int Tensor::getMapDims() const
+	{
+		return this->rows * this->cols;
+	}
+
+	inline int Tensor::getChnBlocks() const
+	{
+		return (this->chns + TENSOR_BLOCK_CHNS - 1) / TENSOR_BLOCK_CHNS;
+	}
+
+	inline int Tensor::getImageStep() const
+	{
+		return this->imageStep;
+	}
+
+	inline int Tensor::getChnStep() const
+	{
+		return this->chnStep;
+	}
+
+	inline int Tensor::getTotal() const
+	{
+		return layout == TENSOR_CNHW ? chns * chnStep : numImages * imageStep;
+	}
+
+	inline bool Tensor::isPacked() const
+	{
+		return layout == TENSOR_NCHW || (layout == TENSOR_CNHW && (numImages == 1 || chns == 1));
+	}
+
+	inline bool Tensor::isChannelMajor() const
+	{
+		return layout == TENSOR_CNHW || (layout == TENSOR_NCHW && (numImages == 1 || chns == 1));
+	}
+}
+
+#endif // tensor.h
@@ -7,6 +7,8 @@
 
 namespace convnet
 {
+	// per-image lists of maps, e.g. datasets; layer activations are
+	// held in a Tensor (tensor.h)
 	#define Mat4D std::vector<std::vector<cv::Mat>>
 	#define Mat3D std::vector<cv::Mat>
 }
@@ -0,0 +1,332 @@
+#include "vecmath.h"
+#include <intrin.h>
+
+namespace convnet
+{
+	// inputs past these give 2^k out of the normal range
+	static const float EXP_MAX_INPUT = 88.0f;
+	static const float EXP_MIN_INPUT = -87.0f;
+
+	// sqrt(2 / pi) and the cubic term of the tanh form of GELU
+	static const float GELU_SCALE = 0.7978845608f;
+	static const float GELU_CUBIC = 0.044715f;
+
+	// below this |x| tanh and e^x - 1 would cancel, both accuracies
+	// take their own series there
+	static const float SMALL_INPUT = 0.625f;
+
+	template <bool IS_ACCURATE>
+	static inline __m128 expPs(__m128 x)
+	{
+		x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(EXP_MIN_INPUT)), _mm_set1_ps(EXP_MAX_INPUT));
+
+		// k = round(x / ln2), r = x - k ln2 with ln2 in two parts
+		__m128i k = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504089f)));
+		__m128 kf = _mm_cvtepi32_ps(k);
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(kf, _mm_set1_ps(0.693359375f)));
+		r = _mm_add_ps(r, _mm_mul_ps(kf, _mm_set1_ps(2.12194440e-4f)));
+
+		__m128 p;
+		if (IS_ACCURATE) {
+			// cephes expf: 1 + r + r^2 P(r)
+			p = _mm_set1_ps(1.9875691500e-4f);
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507e-3f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073e-3f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894e-2f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459e-1f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201e-1f));
+			p = _mm_mul_ps(p, _mm_mul_ps(r, r));
+			p = _mm_add_ps(_mm_add_ps(p, r), _mm_set1_ps(1.0f));
+		}
+		else {
+			p = _mm_set1_ps(1.0f / 24);
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f / 6));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(0.5f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+			p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.0f));
+		}
+
+		__m128i bits = _mm_slli_epi32(_mm_add_epi32(k, _mm_set1_epi32(127)), 23);
+		return _mm_mul_ps(p, _mm_castsi128_ps(bits));
+	}
+
+	// a / b, the fast one is a reciprocal estimate and a Newton step
+	template <bool IS_ACCURATE>
+	static inline __m128 divPs(__m128 a, __m128 b)
+	{
+		if (IS_ACCURATE)
+			return _mm_div_ps(a, b);
+		__m128 rcp = _mm_rcp_ps(b);
+		rcp = _mm_mul_ps(rcp, _mm_sub_ps(_mm_set1_ps(2.0f), _mm_mul_ps(b, rcp)));
+		return _mm_mul_ps(a, rcp);
+	}
+
+	static inline __m128 selectPs(__m128 mask, __m128 a, __m128 b)
+	{
+		return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+	}
+
+	static inline __m128 absPs(__m128 x)
+	{
+		return _mm_andnot_ps(_mm_set1_ps(-0.0f), x);
+	}
+
+	template <bool IS_ACCURATE>
+	static inline __m128 sigmoidPs(__m128 x)
+	{
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 e = expPs<IS_ACCURATE>(_mm_sub_ps(_mm_setzero_ps(), x));
+		return divPs<IS_ACCURATE>(one, _mm_add_ps(one, e));
+	}
+
+	template <bool IS_ACCURATE>
+	static inline __m128 tanhPs(__m128 x)
+	{
+		// 1 - 2 / (e^2x + 1)
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 e = expPs<IS_ACCURATE>(_mm_add_ps(x, x));
+		__m128 y = _mm_sub_ps(one, divPs<IS_ACCURATE>(_mm_set1_ps(2.0f), _mm_add_ps(e, one)));
+
+		// cephes tanhf: x + x z P(z), z = x^2 for small |x|
+		__m128 z = _mm_mul_ps(x, x);
+		__m128 p = _mm_set1_ps(-5.70498872745e-3f);
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(2.06390887954e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-5.37397155531e-2f));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.33314422036e-1f));
+		p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(-3.33332819422e-1f));
+		__m128 small = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, z), p));
+		return selectPs(_mm_cmplt_ps(absPs(x), _mm_set1_ps(SMALL_INPUT)), small, y);
+	}
+
+	template <bool IS_ACCURATE>
+	static inline __m128 expm1Ps(__m128 x)
+	{
+		__m128 y = _mm_sub_ps(expPs<IS_ACCURATE>(x), _mm_set1_ps(1.0f));
+
+		// x + x^2 / 2! + ... + x^8 / 8! for small |x|
+		__m128 p = _mm_set1_ps(1.0f / 40320);
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.0f / 5040));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.0f / 720));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.0f / 120));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.0f / 24));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(1.0f / 6));
+		p = _mm_add_ps(_mm_mul_ps(p, x), _mm_set1_ps(0.5f));
+		__m128 small = _mm_add_ps(x, _mm_mul_ps(_mm_mul_ps(x, x), p));
+		return selectPs(_mm_cmplt_ps(absPs(x), _mm_set1_ps(SMALL_INPUT)), small, y);
+	}
+
+	// 2 sqrt(2 / pi) (x + 0.044715 x^3)
+	static inline __m128 geluArgPs(__m128 x)
+	{
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 u = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(_mm_set1_ps(GELU_CUBIC), x2));
+		return _mm_mul_ps(_mm_set1_ps(2.0f * GELU_SCALE), _mm_mul_ps(x, u));
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//					   one pass per function, tails go masked
+	//
+	// ----------------------------------------------------------------------------
+
+	// loads of the last n % 4 values are padded with zeros, stores only
+	// write the valid lanes
+	static inline __m128 loadTail(const float *src, const int n)
+	{
+		float buf[4] = { 0, 0, 0, 0 };
+		for (int j = 0; j < n; ++j)
+			buf[j] = src[j];
+		return _mm_loadu_ps(buf);
+	}
+
+	static inline void storeTail(float *dst, __m128 v, const int n)
+	{
+		float buf[4];
+		_mm_storeu_ps(buf, v);
+		for (int j = 0; j < n; ++j)
+			dst[j] = buf[j];
+	}
+
+	template <bool IS_ACCURATE>
+	static void expLoop(float *y, const float *x, const int n)
+	{
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(y + k, expPs<IS_ACCURATE>(_mm_loadu_ps(x + k)));
+		if (k < n)
+			storeTail(y + k, expPs<IS_ACCURATE>(loadTail(x + k, n - k)), n - k);
+	}
+
+	template <bool IS_ACCURATE>
+	static void sigmoidLoop(float *y, const float *x, const int n)
+	{
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(y + k, sigmoidPs<IS_ACCURATE>(_mm_loadu_ps(x + k)));
+		if (k < n)
+			storeTail(y + k, sigmoidPs<IS_ACCURATE>(loadTail(x + k, n - k)), n - k);
+	}
+
+	template <bool IS_ACCURATE>
+	static void tanhLoop(float *y, const float *x, const int n)
+	{
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(y + k, tanhPs<IS_ACCURATE>(_mm_loadu_ps(x + k)));
+		if (k < n)
+			storeTail(y + k, tanhPs<IS_ACCURATE>(loadTail(x + k, n - k)), n - k);
+	}
+
+	template <bool IS_ACCURATE>
+	static inline __m128 eluPs(__m128 x, __m128 alpha)
+	{
+		__m128 neg = _mm_mul_ps(alpha, expm1Ps<IS_ACCURATE>(x));
+		return selectPs(_mm_cmpgt_ps(x, _mm_setzero_ps()), x, neg);
+	}
+
+	template <bool IS_ACCURATE>
+	static void eluLoop(float *y, const float *x, const int n, const float alpha)
+	{
+		__m128 a = _mm_set1_ps(alpha);
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(y + k, eluPs<IS_ACCURATE>(_mm_loadu_ps(x + k), a));
+		if (k < n)
+			storeTail(y + k, eluPs<IS_ACCURATE>(loadTail(x + k, n - k), a), n - k);
+	}
+
+	template <bool IS_ACCURATE>
+	static inline __m128 geluPs(__m128 x)
+	{
+		return _mm_mul_ps(x, sigmoidPs<IS_ACCURATE>(geluArgPs(x)));
+	}
+
+	template <bool IS_ACCURATE>
+	static void geluLoop(float *y, const float *x, const int n)
+	{
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(y + k, geluPs<IS_ACCURATE>(_mm_loadu_ps(x + k)));
+		if (k < n)
+			storeTail(y + k, geluPs<IS_ACCURATE>(loadTail(x + k, n - k)), n - k);
+	}
+
+	// d/dx x s(v) = s + 2 x s (1 - s) sqrt(2 / pi) (1 + 3 0.044715 x^2)
+	template <bool IS_ACCURATE>
+	static inline __m128 geluGradPs(__m128 x, __m128 dy)
+	{
+		__m128 one = _mm_set1_ps(1.0f);
+		__m128 s = sigmoidPs<IS_ACCURATE>(geluArgPs(x));
+		__m128 x2 = _mm_mul_ps(x, x);
+		__m128 du = _mm_add_ps(one, _mm_mul_ps(_mm_set1_ps(3.0f * GELU_CUBIC), x2));
+		du = _mm_mul_ps(_mm_set1_ps(2.0f * GELU_SCALE), du);
+		__m128 ds = _mm_mul_ps(_mm_mul_ps(s, _mm_sub_ps(one, s)), _mm_mul_ps(x, du));
+		return _mm_mul_ps(dy, _mm_add_ps(s, ds));
+	}
+
+	template <bool IS_ACCURATE>
+	static void geluGradLoop(float *dx, const float *x, const float *dy, const int n)
+	{
+		int k = 0;
+		for (; k + 4 <= n; k += 4)
+			_mm_storeu_ps(dx + k, geluGradPs<IS_ACCURATE>(_mm_loadu_ps(x + k), _mm_loadu_ps(dy + k)));
+		if (k < n) {
+			__m128 g = geluGradPs<IS_ACCURATE>(loadTail(x + k, n - k), loadTail(dy + k, n - k));
+			storeTail(dx + k, g, n - k);
+		}
+	}
+
+
+	void vecExp(float *y, const float *x, const int n, const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			expLoop<true>(y, x, n);
+		else
+			expLoop<false>(y, x, n);
+	}
+
+	void vecSigmoid(float *y, const float *x, const int n, const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			sigmoidLoop<true>(y, x, n);
+		else
+			sigmoidLoop<false>(y, x, n);
+	}
+
+	void vecSigmoidGrad(float *dx, const float *y, const float *dy, const int n)
+	{
+		__m128 one = _mm_set1_ps(1.0f);
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 s = _mm_loadu_ps(y + k);
+			__m128 g = _mm_mul_ps(_mm_mul_ps(s, _mm_sub_ps(one, s)), _mm_loadu_ps(dy + k));
+			_mm_storeu_ps(dx + k, g);
+		}
+		for (; k < n; ++k)
+			dx[k] = y[k] * (1 - y[k]) * dy[k];
+	}
+
+	void vecTanh(float *y, const float *x, const int n, const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			tanhLoop<true>(y, x, n);
+		else
+			tanhLoop<false>(y, x, n);
+	}
+
+	void vecTanhGrad(float *dx, const float *y, const float *dy, const int n)
+	{
+		__m128 one = _mm_set1_ps(1.0f);
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 t = _mm_loadu_ps(y + k);
+			__m128 g = _mm_mul_ps(_mm_sub_ps(one, _mm_mul_ps(t, t)), _mm_loadu_ps(dy + k));
+			_mm_storeu_ps(dx + k, g);
+		}
+		for (; k < n; ++k)
+			dx[k] = (1 - y[k] * y[k]) * dy[k];
+	}
+
+	void vecELU(float *y, const float *x, const int n, const float alpha,
+				const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			eluLoop<true>(y, x, n, alpha);
+		else
+			eluLoop<false>(y, x, n, alpha);
+	}
+
+	// y > 0 exactly where x > 0, below it dy/dx = e^x alpha = y + alpha
+	void vecELUGrad(float *dx, const float *y, const float *dy, const int n,
+					const float alpha)
+	{
+		__m128 a = _mm_set1_ps(alpha);
+		__m128 one = _mm_set1_ps(1.0f);
+		int k = 0;
+		for (; k + 4 <= n; k += 4) {
+			__m128 v = _mm_loadu_ps(y + k);
+			__m128 slope = selectPs(_mm_cmpgt_ps(v, _mm_setzero_ps()), one, _mm_add_ps(v, a));
+			_mm_storeu_ps(dx + k, _mm_mul_ps(slope, _mm_loadu_ps(dy + k)));
+		}
+		for (; k < n; ++k)
+			dx[k] = (y[k] > 0 ? 1 : y[k] + alpha) * dy[k];
+	}
+
+	void vecGELU(float *y, const float *x, const int n, const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			geluLoop<true>(y, x, n);
+		else
+			geluLoop<false>(y, x, n);
+	}
+
+	void vecGELUGrad(float *dx, const float *x, const float *dy, const int n,
+					 const MathAccuracy accuracy)
+	{
+		if (accuracy == MATH_ACCURATE)
+			geluGradLoop<true>(dx, x, dy, n);
+		else
+			geluGradLoop<false>(dx, x, dy, n);
+	}
+}
@@ -0,0 +1,51 @@
+#ifndef _CONVNET_UTILITY_VECMATH_H_
+#define _CONVNET_UTILITY_VECMATH_H_
+#pragma once
+
+namespace convnet
+{
+	// MATH_FAST uses a degree-4 exp polynomial (relative error about
+	// 6e-5) and reciprocal estimates, MATH_ACCURATE a degree-7 one
+	// (within 1-2 ulp) with exact divisions
+	enum MathAccuracy
+	{
+		MATH_FAST = 0,
+		MATH_ACCURATE = 1
+	};
+
+	// --------------------------------------------------------------
+	//
+	// @brief activations and their derivatives over n continuous
+	//		  floats in one SSE pass, exp is 2^k x p(r) with
+	//		  x = k ln2 + r, |r| <= ln2 / 2
+	//
+	//	y may alias x and dx may alias dy. The derivatives take
+	//	what the activation keeps: its outputs y, or its inputs x
+	//	for GELU.
+	//
+	// --------------------------------------------------------------
+	void vecExp(float *y, const float *x, const int n, const MathAccuracy accuracy);
+
+	void vecSigmoid(float *y, const float *x, const int n, const MathAccuracy accuracy);
+
+	void vecSigmoidGrad(float *dx, const float *y, const float *dy, const int n);
+
+	void vecTanh(float *y, const float *x, const int n, const MathAccuracy accuracy);
+
+	void vecTanhGrad(float *dx, const float *y, const float *dy, const int n);
+
+	// x for x > 0, alpha (e^x - 1) otherwise
+	void vecELU(float *y, const float *x, const int n, const float alpha,
+				const MathAccuracy accuracy);
+
+	void vecELUGrad(float *dx, const float *y, const float *dy, const int n,
+					const float alpha);
+
+	// tanh form, x sigmoid(2 sqrt(2 / pi) (x + 0.044715 x^3))
+	void vecGELU(float *y, const float *x, const int n, const MathAccuracy accuracy);
+
+	void vecGELUGrad(float *dx, const float *x, const float *dy, const int n,
+					 const MathAccuracy accuracy);
+}
+
+#endif // vecmath.h
@@ -0,0 +1,422 @@
+#include "check.h"
+#include "sgemm.h"
+#include "winograd.h"
+#include <string.h>
+#include <algorithm>
+#include <opencv2/core/core.hpp>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace convnet
+{
+	// -----------------------------------------------------------------
+	// transform matrices (Lavin & Gray), row major
+	// -----------------------------------------------------------------
+	static const float BT_F2[4 * 4] = {
+		1,  0, -1,  0,
+		0,  1,  1,  0,
+		0, -1,  1,  0,
+		0,  1,  0, -1
+	};
+
+	static const float G_F2[4 * 3] = {
+		1.0f,  0.0f, 0.0f,
+		0.5f,  0.5f, 0.5f,
+		0.5f, -0.5f, 0.5f,
+		0.0f,  0.0f, 1.0f
+	};
+
+	static const float AT_F2[2 * 4] = {
+		1, 1,  1,  0,
+		0, 1, -1, -1
+	};
+
+	static const float BT_F4[6 * 6] = {
+		4,  0, -5,  0, 1, 0,
+		0, -4, -4,  1, 1, 0,
+		0,  4, -4, -1, 1, 0,
+		0, -2, -1,  2, 1, 0,
+		0,  2, -1, -2, 1, 0,
+		0,  4,  0, -5, 0, 1
+	};
+
+	static const float G_F4[6 * 3] = {
+		 1.0f / 4,   0.0f,       0.0f,
+		-1.0f / 6,  -1.0f / 6,  -1.0f / 6,
+		-1.0f / 6,   1.0f / 6,  -1.0f / 6,
+		 1.0f / 24,  1.0f / 12,  1.0f / 6,
+		 1.0f / 24, -1.0f / 12,  1.0f / 6,
+		 0.0f,       0.0f,       1.0f
+	};
+
+	static const float AT_F4[4 * 6] = {
+		1, 1,  1, 1,  1, 0,
+		0, 1, -1, 2, -2, 0,
+		0, 1,  1, 4,  4, 0,
+		0, 1, -1, 8, -8, 1
+	};
+
+	enum { WINOGRAD_MAX_ALPHA = 6 };
+
+	// Z[p x q] = L[p x n] * X[n x n'] * R^T, R is [q x n']
+	// (transLeft reads L as [n x p]^T, transRight reads R as [n' x q]^T)
+	static void sandwich(float *Z, const float *L, const float *X, const float *R,
+						 const int p, const int n, const int nn, const int q,
+						 const bool transLeft, const bool transRight)
+	{
+		float tmp[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+		for (int i = 0; i < p; ++i) {
+			for (int j = 0; j < nn; ++j) {
+				float acc = 0;
+				for (int k = 0; k < n; ++k)
+					acc += (transLeft ? L[k * p + i] : L[i * n + k]) * X[k * nn + j];
+				tmp[i * nn + j] = acc;
+			}
+		}
+		for (int i = 0; i < p; ++i) {
+			for (int j = 0; j < q; ++j) {
+				float acc = 0;
+				for (int k = 0; k < nn; ++k)
+					acc += tmp[i * nn + k] * (transRight ? R[k * q + j] : R[j * nn + k]);
+				Z[i * q + j] = acc;
+			}
+		}
+	}
+
+
+	bool WinogradConv::isSupported(const WeightGeometry &wparams,
+								   const StrideGeometry &strides)
+	{
+		return wparams.width == 3 && wparams.height == 3 &&
+			   strides.stepRow == 1 && strides.stepCol == 1;
+	}
+
+	void WinogradConv::init(const int tileSize,
+							const WeightGeometry &wparams,
+							const PadGeometry &padding,
+							const int numImages,
+							const int inChns,
+							const int ouRows,
+							const int ouCols)
+	{
+		argu::ASSERT(tileSize != 2 && tileSize != 4, " winograd only supports F(2x2, 3x3) / F(4x4, 3x3) !\n");
+
+		this->tileSize = tileSize;
+		this->alpha = tileSize + 2;
+		this->wparams = wparams;
+		this->padding = padding;
+		this->numImages = numImages;
+		this->inChns = inChns;
+		this->ouRows = ouRows;
+		this->ouCols = ouCols;
+		this->tileRows = (ouRows + tileSize - 1) / tileSize;
+		this->tileCols = (ouCols + tileSize - 1) / tileSize;
+		this->numTiles = numImages * tileRows * tileCols;
+
+		BT = tileSize == 2 ? BT_F2 : BT_F4;
+		G = tileSize == 2 ? G_F2 : G_F4;
+		AT = tileSize == 2 ? AT_F2 : AT_F4;
+
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		U = Mat::zeros(wparams.numGroups * alpha2 * groupWeights, wparams.weightChns, CV_32FC1);
+		dU = Mat::zeros(U.size(), CV_32FC1);
+		V = Mat::zeros(alpha2 * inChns, numTiles, CV_32FC1);
+		M = Mat::zeros(alpha2 * wparams.numWeights, numTiles, CV_32FC1);
+		isFilterStale = true;
+	}
+
+	void WinogradConv::fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+							 const Mat3D &weights, const Mat &bias)
+	{
+		if (isFilterStale) {
+			transformFilters(weights);
+			isFilterStale = false;
+		}
+
+		transformInputs(inFeatMaps);
+
+		// M(g, xi) = U(g, xi) * V(g, xi) for every tile position xi
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int xi = 0; xi < alpha2; ++xi) {
+				int gxi = g * alpha2 + xi;
+				sgemm(false, false, groupWeights, numTiles, groupChns, 1.0f,
+					  CV_MAT_PRF(U) + gxi * groupWeights * groupChns, groupChns,
+					  CV_MAT_PRF(V) + gxi * groupChns * numTiles, numTiles,
+					  0.0f, CV_MAT_PRF(M) + gxi * groupWeights * numTiles, numTiles);
+			}
+		}
+
+		transformOutputs(ouFeatMaps, bias);
+	}
+
+	void WinogradConv::bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+									const Tensor &inFeatMaps, const bool isInputCached)
+	{
+		if (!isInputCached)
+			transformInputs(inFeatMaps);
+		transformDeltas(currLayerDelta);
+
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+
+		// dU(g, xi) = dM(g, xi) * V(g, xi)^T
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int xi = 0; xi < alpha2; ++xi) {
+				int gxi = g * alpha2 + xi;
+				sgemm(false, true, groupWeights, groupChns, numTiles, 1.0f,
+					  CV_MAT_PRF(M) + gxi * groupWeights * numTiles, numTiles,
+					  CV_MAT_PRF(V) + gxi * groupChns * numTiles, numTiles,
+					  0.0f, CV_MAT_PRF(dU) + gxi * groupWeights * groupChns, groupChns);
+			}
+		}
+		untransformFilterGrads(weightGrads);
+	}
+
+	void WinogradConv::bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+								 const Mat3D &weights, const bool isDeltaCached)
+	{
+		if (isFilterStale) {
+			transformFilters(weights);
+			isFilterStale = false;
+		}
+		if (!isDeltaCached)
+			transformDeltas(currLayerDelta);
+
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+
+		// dV(g, xi) = U(g, xi)^T * dM(g, xi), written over V
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int xi = 0; xi < alpha2; ++xi) {
+				int gxi = g * alpha2 + xi;
+				sgemm(true, false, groupChns, numTiles, groupWeights, 1.0f,
+					  CV_MAT_PRF(U) + gxi * groupWeights * groupChns, groupChns,
+					  CV_MAT_PRF(M) + gxi * groupWeights * numTiles, numTiles,
+					  0.0f, CV_MAT_PRF(V) + gxi * groupChns * numTiles, numTiles);
+			}
+		}
+		untransformInputGrads(prevLayerDelta);
+	}
+
+
+	// ----------------------------------------------------------------------------
+	//
+	//								private function impl
+	//
+	// ----------------------------------------------------------------------------
+
+	// U = G g G^T
+	void WinogradConv::transformFilters(const Mat3D &weights)
+	{
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		float u[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+		float *UPtr = CV_MAT_PRF(U);
+
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int k = 0; k < groupWeights; ++k) {
+				const float *w = CV_MAT_PRF(weights[g]) + k * weights[g].cols;
+				for (int c = 0; c < groupChns; ++c) {
+					sandwich(u, G, w + c * 9, G, alpha, 3, 3, alpha, false, false);
+					for (int xi = 0; xi < alpha2; ++xi)
+						UPtr[((g * alpha2 + xi) * groupWeights + k) * groupChns + c] = u[xi];
+				}
+			}
+		}
+	}
+
+	// V = B^T d B
+	void WinogradConv::transformInputs(const Tensor &inFeatMaps)
+	{
+		int alpha2 = alpha * alpha;
+		int groupChns = wparams.weightChns;
+		int inRows = inFeatMaps[0][0].rows;
+		int inCols = inFeatMaps[0][0].cols;
+		float *VPtr = CV_MAT_PRF(V);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float d[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			float v[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			for (int ch = 0; ch < inChns; ++ch) {
+				int g = ch / groupChns;
+				int c = ch % groupChns;
+				const float *imagePtr = CV_MAT_PRF(inFeatMaps[i][ch]);
+				for (int ty = 0; ty < tileRows; ++ty) {
+					for (int tx = 0; tx < tileCols; ++tx) {
+						int r0 = ty * tileSize - padding.top;
+						int c0 = tx * tileSize - padding.left;
+						for (int r = 0; r < alpha; ++r) {
+							for (int cc = 0; cc < alpha; ++cc) {
+								int ir = r0 + r, ic = c0 + cc;
+								d[r * alpha + cc] = (ir < 0 || ir >= inRows || ic < 0 || ic >= inCols) ?
+													0 : CV_MAT_AT(imagePtr, ir, ic, inCols);
+							}
+						}
+						sandwich(v, BT, d, BT, alpha, alpha, alpha, alpha, false, false);
+
+						int p = (i * tileRows + ty) * tileCols + tx;
+						for (int xi = 0; xi < alpha2; ++xi)
+							VPtr[((g * alpha2 + xi) * groupChns + c) * numTiles + p] = v[xi];
+					}
+				}
+			}
+		}
+	}
+
+	// Y = A^T M A
+	void WinogradConv::transformOutputs(Tensor &ouFeatMaps, const Mat &bias)
+	{
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		const float *MPtr = CV_MAT_PRF(M);
+		const float *biasPtr = bias.empty() ? NULL : CV_MAT_PRF(bias);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float m[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			float y[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			for (int ch = 0; ch < wparams.numWeights; ++ch) {
+				int g = ch / groupWeights;
+				int k = ch % groupWeights;
+				float b = biasPtr == NULL ? 0 : biasPtr[ch];
+				float *ouMapPtr = CV_MAT_PRF(ouFeatMaps[i][ch]);
+				for (int ty = 0; ty < tileRows; ++ty) {
+					for (int tx = 0; tx < tileCols; ++tx) {
+						int p = (i * tileRows + ty) * tileCols + tx;
+						for (int xi = 0; xi < alpha2; ++xi)
+							m[xi] = MPtr[((g * alpha2 + xi) * groupWeights + k) * numTiles + p];
+						sandwich(y, AT, m, AT, tileSize, alpha, alpha, tileSize, false, false);
+
+						int rmax = min(tileSize, ouRows - ty * tileSize);
+						int cmax = min(tileSize, ouCols - tx * tileSize);
+						for (int r = 0; r < rmax; ++r) {
+							for (int c = 0; c < cmax; ++c)
+								CV_MAT_AT(ouMapPtr, ty * tileSize + r, tx * tileSize + c, ouCols) =
+									y[r * tileSize + c] + b;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// dM = A dY A^T, adjoint of the output transform
+	void WinogradConv::transformDeltas(const Tensor &currLayerDelta)
+	{
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		float *MPtr = CV_MAT_PRF(M);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float dy[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			float dm[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			for (int ch = 0; ch < wparams.numWeights; ++ch) {
+				int g = ch / groupWeights;
+				int k = ch % groupWeights;
+				const float *deltaPtr = CV_MAT_PRF(currLayerDelta[i][ch]);
+				for (int ty = 0; ty < tileRows; ++ty) {
+					for (int tx = 0; tx < tileCols; ++tx) {
+						for (int r = 0; r < tileSize; ++r) {
+							for (int c = 0; c < tileSize; ++c) {
+								int orow = ty * tileSize + r, ocol = tx * tileSize + c;
+								dy[r * tileSize + c] = (orow >= ouRows || ocol >= ouCols) ?
+													   0 : CV_MAT_AT(deltaPtr, orow, ocol, ouCols);
+							}
+						}
+						sandwich(dm, AT, dy, AT, alpha, tileSize, tileSize, alpha, true, true);
+
+						int p = (i * tileRows + ty) * tileCols + tx;
+						for (int xi = 0; xi < alpha2; ++xi)
+							MPtr[((g * alpha2 + xi) * groupWeights + k) * numTiles + p] = dm[xi];
+					}
+				}
+			}
+		}
+	}
+
+	// dg = G^T dU G, adjoint of the filter transform
+	void WinogradConv::untransformFilterGrads(Mat3D &weightGrads)
+	{
+		int alpha2 = alpha * alpha;
+		int groupWeights = wparams.numWeights / wparams.numGroups;
+		int groupChns = wparams.weightChns;
+		float du[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+		const float *dUPtr = CV_MAT_PRF(dU);
+
+		for (int g = 0; g < wparams.numGroups; ++g) {
+			for (int k = 0; k < groupWeights; ++k) {
+				float *dw = CV_MAT_PRF(weightGrads[g]) + k * weightGrads[g].cols;
+				for (int c = 0; c < groupChns; ++c) {
+					for (int xi = 0; xi < alpha2; ++xi)
+						du[xi] = dUPtr[((g * alpha2 + xi) * groupWeights + k) * groupChns + c];
+					sandwich(dw + c * 9, G, du, G, 3, alpha, alpha, 3, true, true);
+				}
+			}
+		}
+	}
+
+	// dd = B dV B^T, adjoint of the input transform, overlapping tiles accumulate
+	void WinogradConv::untransformInputGrads(Tensor &prevLayerDelta)
+	{
+		int alpha2 = alpha * alpha;
+		int groupChns = wparams.weightChns;
+		int inRows = prevLayerDelta[0][0].rows;
+		int inCols = prevLayerDelta[0][0].cols;
+		const float *VPtr = CV_MAT_PRF(V);
+
+		#ifdef _OPENMP
+		#pragma omp parallel for
+		#endif
+
+		for (int i = 0; i < numImages; ++i) {
+			float dv[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			float dd[WINOGRAD_MAX_ALPHA * WINOGRAD_MAX_ALPHA];
+			for (int ch = 0; ch < inChns; ++ch) {
+				int g = ch / groupChns;
+				int c = ch % groupChns;
+				float *deltaPtr = CV_MAT_PRF(prevLayerDelta[i][ch]);
+				memset(deltaPtr, 0, inRows * inCols * sizeof(float));
+				for (int ty = 0; ty < tileRows; ++ty) {
+					for (int tx = 0; tx < tileCols; ++tx) {
+						int p = (i * tileRows + ty) * tileCols + tx;
+						for (int xi = 0; xi < alpha2; ++xi)
+							dv[xi] = VPtr[((g * alpha2 + xi) * groupChns + c) * numTiles + p];
+						sandwich(dd, BT, dv, BT, alpha, alpha, alpha, alpha, true, true);
+
+						int r0 = ty * tileSize - padding.top;
+						int c0 = tx * tileSize - padding.left;
+						for (int r = 0; r < alpha; ++r) {
+							int ir = r0 + r;
+							if (ir < 0 || ir >= inRows) continue;
+							for (int cc = 0; cc < alpha; ++cc) {
+								int ic = c0 + cc;
+								if (ic >= 0 && ic < inCols)
+									CV_MAT_AT(deltaPtr, ir, ic, inCols) += dd[r * alpha + cc];
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+}
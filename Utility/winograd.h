@@ -0,0 +1,119 @@
+#ifndef _CONVNET_UTILITY_WINOGRAD_H_
+#define _CONVNET_UTILITY_WINOGRAD_H_
+#pragma once
+
+#include "types.h"
+#include "tensor.h"
+#include "param.h"
+#include <vector>				 // vector
+#include <opencv2/core/core.hpp> // Mat
+
+namespace convnet
+{
+	using namespace std;
+	using namespace cv;
+
+	// --------------------------------------------------------------
+	//
+	// @brief Winograd minimal filtering F(m x m, 3 x 3) for stride-1
+	//		  3 x 3 convolutions, m = 2 or 4
+	//
+	//	Y = A^T [(G g G^T) .* (B^T d B)] A for every m x m output tile.
+	//	The element-wise products of all tiles of the minibatch are
+	//	batched into (m + 2)^2 matrix multiplications per group. The
+	//	backward passes use the exact adjoints of the same transforms
+	//	so they reuse the cached filter transform U and the input
+	//	transform V kept by fprop when it ran on this engine too.
+	//
+	// --------------------------------------------------------------
+	class WinogradConv
+	{
+	public:
+		WinogradConv() : tileSize(0), isFilterStale(true) {}
+
+		~WinogradConv() {}
+
+		static bool isSupported(const WeightGeometry &wparams,
+								const StrideGeometry &strides);
+
+		void init(const int tileSize,
+				  const WeightGeometry &wparams,
+				  const PadGeometry &padding,
+				  const int numImages,
+				  const int inChns,
+				  const int ouRows,
+				  const int ouCols);
+
+		// filter transform is recomputed on next fprop
+		inline void setFilterStale();
+
+		// buffers written before they are read in each pass, i.e. free
+		// between fprop and bprop; V only if bpropWeights rebuilds it
+		inline void getWorkspaces(vector<Mat *> &workspaces, const bool isInputCached);
+
+		void fprop(Tensor &ouFeatMaps, const Tensor &inFeatMaps,
+				   const Mat3D &weights, const Mat &bias);
+
+		// wgrad, V is rebuilt from inFeatMaps unless fprop of this
+		// engine left it there (isInputCached)
+		void bpropWeights(Mat3D &weightGrads, const Tensor &currLayerDelta,
+						  const Tensor &inFeatMaps, const bool isInputCached);
+
+		// dgrad, M is rebuilt from currLayerDelta unless bpropWeights
+		// of this engine left it there (isDeltaCached); overwrites V
+		void bpropData(Tensor &prevLayerDelta, const Tensor &currLayerDelta,
+					   const Mat3D &weights, const bool isDeltaCached);
+
+	private:
+		void transformFilters(const Mat3D &weights);
+
+		void transformInputs(const Tensor &inFeatMaps);
+
+		void transformOutputs(Tensor &ouFeatMaps, const Mat &bias);
+
+		void transformDeltas(const Tensor &currLayerDelta);
+
+		void untransformFilterGrads(Mat3D &weightGrads);
+
+		void untransformInputGrads(Tensor &prevLayerDelta);
+
+	private:
+		Mat U;  // [numGroups x alpha^2 x groupWeights x groupChns]
+		Mat V;  // [numGroups x alpha^2 x groupChns x numTiles]
+		Mat M;  // [numGroups x alpha^2 x groupWeights x numTiles]
+		Mat dU; // same layout as U
+		WeightGeometry wparams;
+		PadGeometry padding;
+
+		const float *BT; // [alpha x alpha]
+		const float *G;  // [alpha x 3]
+		const float *AT; // [m x alpha]
+
+		int tileSize;
+		int alpha;
+		int numImages;
+		int inChns;
+		int ouRows;
+		int ouCols;
+		int tileRows;
+		int tileCols;
+		int numTiles;
+		bool isFilterStale;
+	};
+
+
+	inline void WinogradConv::setFilterStale()
+	{
+		this->isFilterStale = true;
+	}
+
+	inline void WinogradConv::getWorkspaces(vector<Mat *> &workspaces, const bool isInputCached)
+	{
+		workspaces.push_back(&M);
+		workspaces.push_back(&dU);
+		if (!isInputCached)
+			workspaces.push_back(&V);
+	}
+}
+
+#endif // winograd.h